@@ -7,8 +7,11 @@
 //
 
 #import "ViewController.h"
+#import "Config.hpp"
 #import "Engine.hpp"
 
+#include <vector>
+
 inline NSString* resourcePath(NSString* component)
 {
     return [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:component];
@@ -32,7 +35,13 @@ inline NSString* resourcePath(NSString* component)
     // Set up the sound engine
     try {
         // Initialize and configure the audio session
-        engine = new Engine([resourcePath(@"sounds") UTF8String]);
+        Engine::Options options([resourcePath(@"sounds") UTF8String]);
+        // Override the defaults with an engine.conf in the app bundle
+        NSString* configPath = resourcePath(@"engine.conf");
+        if ([[NSFileManager defaultManager] fileExistsAtPath:configPath]) {
+            loadEngineOptions([configPath UTF8String], options);
+        }
+        engine = new Engine(options);
     } catch (std::exception& e) {
         std::cerr << e.what() << std::endl;
     }
@@ -53,25 +62,37 @@ inline NSString* resourcePath(NSString* component)
 
 - (void) touchesBegan:(NSSet*)touches withEvent:(UIEvent*)event
 {
+    // Start all new touches in the same request so that chords start together
+    std::vector<Engine::VoiceStart> voices;
+    voices.reserve(touches.count);
     for (UITouch* touch in touches) {
 	    const CGPoint pt = [self relativeLocation:touch inView:self.view];
-	    engine->startVoice(reinterpret_cast<intptr_t>(touch), engine->nextSound(), pt.x);
+        // Touch timestamps use the system uptime clock, which is what
+        // steady_clock measures on Apple platforms.
+        voices.push_back({ reinterpret_cast<intptr_t>(touch), engine->nextSound(), float(pt.x), touch.timestamp });
     }
+    engine->startVoices(voices.data(), voices.size());
 }
 
 - (void) touchesMoved:(NSSet*)touches withEvent:(UIEvent*)event
 {
+    std::vector<Engine::VoiceUpdate> voices;
+    voices.reserve(touches.count);
     for (UITouch* touch in touches) {
 	    const CGPoint pt = [self relativeLocation:touch inView:self.view];
-        engine->updateVoice(reinterpret_cast<intptr_t>(touch), pt.x);
+        voices.push_back({ reinterpret_cast<intptr_t>(touch), float(pt.x) });
     }
+    engine->updateVoices(voices.data(), voices.size());
 }
 
 - (void) touchesEnded:(NSSet *)touches withEvent:(UIEvent *)event
 {
+    std::vector<Engine::VoiceId> voices;
+    voices.reserve(touches.count);
     for (UITouch* touch in touches) {
-    	engine->stopVoice(reinterpret_cast<intptr_t>(touch));
+        voices.push_back(reinterpret_cast<intptr_t>(touch));
     }
+    engine->stopVoices(voices.data(), voices.size());
 }
 
 - (void) touchesCancelled:(NSSet *)touches withEvent:(UIEvent *)event
@@ -0,0 +1,125 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Headless driver for running the sampler engine on Linux, e.g. under perf.
+//
+// Usage: methcla-sampler [-c CONFIG] [SOUND_DIR [SECONDS [NOTES_PER_SECOND [POLYPHONY]]]]
+//
+// Plays a stream of notes with pseudo-random rates, cycling through all
+// sounds in SOUND_DIR, and keeps at most POLYPHONY voices sounding. Engine
+// options are read from CONFIG if given (see Config.hpp).
+
+#include "Config.hpp"
+#include "Engine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+int main(int argc, const char* argv[])
+{
+    std::string configPath;
+    if (argc > 2 && std::string(argv[1]) == "-c") {
+        configPath = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    const std::string soundDir = argc > 1 ? argv[1] : "sounds/7773__hoobtastic__acoustic-guitar/sounds";
+    const double seconds = argc > 2 ? std::atof(argv[2]) : 10.;
+    const double notesPerSecond = argc > 3 ? std::atof(argv[3]) : 10.;
+    const size_t polyphony = argc > 4 ? std::atoi(argv[4]) : 8;
+
+    if (seconds <= 0. || notesPerSecond <= 0. || polyphony == 0) {
+        std::cerr << "Usage: " << argv[0] << " [-c CONFIG] [SOUND_DIR [SECONDS [NOTES_PER_SECOND [POLYPHONY]]]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        Engine::Options options(soundDir);
+        options.soundIndexPath = soundDir + "/.methcla-sound-index";
+        if (!configPath.empty()) {
+            loadEngineOptions(configPath, options);
+        }
+        Engine engine(options);
+
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> param(0.f, 1.f);
+        std::deque<Engine::VoiceId> voices;
+
+        const auto interval = std::chrono::duration<double>(1. / notesPerSecond);
+        const auto start = std::chrono::steady_clock::now();
+        auto next = start;
+        Engine::VoiceId nextVoice = 0;
+
+        while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)) {
+            if (voices.size() >= polyphony) {
+                engine.stopVoice(voices.front());
+                voices.pop_front();
+            }
+            const Engine::VoiceStart voice = { nextVoice, engine.nextSound(), param(rng), InputLatency::hostTime() };
+            engine.startVoices(&voice, 1);
+            voices.push_back(nextVoice);
+            nextVoice++;
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+            std::this_thread::sleep_until(next);
+        }
+
+        const std::vector<StreamStatus> streams = engine.streamStatus();
+        if (!streams.empty()) {
+            double minFill = 1.;
+            size_t underruns = 0;
+            for (const auto& stream : streams) {
+                minFill = std::min(minFill, double(stream.bufferedFrames) / stream.capacity);
+                underruns += stream.underruns;
+            }
+            std::cout << "streams: n=" << streams.size()
+                      << " minFill=" << minFill * 100. << "%"
+                      << " minDeadline=" << streams.front().deadline * 1e3 << "ms"
+                      << " underruns=" << underruns
+                      << std::endl;
+        }
+
+        for (auto voice : voices) {
+            engine.stopVoice(voice);
+        }
+
+        const InputLatency::Stats latency = engine.inputLatency();
+        auto printHistogram = [](const char* name, const LatencyHistogram& histogram) {
+            std::cout << name
+                      << ": n=" << histogram.count()
+                      << " mean=" << histogram.mean() * 1e3 << "ms"
+                      << " p50=" << histogram.percentile(0.5) * 1e3 << "ms"
+                      << " p99=" << histogram.percentile(0.99) * 1e3 << "ms"
+                      << " max=" << histogram.max() * 1e3 << "ms"
+                      << std::endl;
+        };
+        printHistogram("input", latency.input);
+        printHistogram("schedule", latency.schedule);
+        printHistogram("render", latency.render);
+        printHistogram("total", latency.total);
+        std::cout << "stream underruns: " << engine.numStreamUnderruns() << std::endl;
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
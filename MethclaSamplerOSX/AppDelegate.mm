@@ -56,7 +56,10 @@ int keyToIndex(unichar key)
 //            NSLog(@"keyDown: %u", key);
             int index = keyToIndex(key);
             if (index >= 0) {
-                engine->startVoice(static_cast<intptr_t>(index), engine->nextSound(), 0.5);
+                // Event timestamps use the system uptime clock, which is what
+                // steady_clock measures on Apple platforms.
+                const Engine::VoiceStart start = { static_cast<intptr_t>(index), engine->nextSound(), 0.5f, theEvent.timestamp };
+                engine->startVoices(&start, 1);
             }
         }
     }
@@ -0,0 +1,296 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lossless block codec benchmark.
+//
+// Compresses the sounds in SOUND_DIR into block containers (see
+// CompressedSound) in a temporary directory, checks that decoding them
+// yields exactly the samples the sound file API reads from the originals,
+// and reports:
+//
+// - the size of the sound files, of their samples as 32 bit floats, which
+//   is what the sampler keeps in memory and in sample containers, and of
+//   the compressed containers, i.e. the bytes a streamed voice reads per
+//   second of audio;
+// - the decoding throughput of the vectorized and the portable kernels
+//   in frames per second and in voices at SAMPLE_RATE, decoding from
+//   memory so that only the kernels are measured.
+//
+// Results are written to stdout as JSON lines, progress to stderr.
+//
+// Usage: methcla-codec-bench [SOUND_DIR [REPEATS]]
+
+#include "BlockCodec.hpp"
+#include "CompressedSound.hpp"
+#include "plugins/soundfile_api_wav.h"
+
+#include <methcla/plugin.h>
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+# include <methcla/plugins/soundfile_api_libsndfile.h>
+#endif
+
+#include <tinydir.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const double kSampleRate = 44100.;
+
+static std::vector<std::string> listSoundFiles(const std::string& path)
+{
+    std::vector<std::string> result;
+    tinydir_dir dir;
+    if (tinydir_open(&dir, path.c_str()) == -1) {
+        throw std::runtime_error("Couldn't open sound directory " + path);
+    }
+    while (dir.has_next) {
+        tinydir_file file;
+        tinydir_readfile(&dir, &file);
+        if (!file.is_dir && file.name[0] != '.') {
+            result.push_back(path + "/" + std::string(file.name));
+        }
+        tinydir_next(&dir);
+    }
+    tinydir_close(&dir);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+static size_t fileSize(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? size_t(st.st_size) : 0;
+}
+
+// Keeps the compiler from optimizing away the output.
+static volatile float gSink;
+
+class CodecBench
+{
+public:
+    CodecBench(size_t repeats)
+        : m_soundFileAPI(nullptr)
+        , m_repeats(repeats)
+    {
+        Methcla_Host host;
+        std::fill_n(reinterpret_cast<char*>(&host), sizeof(host), 0);
+        host.handle = this;
+        host.register_soundfile_api = [](const Methcla_Host* host, const Methcla_SoundFileAPI* api) {
+            static_cast<CodecBench*>(host->handle)->m_soundFileAPI = api;
+        };
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+        methcla_soundfile_api_libsndfile(&host, ".");
+#else
+        methcla_soundfile_api_wav(&host, ".");
+#endif
+        if (m_soundFileAPI == nullptr) {
+            throw std::runtime_error("No sound file API");
+        }
+
+        char tmpDir[] = "/tmp/methcla-codec-bench.XXXXXX";
+        if (mkdtemp(tmpDir) == nullptr) {
+            throw std::runtime_error("Couldn't create temporary directory");
+        }
+        m_tmpDir = tmpDir;
+    }
+
+    ~CodecBench()
+    {
+        rmdir(m_tmpDir.c_str());
+    }
+
+    void run(const std::vector<std::string>& sounds)
+    {
+        size_t numSounds = 0;
+        size_t numSkipped = 0;
+        int64_t numFrames = 0;
+        double duration = 0.;
+        size_t soundFileBytes = 0;
+        size_t floatBytes = 0;
+        size_t compressedBytes = 0;
+        double vectorTime = 0.;
+        double scalarTime = 0.;
+        int64_t decodedFrames = 0;
+
+        for (const auto& path : sounds) {
+            Methcla_SoundFile* file = nullptr;
+            Methcla_SoundFileInfo info;
+            if (openSoundFile(path.c_str(), &file, &info) != kMethcla_NoError) {
+                std::cerr << "Skipping " << path << std::endl;
+                continue;
+            }
+
+            const std::string compressedPath = m_tmpDir + "/sound" + CompressedSound::kExtension;
+            try {
+                CompressedSound::write(compressedPath, file, info);
+            } catch (std::exception& e) {
+                std::cerr << "Skipping " << path << ": " << e.what() << std::endl;
+                file->close(file);
+                numSkipped++;
+                continue;
+            }
+
+            // Reference samples as read by the sound file API.
+            std::vector<float> reference(size_t(info.frames) * info.channels);
+            size_t numRead = 0;
+            file->seek(file, 0);
+            while (numRead < size_t(info.frames)) {
+                size_t n = 0;
+                file->read_float(file, reference.data() + numRead * info.channels, size_t(info.frames) - numRead, &n);
+                if (n == 0) {
+                    break;
+                }
+                numRead += n;
+            }
+            file->close(file);
+
+            std::unique_ptr<CompressedSound> sound = CompressedSound::open(compressedPath);
+            const size_t compressedSize = fileSize(compressedPath);
+            std::remove(compressedPath.c_str());
+            if (!sound || sound->frames() != int64_t(numRead)) {
+                throw std::runtime_error("Couldn't read compressed " + path);
+            }
+
+            std::vector<unsigned char> data;
+            if (!sound->readBlocks(0, sound->numBlocks(), data)) {
+                throw std::runtime_error("Couldn't read blocks of compressed " + path);
+            }
+            std::vector<float> decoded(reference.size());
+            for (bool vectorized : { true, false }) {
+                if (!decode(*sound, data, vectorized, decoded)
+                    || std::memcmp(decoded.data(), reference.data(), numRead * info.channels * sizeof(float)) != 0) {
+                    throw std::runtime_error("Decoding compressed " + path + " isn't lossless");
+                }
+            }
+
+            for (size_t i=0; i < m_repeats; i++) {
+                vectorTime += timeDecode(*sound, data, true, decoded);
+                scalarTime += timeDecode(*sound, data, false, decoded);
+                decodedFrames += sound->frames();
+            }
+
+            numSounds++;
+            numFrames += sound->frames();
+            duration += double(sound->frames()) / sound->sampleRate();
+            soundFileBytes += fileSize(path);
+            floatBytes += size_t(sound->frames()) * sound->channels() * sizeof(float);
+            compressedBytes += compressedSize;
+        }
+
+        if (numSounds == 0) {
+            throw std::runtime_error("No sounds could be compressed");
+        }
+
+        std::cout << "{\"kind\":\"size\""
+                  << ",\"sounds\":" << numSounds
+                  << ",\"skipped\":" << numSkipped
+                  << ",\"frames\":" << numFrames
+                  << ",\"soundFileBytes\":" << soundFileBytes
+                  << ",\"floatBytes\":" << floatBytes
+                  << ",\"compressedBytes\":" << compressedBytes
+                  << ",\"soundFileBytesPerSecond\":" << double(soundFileBytes) / duration
+                  << ",\"compressedBytesPerSecond\":" << double(compressedBytes) / duration
+                  << "}" << std::endl;
+        std::cerr << "compressed " << numSounds << " sounds to "
+                  << 100. * compressedBytes / soundFileBytes << "% of the sound files and "
+                  << 100. * compressedBytes / floatBytes << "% of float samples" << std::endl;
+
+#if defined(METHCLA_SAMPLER_CODEC_SSE)
+        const char* vectorUnit = "sse";
+#elif defined(METHCLA_SAMPLER_CODEC_NEON)
+        const char* vectorUnit = "neon";
+#else
+        const char* vectorUnit = "none";
+#endif
+        for (bool vectorized : { true, false }) {
+            const double framesPerSecond = double(decodedFrames) / (vectorized ? vectorTime : scalarTime);
+            std::cout << "{\"kind\":\"decode\""
+                      << ",\"kernels\":\"" << (vectorized ? vectorUnit : "scalar") << "\""
+                      << ",\"framesPerSecond\":" << framesPerSecond
+                      << ",\"voices\":" << framesPerSecond / kSampleRate
+                      << "}" << std::endl;
+            std::cerr << (vectorized ? vectorUnit : "scalar") << " kernels decode "
+                      << framesPerSecond / 1e6 << "M frames/s" << std::endl;
+        }
+    }
+
+private:
+    Methcla_Error openSoundFile(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) const
+    {
+        return m_soundFileAPI->open(m_soundFileAPI, path, kMethcla_FileModeRead, file, info);
+    }
+
+    // Decode all blocks of sound from data into interleaved floats.
+    bool decode(const CompressedSound& sound, const std::vector<unsigned char>& data, bool vectorized, std::vector<float>& dst)
+    {
+        for (size_t block=0; block < sound.numBlocks(); block++) {
+            if (!sound.decodeBlock(block, data.data() + sound.blockOffset(0, block), sound.blockSize(block), m_samples, vectorized)) {
+                return false;
+            }
+            sound.convert(m_samples, 0, sound.blockFrames(block),
+                          dst.data() + block * CompressedSound::kBlockFrames * sound.channels(), vectorized);
+        }
+        return true;
+    }
+
+    double timeDecode(const CompressedSound& sound, const std::vector<unsigned char>& data, bool vectorized, std::vector<float>& dst)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        decode(sound, data, vectorized, dst);
+        const auto end = std::chrono::steady_clock::now();
+        gSink = dst[dst.size() / 2];
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+private:
+    const Methcla_SoundFileAPI* m_soundFileAPI;
+    size_t                      m_repeats;
+    std::string                 m_tmpDir;
+    std::vector<uint32_t>       m_samples;
+};
+
+int main(int argc, const char* argv[])
+{
+    const std::string soundDir = argc > 1 ? argv[1] : "sounds/7773__hoobtastic__acoustic-guitar/sounds";
+    const long repeats = argc > 2 ? std::atol(argv[2]) : 10;
+
+    if (repeats <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [SOUND_DIR [REPEATS]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        const std::vector<std::string> sounds = listSoundFiles(soundDir);
+        if (sounds.empty()) {
+            throw std::runtime_error("No sounds found in " + soundDir);
+        }
+        CodecBench(size_t(repeats)).run(sounds);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
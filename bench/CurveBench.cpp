@@ -0,0 +1,95 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the table driven rate and gain curves with evaluating the
+// mapping functions with std::pow, and reports the tables' maximum
+// relative error.
+//
+// Usage: curve-bench [EVALUATIONS]
+
+#include "Curve.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+static_assert(dbampConstant(0.) == 1., "dbampConstant(0) must be exact");
+
+// Keeps the compiler from optimizing away the evaluations.
+static volatile float gSink;
+
+template <class F> static double timePerCall(const std::vector<float>& params, F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    float sum = 0.f;
+    for (auto x : params) {
+        sum += f(x);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    gSink = sum;
+    return std::chrono::duration<double, std::nano>(end - start).count() / params.size();
+}
+
+template <class F, class G> static double maxRelativeError(F f, G g)
+{
+    double maxError = 0.;
+    const size_t n = 1000000;
+    for (size_t i=0; i <= n; i++) {
+        const float x = float(double(i) / n);
+        const double y = g(x);
+        maxError = std::max(maxError, std::abs(f(x) - y) / std::abs(y));
+    }
+    return maxError;
+}
+
+template <class F, class G> static void compare(const char* name, const std::vector<float>& params, F curve, G reference)
+{
+    // Warm up caches and branch predictors.
+    timePerCall(params, reference);
+    timePerCall(params, curve);
+    const double powTime = timePerCall(params, reference);
+    const double tableTime = timePerCall(params, curve);
+    std::cout << name
+              << ": pow " << powTime << " ns"
+              << ", table " << tableTime << " ns"
+              << ", speedup " << powTime / tableTime
+              << ", max relative error " << maxRelativeError(curve, reference)
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t numEvaluations = argc > 1 ? std::atol(argv[1]) : 10000000;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> param(0.f, 1.f);
+    std::vector<float> params(numEvaluations);
+    std::generate(params.begin(), params.end(), [&]() { return param(rng); });
+
+    const Curve rate = Curve::exponential(1.f/4.f, 4.f);
+    compare("rate", params, rate, [](float x) { return expmap(1.f/4.f, 4.f, 0.f, 1.f, x); });
+
+    const Curve gain = Curve::decibels(-60.f, 0.f);
+    compare("gain", params, gain, [](float x) { return dbamp(linmap(-60.f, 0.f, 0.f, 1.f, x)); });
+
+    const float kConstantGain = float(dbampConstant(-3.));
+    std::cout << "dbampConstant(-3) = " << kConstantGain
+              << ", dbamp(-3) = " << dbamp(-3.f)
+              << std::endl;
+
+    return 0;
+}
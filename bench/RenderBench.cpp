@@ -0,0 +1,644 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Offline render benchmark for the sampler voices.
+//
+// Hosts the same synth plugins the engine plays voices with in a minimal
+// plugin host without an audio device, renders blocks of looping voices
+// paced to real time and measures the CPU time spent per block. For each
+// voice type and buffer size the maximum number of voices is searched for
+// whose 99th percentile block time stays within a fraction of the block
+// duration. Stream sampler voices rendered in parallel by a bank of voices
+// are measured for increasing numbers of threads at a single buffer size.
+//
+// Results are written to stdout as JSON lines, progress to stderr.
+//
+// Usage: methcla-render-bench [SOUND_DIR [TRIAL_SECONDS [MAX_LOAD]]]
+
+#include "DiskStreamer.hpp"
+#include "Parallel.hpp"
+#include "ParallelRenderer.hpp"
+#include "plugins/parallel_sampler.h"
+#include "plugins/soundfile_api_wav.h"
+#include "plugins/stream_sampler.h"
+
+#include <methcla/plugin.h>
+#include <methcla/plugins/pro/disksampler.h>
+#include <methcla/plugins/sampler.h>
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+# include <methcla/plugins/soundfile_api_libsndfile.h>
+#endif
+
+#include <tinydir.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+static const double kSampleRate = 44100.;
+static const size_t kBufferSizes[] = { 64, 128, 256, 512, 1024 };
+static const size_t kMaxVoices = 4096;
+static const double kAttackHeadDuration = 0.2;
+static const size_t kParallelBufferSize = 256;
+
+static double threadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static std::vector<std::string> listSoundFiles(const std::string& path)
+{
+    std::vector<std::string> result;
+    tinydir_dir dir;
+    if (tinydir_open(&dir, path.c_str()) == -1) {
+        throw std::runtime_error("Couldn't open sound directory " + path);
+    }
+    while (dir.has_next) {
+        tinydir_file file;
+        tinydir_readfile(&dir, &file);
+        if (!file.is_dir && file.name[0] != '.') {
+            result.push_back(path + "/" + std::string(file.name));
+        }
+        tinydir_next(&dir);
+    }
+    tinydir_close(&dir);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// OSC encoded synth arguments.
+class Args
+{
+public:
+    Args() : m_tags(",") { }
+
+    Args& string(const std::string& x)
+    {
+        m_tags += 's';
+        m_args.insert(m_args.end(), x.begin(), x.end());
+        pad(m_args);
+        return *this;
+    }
+
+    Args& int32(int32_t x)
+    {
+        m_tags += 'i';
+        const uint32_t y = uint32_t(x);
+        for (int shift=24; shift >= 0; shift -= 8) {
+            m_args.push_back(char((y >> shift) & 0xff));
+        }
+        return *this;
+    }
+
+    std::vector<char> tags() const
+    {
+        std::vector<char> result(m_tags.begin(), m_tags.end());
+        pad(result);
+        return result;
+    }
+
+    const std::vector<char>& args() const { return m_args; }
+
+private:
+    // Null terminate and pad to a multiple of four bytes.
+    static void pad(std::vector<char>& x)
+    {
+        do {
+            x.push_back('\0');
+        } while (x.size() % 4 != 0);
+    }
+
+    std::string         m_tags;
+    std::vector<char>   m_args;
+};
+
+// Minimal plugin host rendering synths without an audio driver.
+//
+// Commands the synths send to the host are executed on a worker thread,
+// commands sent back to the world are executed before the next block.
+class OfflineHost
+{
+public:
+    struct Voice
+    {
+        const Methcla_SynthDef*     def;
+        std::vector<std::max_align_t> options;
+        std::vector<std::max_align_t> synth;
+        std::vector<float>          controls;
+        std::vector<float>          outputs;
+    };
+
+    OfflineHost(size_t blockSize)
+        : m_blockSize(blockSize)
+        , m_time(0.)
+        , m_soundFileAPI(nullptr)
+        , m_hostBusy(false)
+        , m_quit(false)
+        , m_mix(2 * blockSize)
+    {
+        m_host.handle = this;
+        m_host.register_synthdef = [](const Methcla_Host* host, const Methcla_SynthDef* def) {
+            self(host)->m_synthDefs[def->uri] = def;
+        };
+        m_host.register_soundfile_api = [](const Methcla_Host* host, const Methcla_SoundFileAPI* api) {
+            self(host)->m_soundFileAPI = api;
+        };
+        m_host.soundfile_open = [](const Methcla_Host* host, const char* path, Methcla_FileMode mode, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+            return self(host)->openSoundFile(path, mode, file, info);
+        };
+        m_host.perform_command = [](const Methcla_Host* host, Methcla_WorldPerformFunction perform, void* data) {
+            std::lock_guard<std::mutex> lock(self(host)->m_mutex);
+            self(host)->m_worldCommands.push_back([=](const Methcla_World* world) { perform(world, data); });
+        };
+
+        m_world.handle = this;
+        m_world.samplerate = [](const Methcla_World*) { return kSampleRate; };
+        m_world.block_size = [](const Methcla_World* world) { return self(world)->m_blockSize; };
+        m_world.current_time = [](const Methcla_World* world) { return self(world)->m_time; };
+        m_world.alloc = [](const Methcla_World*, size_t size) { return std::malloc(size); };
+        m_world.alloc_aligned = [](const Methcla_World*, size_t alignment, size_t size) {
+            void* ptr = nullptr;
+            return posix_memalign(&ptr, std::max(alignment, sizeof(void*)), size) == 0 ? ptr : nullptr;
+        };
+        m_world.free = [](const Methcla_World*, void* ptr) { std::free(ptr); };
+        m_world.perform_command = [](const Methcla_World* world, Methcla_HostPerformFunction perform, void* data) {
+            std::lock_guard<std::mutex> lock(self(world)->m_mutex);
+            self(world)->m_hostCommands.push_back([=](const Methcla_Host* host) { perform(host, data); });
+        };
+        m_world.synth_done = [](const Methcla_World*, Methcla_Synth*) { };
+
+        m_worker = std::thread([this]() { processHostCommands(); });
+    }
+
+    ~OfflineHost()
+    {
+        clearVoices();
+        m_quit = true;
+        m_worker.join();
+        for (auto library : m_libraries) {
+            if (library != nullptr && library->destroy != nullptr) {
+                library->destroy(library);
+            }
+        }
+    }
+
+    void load(Methcla_LibraryFunction function)
+    {
+        m_libraries.push_back(function(&m_host, "."));
+    }
+
+    Methcla_Error openSoundFile(const char* path, Methcla_FileMode mode, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)
+    {
+        if (m_soundFileAPI == nullptr) {
+            return kMethcla_UnsupportedFileTypeError;
+        }
+        return m_soundFileAPI->open(m_soundFileAPI, path, mode, file, info);
+    }
+
+    void addVoice(const char* uri, const std::vector<float>& controls, const Args& args)
+    {
+        auto it = m_synthDefs.find(uri);
+        if (it == m_synthDefs.end()) {
+            throw std::runtime_error(std::string("Synth definition not found: ") + uri);
+        }
+        const Methcla_SynthDef* def = it->second;
+
+        std::unique_ptr<Voice> voice(new Voice);
+        voice->def = def;
+        voice->options.resize(def->options_size / sizeof(std::max_align_t) + 1);
+        voice->synth.resize(def->instance_size / sizeof(std::max_align_t) + 1);
+        const std::vector<char> tags = args.tags();
+        def->configure(tags.data(), tags.size(), args.args().data(), args.args().size(), voice->options.data());
+
+        def->construct(&m_world, def, voice->options.data(), voice->synth.data());
+
+        // Connect control inputs in order and audio outputs to private
+        // buffers that are mixed after processing.
+        voice->controls = controls;
+        size_t numControls = 0;
+        std::vector<std::pair<Methcla_PortCount,bool>> ports;
+        Methcla_PortDescriptor port;
+        for (Methcla_PortCount i=0; def->port_descriptor(voice->options.data(), i, &port); i++) {
+            const bool isControl = port.type == kMethcla_ControlPort;
+            if (isControl && numControls++ >= voice->controls.size()) {
+                voice->controls.push_back(0.f);
+            }
+            ports.push_back(std::make_pair(i, isControl));
+        }
+        const size_t numOutputs = ports.size() - numControls;
+        voice->outputs.resize(numOutputs * m_blockSize);
+        size_t control = 0, output = 0;
+        for (const auto& p : ports) {
+            void* data = p.second
+                ? static_cast<void*>(&voice->controls[control++])
+                : static_cast<void*>(&voice->outputs[(output++) * m_blockSize]);
+            def->connect(voice->synth.data(), p.first, data);
+        }
+
+        if (def->activate != nullptr) {
+            def->activate(&m_world, voice->synth.data());
+        }
+
+        m_voices.push_back(std::move(voice));
+    }
+
+    void clearVoices()
+    {
+        for (auto& voice : m_voices) {
+            voice->def->destroy(&m_world, voice->synth.data());
+        }
+        m_voices.clear();
+    }
+
+    size_t numVoices() const { return m_voices.size(); }
+
+    // Render one block and return the CPU time spent in seconds. Parallel
+    // rendering busy waits for the worker threads, so the waiting time is
+    // included.
+    double render()
+    {
+        const double start = threadCpuTime();
+
+        std::deque<std::function<void(const Methcla_World*)>> commands;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            commands.swap(m_worldCommands);
+        }
+        for (auto& command : commands) {
+            command(&m_world);
+        }
+
+        std::fill(m_mix.begin(), m_mix.end(), 0.f);
+        for (auto& voice : m_voices) {
+            voice->def->process(&m_world, voice->synth.data(), m_blockSize);
+            const size_t numOutputs = voice->outputs.size() / m_blockSize;
+            for (size_t c=0; c < std::min<size_t>(numOutputs, 2); c++) {
+                const float* src = &voice->outputs[c * m_blockSize];
+                float* dst = &m_mix[c * m_blockSize];
+                for (size_t k=0; k < m_blockSize; k++) {
+                    dst[k] += src[k];
+                }
+            }
+        }
+
+        m_time += m_blockSize / kSampleRate;
+
+        return threadCpuTime() - start;
+    }
+
+    // Block until the worker has executed all pending host commands.
+    void waitForHostCommands()
+    {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_hostCommands.empty() && !m_hostBusy) {
+                    return;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+private:
+    template <class T> static OfflineHost* self(const T* x)
+    {
+        return static_cast<OfflineHost*>(x->handle);
+    }
+
+    void processHostCommands()
+    {
+        while (!m_quit) {
+            std::function<void(const Methcla_Host*)> command;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_hostCommands.empty()) {
+                    command = m_hostCommands.front();
+                    m_hostCommands.pop_front();
+                    m_hostBusy = true;
+                }
+            }
+            if (command) {
+                command(&m_host);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_hostBusy = false;
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+    }
+
+private:
+    size_t                                              m_blockSize;
+    Methcla_Time                                        m_time;
+    Methcla_Host                                        m_host;
+    Methcla_World                                       m_world;
+    std::vector<Methcla_Library*>                       m_libraries;
+    std::map<std::string,const Methcla_SynthDef*>       m_synthDefs;
+    const Methcla_SoundFileAPI*                         m_soundFileAPI;
+    std::vector<std::unique_ptr<Voice>>                 m_voices;
+    std::mutex                                          m_mutex;
+    std::deque<std::function<void(const Methcla_Host*)>>  m_hostCommands;
+    std::deque<std::function<void(const Methcla_World*)>> m_worldCommands;
+    bool                                                m_hostBusy;
+    std::atomic<bool>                                   m_quit;
+    std::thread                                         m_worker;
+    std::vector<float>                                  m_mix;
+};
+
+enum VoiceType
+{
+    kSampler,
+    kDiskSampler,
+    kStreamSampler,
+    kParallelSampler
+};
+
+static const char* voiceTypeName(VoiceType type)
+{
+    switch (type) {
+        case kSampler: return "sampler";
+        case kDiskSampler: return "disksampler";
+        case kStreamSampler: return "stream_sampler";
+        case kParallelSampler: return "parallel_sampler";
+    }
+    return "unknown";
+}
+
+struct Trial
+{
+    size_t  numVoices;
+    size_t  numBlocks;
+    double  meanBlockTime;
+    double  p99BlockTime;
+    double  maxBlockTime;
+};
+
+class RenderBench
+{
+public:
+    RenderBench(const std::vector<std::string>& sounds, double trialSeconds, double maxLoad)
+        : m_sounds(sounds)
+        , m_trialSeconds(trialSeconds)
+        , m_maxLoad(maxLoad)
+    { }
+
+    void run()
+    {
+        for (auto type : { kSampler, kDiskSampler, kStreamSampler }) {
+            for (auto bufferSize : kBufferSizes) {
+                maxVoices(type, bufferSize, 1);
+            }
+        }
+        const size_t maxThreads = defaultNumThreads();
+        for (size_t numThreads=1; numThreads <= maxThreads; numThreads *= 2) {
+            maxVoices(kParallelSampler, kParallelBufferSize, numThreads);
+            if (numThreads < maxThreads && numThreads * 2 > maxThreads) {
+                maxVoices(kParallelSampler, kParallelBufferSize, maxThreads);
+            }
+        }
+    }
+
+private:
+    bool sustainable(const Trial& trial, size_t bufferSize) const
+    {
+        return trial.p99BlockTime <= m_maxLoad * bufferSize / kSampleRate;
+    }
+
+    void maxVoices(VoiceType type, size_t bufferSize, size_t numThreads)
+    {
+        size_t good = 0, bad = 0;
+        for (size_t n=8; n <= kMaxVoices; n *= 2) {
+            if (sustainable(measure(type, bufferSize, n, numThreads), bufferSize)) {
+                good = n;
+            } else {
+                bad = n;
+                break;
+            }
+        }
+        if (bad != 0) {
+            while (bad - good > std::max<size_t>(1, good / 32)) {
+                const size_t n = (good + bad) / 2;
+                if (sustainable(measure(type, bufferSize, n, numThreads), bufferSize)) {
+                    good = n;
+                } else {
+                    bad = n;
+                }
+            }
+        }
+        std::cout << "{\"kind\":\"capacity\""
+                  << ",\"voice\":\"" << voiceTypeName(type) << "\""
+                  << ",\"bufferSize\":" << bufferSize
+                  << ",\"threads\":" << numThreads
+                  << ",\"sampleRate\":" << kSampleRate
+                  << ",\"maxLoad\":" << m_maxLoad
+                  << ",\"maxVoices\":" << good
+                  << (bad == 0 ? ",\"limited\":true" : "")
+                  << "}" << std::endl;
+    }
+
+    Trial measure(VoiceType type, size_t bufferSize, size_t numVoices, size_t numThreads)
+    {
+        OfflineHost host(bufferSize);
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+        host.load(methcla_soundfile_api_libsndfile);
+#else
+        host.load(methcla_soundfile_api_wav);
+#endif
+        host.load(methcla_plugins_sampler);
+        host.load(methcla_plugins_disksampler);
+        host.load(methcla_sampler_plugins_stream_sampler);
+        host.load(methcla_sampler_plugins_parallel_sampler);
+
+        std::unique_ptr<DiskStreamer> streamer;
+        if (type == kStreamSampler || type == kParallelSampler) {
+            DiskStreamer::Options options;
+            options.numStreams = numVoices;
+            streamer.reset(new DiskStreamer(options, m_sounds.size(),
+                [&host](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                    return host.openSoundFile(path, kMethcla_FileModeRead, file, info);
+                }
+            ));
+            for (size_t i=0; i < m_sounds.size(); i++) {
+                streamer->registerSound(i, loadHead(host, m_sounds[i]));
+            }
+        }
+
+        std::unique_ptr<ParallelRenderer> renderer;
+        std::vector<float> bankControls;
+        if (type == kParallelSampler) {
+            ParallelRenderer::Options options;
+            options.numThreads = numThreads;
+            renderer.reset(new ParallelRenderer(options));
+        }
+
+        for (size_t i=0; i < numVoices; i++) {
+            const size_t sound = i % m_sounds.size();
+            const float rate = 0.5f + float(i % 7) / 6.f;
+            switch (type) {
+                case kSampler:
+                case kDiskSampler:
+                    host.addVoice(
+                        type == kSampler ? METHCLA_PLUGINS_SAMPLER_URI : METHCLA_PLUGINS_DISKSAMPLER_URI,
+                        { 0.1f, rate },
+                        Args().string(m_sounds[sound]).int32(1)
+                    );
+                    break;
+                case kStreamSampler:
+                    host.addVoice(
+                        METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_URI,
+                        { 0.1f, rate, float(sound), 1.f, 0.f, -1.f },
+                        Args().int32(1)
+                    );
+                    break;
+                case kParallelSampler:
+                    bankControls.insert(bankControls.end(), { 0.1f, rate, float(sound), 1.f, 0.f, -1.f });
+                    break;
+            }
+        }
+        if (type == kParallelSampler) {
+            host.addVoice(
+                METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_URI,
+                bankControls,
+                Args().int32(int32_t(numVoices)).int32(int32_t(4 * numThreads)).int32(1)
+            );
+        }
+
+        // Let sound files load and streams fill before measuring.
+        host.render();
+        host.waitForHostCommands();
+
+        const double blockDuration = bufferSize / kSampleRate;
+        const size_t warmupBlocks = size_t(0.1 / blockDuration) + 1;
+        const size_t numBlocks = std::max<size_t>(100, size_t(m_trialSeconds / blockDuration));
+        std::vector<double> blockTimes;
+        blockTimes.reserve(numBlocks);
+
+        const auto blockInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(blockDuration)
+        );
+        auto deadline = std::chrono::steady_clock::now();
+        for (size_t i=0; i < warmupBlocks + numBlocks; i++) {
+            const double time = host.render();
+            if (i >= warmupBlocks) {
+                blockTimes.push_back(time);
+            }
+            // Pace rendering to real time so that disk streaming sees a
+            // realistic load.
+            deadline += blockInterval;
+            std::this_thread::sleep_until(deadline);
+        }
+
+        host.clearVoices();
+        if (streamer) {
+            streamer->stop();
+        }
+
+        Trial trial;
+        trial.numVoices = numVoices;
+        trial.numBlocks = blockTimes.size();
+        trial.meanBlockTime = 0.;
+        for (auto t : blockTimes) {
+            trial.meanBlockTime += t;
+        }
+        trial.meanBlockTime /= blockTimes.size();
+        std::sort(blockTimes.begin(), blockTimes.end());
+        trial.p99BlockTime = blockTimes[std::min(blockTimes.size() - 1, size_t(0.99 * blockTimes.size()))];
+        trial.maxBlockTime = blockTimes.back();
+
+        std::cout << "{\"kind\":\"trial\""
+                  << ",\"voice\":\"" << voiceTypeName(type) << "\""
+                  << ",\"bufferSize\":" << bufferSize
+                  << ",\"threads\":" << numThreads
+                  << ",\"voices\":" << numVoices
+                  << ",\"blocks\":" << trial.numBlocks
+                  << ",\"meanBlockUs\":" << trial.meanBlockTime * 1e6
+                  << ",\"p99BlockUs\":" << trial.p99BlockTime * 1e6
+                  << ",\"maxBlockUs\":" << trial.maxBlockTime * 1e6
+                  << ",\"blockDurationUs\":" << blockDuration * 1e6
+                  << ",\"streamUnderruns\":" << (streamer ? streamer->numUnderruns() : 0)
+                  << "}" << std::endl;
+        std::cerr << voiceTypeName(type) << " bufferSize=" << bufferSize
+                  << " threads=" << numThreads
+                  << " voices=" << numVoices
+                  << " p99=" << trial.p99BlockTime * 1e6 << "us"
+                  << " (" << 100. * trial.p99BlockTime / blockDuration << "%)"
+                  << std::endl;
+
+        return trial;
+    }
+
+    static std::unique_ptr<StreamSound> loadHead(OfflineHost& host, const std::string& path)
+    {
+        Methcla_SoundFile* file = nullptr;
+        Methcla_SoundFileInfo info;
+        if (host.openSoundFile(path.c_str(), kMethcla_FileModeRead, &file, &info) != kMethcla_NoError) {
+            throw std::runtime_error("Couldn't open " + path);
+        }
+        std::unique_ptr<StreamSound> sound(new StreamSound);
+        sound->path = path;
+        sound->info = info;
+        sound->headFrames = std::min<int64_t>(info.frames, int64_t(kAttackHeadDuration * info.samplerate));
+        sound->head.resize(size_t(sound->headFrames) * info.channels);
+        size_t numFrames = 0;
+        file->read_float(file, sound->head.data(), size_t(sound->headFrames), &numFrames);
+        sound->headFrames = int64_t(numFrames);
+        file->close(file);
+        return sound;
+    }
+
+private:
+    std::vector<std::string>    m_sounds;
+    double                      m_trialSeconds;
+    double                      m_maxLoad;
+};
+
+int main(int argc, const char* argv[])
+{
+    const std::string soundDir = argc > 1 ? argv[1] : "sounds/7773__hoobtastic__acoustic-guitar/sounds";
+    const double trialSeconds = argc > 2 ? std::atof(argv[2]) : 1.;
+    const double maxLoad = argc > 3 ? std::atof(argv[3]) : 0.7;
+
+    if (trialSeconds <= 0. || maxLoad <= 0.) {
+        std::cerr << "Usage: " << argv[0] << " [SOUND_DIR [TRIAL_SECONDS [MAX_LOAD]]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        const std::vector<std::string> sounds = listSoundFiles(soundDir);
+        if (sounds.empty()) {
+            throw std::runtime_error("No sounds found in " + soundDir);
+        }
+        RenderBench(sounds, trialSeconds, maxLoad).run();
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Disk streaming benchmark comparing the streamer's readers.
+//
+// Plays voices that stream sounds from SOUND_DIR through a DiskStreamer,
+// consuming their buffers in real time at different rates like stream
+// sampler voices would, without rendering any audio. Voices start from an
+// attack head and move on to the next sound when they reach the end of
+// theirs. For each reader the maximum number of voices is searched for
+// that play without a single buffer underrun while the consumer keeps up
+// with real time.
+//
+// The page cache is dropped for all sounds before each trial where the
+// system supports it, but sounds read during a trial stay cached; use a
+// sound directory that is large compared to the trial's read volume to
+// measure the device rather than memory.
+//
+// Results are written to stdout as JSON lines, progress to stderr.
+//
+// Usage: methcla-stream-bench [SOUND_DIR [TRIAL_SECONDS]]
+
+#include "DiskStreamer.hpp"
+#include "plugins/soundfile_api_wav.h"
+
+#include <methcla/plugin.h>
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+# include <methcla/plugins/soundfile_api_libsndfile.h>
+#endif
+
+#include <tinydir.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const double kSampleRate = 44100.;
+static const size_t kBlockSize = 256;
+static const size_t kMaxVoices = 4096;
+static const double kAttackHeadDuration = 0.2;
+static const double kWarmupTime = 0.5;
+
+static std::vector<std::string> listSoundFiles(const std::string& path)
+{
+    std::vector<std::string> result;
+    tinydir_dir dir;
+    if (tinydir_open(&dir, path.c_str()) == -1) {
+        throw std::runtime_error("Couldn't open sound directory " + path);
+    }
+    while (dir.has_next) {
+        tinydir_file file;
+        tinydir_readfile(&dir, &file);
+        if (!file.is_dir && file.name[0] != '.') {
+            result.push_back(path + "/" + std::string(file.name));
+        }
+        tinydir_next(&dir);
+    }
+    tinydir_close(&dir);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Ask the system to drop the cached pages of path.
+static void dropCache(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd != -1) {
+#if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        close(fd);
+    }
+}
+
+static const char* readerName(DiskStreamer::Reader reader)
+{
+    switch (reader) {
+        case DiskStreamer::kThreadReader: return "thread";
+        case DiskStreamer::kUringReader: return "uring";
+    }
+    return "unknown";
+}
+
+class StreamBench
+{
+public:
+    StreamBench(const std::vector<std::string>& sounds, double trialSeconds)
+        : m_soundFileAPI(nullptr)
+        , m_trialSeconds(trialSeconds)
+    {
+        Methcla_Host host;
+        std::fill_n(reinterpret_cast<char*>(&host), sizeof(host), 0);
+        host.handle = this;
+        host.register_soundfile_api = [](const Methcla_Host* host, const Methcla_SoundFileAPI* api) {
+            static_cast<StreamBench*>(host->handle)->m_soundFileAPI = api;
+        };
+#if defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+        methcla_soundfile_api_libsndfile(&host, ".");
+#else
+        methcla_soundfile_api_wav(&host, ".");
+#endif
+        if (m_soundFileAPI == nullptr) {
+            throw std::runtime_error("No sound file API");
+        }
+
+        for (const auto& path : sounds) {
+            Methcla_SoundFile* file = nullptr;
+            Methcla_SoundFileInfo info;
+            if (openSoundFile(path.c_str(), &file, &info) != kMethcla_NoError) {
+                std::cerr << "Skipping " << path << std::endl;
+                continue;
+            }
+            file->close(file);
+            if (info.frames > 0 && info.channels <= 2) {
+                m_sounds.push_back(path);
+                m_infos.push_back(info);
+            }
+        }
+        if (m_sounds.empty()) {
+            throw std::runtime_error("No playable sounds");
+        }
+    }
+
+    void run()
+    {
+        for (auto reader : { DiskStreamer::kThreadReader, DiskStreamer::kUringReader }) {
+            search(reader);
+        }
+    }
+
+private:
+    struct Voice
+    {
+        size_t  sound;
+        Stream* stream;
+        double  position;
+        float   rate;
+    };
+
+    Methcla_Error openSoundFile(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) const
+    {
+        return m_soundFileAPI->open(m_soundFileAPI, path, kMethcla_FileModeRead, file, info);
+    }
+
+    // Find the maximum number of voices without underruns by doubling and
+    // bisection.
+    void search(DiskStreamer::Reader reader)
+    {
+        size_t good = 0;
+        size_t bad = 0;
+        for (size_t n=8; n <= kMaxVoices; n *= 2) {
+            size_t failures = 0;
+            if (!measure(reader, n, failures)) {
+                std::cerr << readerName(reader) << " reader not available" << std::endl;
+                return;
+            }
+            if (failures == 0) {
+                good = n;
+            } else {
+                bad = n;
+                break;
+            }
+        }
+        if (bad != 0) {
+            while (bad - good > std::max<size_t>(1, good / 32)) {
+                const size_t n = (good + bad) / 2;
+                size_t failures = 0;
+                measure(reader, n, failures);
+                if (failures == 0) {
+                    good = n;
+                } else {
+                    bad = n;
+                }
+            }
+        }
+        std::cout << "{\"kind\":\"capacity\""
+                  << ",\"reader\":\"" << readerName(reader) << "\""
+                  << ",\"bufferSize\":" << kBlockSize
+                  << ",\"sampleRate\":" << kSampleRate
+                  << ",\"maxVoices\":" << good
+                  << (bad == 0 ? ",\"limited\":true" : "")
+                  << "}" << std::endl;
+    }
+
+    // Play numVoices voices for a trial and count the blocks with underruns
+    // or in which the consumer fell behind real time in failures. Return
+    // false if reader isn't available.
+    bool measure(DiskStreamer::Reader reader, size_t numVoices, size_t& failures)
+    {
+        for (const auto& path : m_sounds) {
+            dropCache(path);
+        }
+
+        DiskStreamer::Options options;
+        // Streams of finished voices are only released by the streamer
+        // thread, so leave room for starting voices.
+        options.numStreams = numVoices + numVoices / 4 + 4;
+        options.reader = reader;
+        options.sampleRate = kSampleRate;
+        DiskStreamer streamer(options, m_sounds.size(),
+            [this](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                return openSoundFile(path, file, info);
+            }
+        );
+        if (streamer.reader() != reader) {
+            return false;
+        }
+        // Voices play their attack heads from memory; the head data itself
+        // isn't needed here.
+        for (size_t i=0; i < m_sounds.size(); i++) {
+            std::unique_ptr<StreamSound> sound(new StreamSound);
+            sound->path = m_sounds[i];
+            sound->info = m_infos[i];
+            sound->headFrames = std::min<int64_t>(m_infos[i].frames, int64_t(kAttackHeadDuration * m_infos[i].samplerate));
+            streamer.registerSound(i, std::move(sound));
+        }
+
+        size_t nextSound = 0;
+        std::vector<Voice> voices(numVoices);
+        for (size_t i=0; i < numVoices; i++) {
+            voices[i].rate = 0.5f + float(i % 7) / 4.f;
+            start(streamer, voices[i], nextSound++ % m_sounds.size());
+        }
+
+        const double blockDuration = kBlockSize / kSampleRate;
+        const size_t warmupBlocks = size_t(kWarmupTime / blockDuration) + 1;
+        const size_t numBlocks = std::max<size_t>(100, size_t(m_trialSeconds / blockDuration));
+        const auto blockInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(blockDuration)
+        );
+
+        size_t numUnderruns = 0;
+        size_t numLateBlocks = 0;
+        size_t numSoundsPlayed = 0;
+        int64_t numFramesStreamed = 0;
+        auto deadline = std::chrono::steady_clock::now();
+        auto startTime = deadline;
+        for (size_t b=0; b < warmupBlocks + numBlocks; b++) {
+            if (b == warmupBlocks) {
+                startTime = std::chrono::steady_clock::now();
+            }
+            for (auto& voice : voices) {
+                const StreamSound* sound = streamer.sound(voice.sound);
+                const double next = voice.position + voice.rate * kBlockSize;
+                const int64_t last = std::min(int64_t(next), sound->info.frames - 1);
+                if (voice.stream == nullptr) {
+                    voice.stream = streamer.openStream(voice.sound, sound, sound->headFrames, false);
+                }
+                if (voice.stream != nullptr) {
+                    voice.stream->setRate(voice.rate);
+                }
+                if (last < sound->headFrames || (voice.stream != nullptr && voice.stream->contains(last))) {
+                    if (b >= warmupBlocks && last >= sound->headFrames) {
+                        numFramesStreamed += int64_t(next) - std::max(int64_t(voice.position), sound->headFrames);
+                    }
+                    voice.position = next;
+                    if (voice.stream != nullptr) {
+                        voice.stream->release(int64_t(next));
+                    }
+                } else {
+                    // Hold the position like a voice waiting for data.
+                    if (voice.stream != nullptr) {
+                        voice.stream->underrun();
+                    }
+                    if (b >= warmupBlocks) {
+                        numUnderruns++;
+                    }
+                }
+                if (voice.position >= sound->info.frames) {
+                    if (voice.stream != nullptr) {
+                        streamer.closeStream(voice.stream);
+                    }
+                    start(streamer, voice, nextSound++ % m_sounds.size());
+                    numSoundsPlayed++;
+                }
+            }
+            deadline += blockInterval;
+            // Count blocks that couldn't be started before the next one
+            // was due, allowing for scheduling jitter.
+            if (std::chrono::steady_clock::now() > deadline + blockInterval && b >= warmupBlocks) {
+                numLateBlocks++;
+            }
+            std::this_thread::sleep_until(deadline);
+        }
+        const double trialTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        for (auto& voice : voices) {
+            if (voice.stream != nullptr) {
+                streamer.closeStream(voice.stream);
+            }
+        }
+        streamer.stop();
+
+        failures = numUnderruns + numLateBlocks;
+        std::cout << "{\"kind\":\"trial\""
+                  << ",\"reader\":\"" << readerName(reader) << "\""
+                  << ",\"voices\":" << numVoices
+                  << ",\"blocks\":" << numBlocks
+                  << ",\"underruns\":" << numUnderruns
+                  << ",\"lateBlocks\":" << numLateBlocks
+                  << ",\"soundsPlayed\":" << numSoundsPlayed
+                  << ",\"streamedFramesPerSecond\":" << double(numFramesStreamed) / trialTime
+                  << "}" << std::endl;
+        std::cerr << readerName(reader) << " voices=" << numVoices
+                  << " underruns=" << numUnderruns
+                  << " late=" << numLateBlocks
+                  << std::endl;
+        return true;
+    }
+
+    void start(DiskStreamer& streamer, Voice& voice, size_t sound)
+    {
+        voice.sound = sound;
+        voice.position = 0.;
+        const StreamSound* data = streamer.sound(sound);
+        voice.stream = streamer.openStream(sound, data, data->headFrames, false);
+    }
+
+private:
+    const Methcla_SoundFileAPI*         m_soundFileAPI;
+    std::vector<std::string>            m_sounds;
+    std::vector<Methcla_SoundFileInfo>  m_infos;
+    double                              m_trialSeconds;
+};
+
+int main(int argc, const char* argv[])
+{
+    const std::string soundDir = argc > 1 ? argv[1] : "sounds/7773__hoobtastic__acoustic-guitar/sounds";
+    const double trialSeconds = argc > 2 ? std::atof(argv[2]) : 2.;
+
+    if (trialSeconds <= 0.) {
+        std::cerr << "Usage: " << argv[0] << " [SOUND_DIR [TRIAL_SECONDS]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        const std::vector<std::string> sounds = listSoundFiles(soundDir);
+        if (sounds.empty()) {
+            throw std::runtime_error("No sounds found in " + soundDir);
+        }
+        StreamBench(sounds, trialSeconds).run();
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares start/update/stop throughput of the engine's voice table with
+// std::unordered_map, using pointer-like voice ids as produced by touches.
+//
+// Usage: voice-table-bench [POLYPHONY [NOTES [UPDATES_PER_NOTE]]]
+
+#include "VoiceTable.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+typedef intptr_t VoiceId;
+
+struct Voice
+{
+    int32_t synth;
+    size_t  sound;
+    bool    inMemory;
+    bool    pooled;
+};
+
+struct Event
+{
+    enum Type { kStart, kUpdate, kStop };
+    Type    type;
+    VoiceId voice;
+};
+
+// Generate a stream of note events with at most polyphony voices sounding.
+static std::vector<Event> makeEvents(size_t polyphony, size_t numNotes, size_t updatesPerNote)
+{
+    std::mt19937 rng(42);
+    // Touch objects are heap allocated; mimic 16 byte aligned addresses.
+    std::uniform_int_distribution<intptr_t> address(0x10000, 0x7fffffff);
+    std::vector<Event> events;
+    std::vector<VoiceId> active;
+
+    for (size_t i=0; i < numNotes; i++) {
+        if (active.size() >= polyphony) {
+            const size_t k = rng() % active.size();
+            events.push_back({ Event::kStop, active[k] });
+            active[k] = active.back();
+            active.pop_back();
+        }
+        VoiceId voice;
+        do {
+            voice = address(rng) & ~intptr_t(15);
+        } while (std::find(active.begin(), active.end(), voice) != active.end());
+        events.push_back({ Event::kStart, voice });
+        active.push_back(voice);
+        for (size_t j=0; j < updatesPerNote; j++) {
+            events.push_back({ Event::kUpdate, active[rng() % active.size()] });
+        }
+    }
+    for (auto voice : active) {
+        events.push_back({ Event::kStop, voice });
+    }
+
+    return events;
+}
+
+template <class Map> struct MapOps;
+
+template <> struct MapOps<std::unordered_map<VoiceId,Voice>>
+{
+    typedef std::unordered_map<VoiceId,Voice> Map;
+    static void start(Map& map, VoiceId id, const Voice& voice) { map[id] = voice; }
+    static Voice* find(Map& map, VoiceId id) { auto it = map.find(id); return it == map.end() ? nullptr : &it->second; }
+    static void stop(Map& map, VoiceId id) { map.erase(id); }
+};
+
+template <> struct MapOps<VoiceTable<VoiceId,Voice>>
+{
+    typedef VoiceTable<VoiceId,Voice> Map;
+    static void start(Map& map, VoiceId id, const Voice& voice) { map.insert(id, voice); }
+    static Voice* find(Map& map, VoiceId id) { return map.find(id); }
+    static void stop(Map& map, VoiceId id) { map.erase(id); }
+};
+
+// Replay events on map and return the time per event in nanoseconds.
+template <class Map> double run(Map& map, const std::vector<Event>& events, size_t repetitions, size_t& checksum)
+{
+    typedef MapOps<Map> Ops;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r=0; r < repetitions; r++) {
+        for (const auto& event : events) {
+            switch (event.type) {
+                case Event::kStart:
+                    Ops::start(map, event.voice, { int32_t(checksum), size_t(event.voice), false, false });
+                    break;
+                case Event::kUpdate: {
+                    Voice* voice = Ops::find(map, event.voice);
+                    if (voice == nullptr) throw std::logic_error("voice not found");
+                    checksum += voice->synth;
+                    break;
+                }
+                case Event::kStop:
+                    Ops::stop(map, event.voice);
+                    break;
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / double(events.size() * repetitions);
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t polyphony = argc > 1 ? std::atoi(argv[1]) : 10;
+    const size_t numNotes = argc > 2 ? std::atoi(argv[2]) : 100000;
+    const size_t updatesPerNote = argc > 3 ? std::atoi(argv[3]) : 20;
+    const size_t repetitions = 10;
+
+    const std::vector<Event> events = makeEvents(polyphony, numNotes, updatesPerNote);
+
+    size_t checksumMap = 0, checksumTable = 0;
+    std::unordered_map<VoiceId,Voice> map;
+    VoiceTable<VoiceId,Voice> table(polyphony);
+
+    // Warm up, then measure.
+    run(map, events, 1, checksumMap);
+    run(table, events, 1, checksumTable);
+    const double mapTime = run(map, events, repetitions, checksumMap);
+    const double tableTime = run(table, events, repetitions, checksumTable);
+
+    if (checksumMap != checksumTable || !map.empty() || !table.empty()) {
+        std::cerr << "Mismatch between std::unordered_map and VoiceTable" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "polyphony=" << polyphony
+              << " events=" << events.size()
+              << " updates/note=" << updatesPerNote << std::endl
+              << "std::unordered_map: " << mapTime << " ns/event" << std::endl
+              << "VoiceTable:         " << tableTime << " ns/event" << std::endl
+              << "speedup:            " << mapTime / tableTime << "x" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BLOCKCODEC_HPP_INCLUDED
+#define BLOCKCODEC_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+# define METHCLA_SAMPLER_CODEC_SSE 1
+# include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+# define METHCLA_SAMPLER_CODEC_NEON 1
+# include <arm_neon.h>
+#endif
+
+// Decoding kernels of the lossless block codec (see CompressedSound).
+// Vectorized with SSE2 on x86 and NEON on ARM.
+//
+// Samples are coded as residuals of a fixed polynomial predictor, i.e.
+// the samples differenced zero to two times, mapped to unsigned integers
+// with zigzag coding. Residuals are bit packed in groups of
+// kCodecGroupSize values with a common bit width per group. Within a
+// group, value i is stored in lane i % 4 of consecutive 32 bit words
+// interleaved by lane, so that unpacking four adjacent values takes one
+// vector shift. All arithmetic is modulo 2^32, which makes the coding
+// lossless for any 32 bit integer samples.
+
+const size_t kCodecGroupSize = 128;
+const size_t kCodecLanes = 4;
+
+// Size in bytes of a packed group of bits wide values.
+inline size_t codecGroupBytes(unsigned int bits)
+{
+    return bits * kCodecLanes * sizeof(uint32_t);
+}
+
+namespace detail {
+    inline uint32_t loadWord(const unsigned char* src, size_t index)
+    {
+        uint32_t x;
+        std::memcpy(&x, src + index * sizeof(uint32_t), sizeof(x));
+        return x;
+    }
+
+    inline uint32_t codecMask(unsigned int bits)
+    {
+        return bits >= 32 ? 0xffffffffu : (uint32_t(1) << bits) - 1;
+    }
+
+    inline void unpackGroupScalar(const unsigned char* src, unsigned int bits, uint32_t* dst)
+    {
+        if (bits == 0) {
+            std::memset(dst, 0, kCodecGroupSize * sizeof(uint32_t));
+            return;
+        }
+        const uint32_t mask = codecMask(bits);
+        for (size_t j=0; j < kCodecGroupSize / kCodecLanes; j++) {
+            const size_t offset = j * bits;
+            const size_t word = offset / 32;
+            const unsigned int shift = offset % 32;
+            for (size_t lane=0; lane < kCodecLanes; lane++) {
+                uint32_t x = loadWord(src, word * kCodecLanes + lane) >> shift;
+                if (shift + bits > 32) {
+                    x |= loadWord(src, (word + 1) * kCodecLanes + lane) << (32 - shift);
+                }
+                dst[j * kCodecLanes + lane] = x & mask;
+            }
+        }
+    }
+
+    inline uint32_t zigzagDecode(uint32_t x)
+    {
+        return (x >> 1) ^ (0u - (x & 1));
+    }
+
+    inline void integrateScalar(uint32_t* x, size_t n, unsigned int order)
+    {
+        for (size_t i=0; i < n; i++) {
+            x[i] = zigzagDecode(x[i]);
+        }
+        for (unsigned int k=0; k < order; k++) {
+            uint32_t sum = 0;
+            for (size_t i=0; i < n; i++) {
+                sum += x[i];
+                x[i] = sum;
+            }
+        }
+    }
+
+    inline void toFloatScalar(const uint32_t* const* src, unsigned int numChannels, size_t begin, size_t end, float scale, float* dst)
+    {
+        for (size_t i=begin; i < end; i++) {
+            for (unsigned int c=0; c < numChannels; c++) {
+                *dst++ = float(int32_t(src[c][i])) * scale;
+            }
+        }
+    }
+}
+
+// Unpack a group of kCodecGroupSize bits wide values from src, which holds
+// codecGroupBytes(bits) bytes.
+inline void unpackGroup(const unsigned char* src, unsigned int bits, uint32_t* dst)
+{
+    if (bits == 0) {
+        std::memset(dst, 0, kCodecGroupSize * sizeof(uint32_t));
+        return;
+    }
+#if defined(METHCLA_SAMPLER_CODEC_SSE)
+    const __m128i mask = _mm_set1_epi32(int(detail::codecMask(bits)));
+    const __m128i* words = reinterpret_cast<const __m128i*>(src);
+    for (size_t j=0; j < kCodecGroupSize / kCodecLanes; j++) {
+        const size_t offset = j * bits;
+        const size_t word = offset / 32;
+        const int shift = int(offset % 32);
+        __m128i x = _mm_srl_epi32(_mm_loadu_si128(words + word), _mm_cvtsi32_si128(shift));
+        if (shift + bits > 32) {
+            x = _mm_or_si128(x, _mm_sll_epi32(_mm_loadu_si128(words + word + 1), _mm_cvtsi32_si128(32 - shift)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j * kCodecLanes), _mm_and_si128(x, mask));
+    }
+#elif defined(METHCLA_SAMPLER_CODEC_NEON)
+    const uint32x4_t mask = vdupq_n_u32(detail::codecMask(bits));
+    const size_t wordBytes = kCodecLanes * sizeof(uint32_t);
+    for (size_t j=0; j < kCodecGroupSize / kCodecLanes; j++) {
+        const size_t offset = j * bits;
+        const size_t word = offset / 32;
+        const int shift = int(offset % 32);
+        uint32x4_t x = vshlq_u32(vreinterpretq_u32_u8(vld1q_u8(src + word * wordBytes)), vdupq_n_s32(-shift));
+        if (shift + bits > 32) {
+            x = vorrq_u32(x, vshlq_u32(vreinterpretq_u32_u8(vld1q_u8(src + (word + 1) * wordBytes)), vdupq_n_s32(32 - shift)));
+        }
+        vst1q_u32(dst + j * kCodecLanes, vandq_u32(x, mask));
+    }
+#else
+    detail::unpackGroupScalar(src, bits, dst);
+#endif
+}
+
+// Turn n zigzag coded residuals of a predictor of order into samples in
+// place.
+inline void integrate(uint32_t* x, size_t n, unsigned int order)
+{
+    size_t i = 0;
+#if defined(METHCLA_SAMPLER_CODEC_SSE)
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+    if (order == 0) {
+        for (; i + 4 <= n; i += 4) {
+            const __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            const __m128i r = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(zero, _mm_and_si128(z, one)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(x + i), r);
+        }
+    } else {
+        // Zigzag decoding fused with the first prefix sum; the sums of
+        // four values are computed with two shifted adds.
+        __m128i carry = zero;
+        for (; i + 4 <= n; i += 4) {
+            const __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+            __m128i r = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(zero, _mm_and_si128(z, one)));
+            r = _mm_add_epi32(r, _mm_slli_si128(r, 4));
+            r = _mm_add_epi32(r, _mm_slli_si128(r, 8));
+            r = _mm_add_epi32(r, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(x + i), r);
+            carry = _mm_shuffle_epi32(r, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        for (unsigned int k=1; k < order; k++) {
+            carry = zero;
+            for (size_t j=0; j + 4 <= i; j += 4) {
+                __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + j));
+                r = _mm_add_epi32(r, _mm_slli_si128(r, 4));
+                r = _mm_add_epi32(r, _mm_slli_si128(r, 8));
+                r = _mm_add_epi32(r, carry);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(x + j), r);
+                carry = _mm_shuffle_epi32(r, _MM_SHUFFLE(3, 3, 3, 3));
+            }
+        }
+    }
+#elif defined(METHCLA_SAMPLER_CODEC_NEON)
+    const uint32x4_t zero = vdupq_n_u32(0);
+    const uint32x4_t one = vdupq_n_u32(1);
+    if (order == 0) {
+        for (; i + 4 <= n; i += 4) {
+            const uint32x4_t z = vld1q_u32(x + i);
+            vst1q_u32(x + i, veorq_u32(vshrq_n_u32(z, 1), vsubq_u32(zero, vandq_u32(z, one))));
+        }
+    } else {
+        uint32x4_t carry = zero;
+        for (; i + 4 <= n; i += 4) {
+            const uint32x4_t z = vld1q_u32(x + i);
+            uint32x4_t r = veorq_u32(vshrq_n_u32(z, 1), vsubq_u32(zero, vandq_u32(z, one)));
+            r = vaddq_u32(r, vextq_u32(zero, r, 3));
+            r = vaddq_u32(r, vextq_u32(zero, r, 2));
+            r = vaddq_u32(r, carry);
+            vst1q_u32(x + i, r);
+            carry = vdupq_n_u32(vgetq_lane_u32(r, 3));
+        }
+        for (unsigned int k=1; k < order; k++) {
+            carry = zero;
+            for (size_t j=0; j + 4 <= i; j += 4) {
+                uint32x4_t r = vld1q_u32(x + j);
+                r = vaddq_u32(r, vextq_u32(zero, r, 3));
+                r = vaddq_u32(r, vextq_u32(zero, r, 2));
+                r = vaddq_u32(r, carry);
+                vst1q_u32(x + j, r);
+                carry = vdupq_n_u32(vgetq_lane_u32(r, 3));
+            }
+        }
+    }
+#endif
+    if (i < n) {
+        // Integrate the tail, continuing from the vectorized part.
+        if (i == 0) {
+            detail::integrateScalar(x, n, order);
+        } else {
+            uint32_t sums[2] = { x[i - 1], 0 };
+            if (order == 2) {
+                // The running sum of the first integration at i - 1 is
+                // the difference of the last two samples.
+                sums[0] = x[i - 1] - x[i - 2];
+                sums[1] = x[i - 1];
+            }
+            for (size_t j=i; j < n; j++) {
+                uint32_t y = detail::zigzagDecode(x[j]);
+                for (unsigned int k=0; k < order; k++) {
+                    sums[k] += y;
+                    y = sums[k];
+                }
+                x[j] = y;
+            }
+        }
+    }
+}
+
+// Convert frames begin to end of numChannels channels of integer samples
+// to interleaved floats multiplied by scale.
+inline void toFloat(const uint32_t* const* src, unsigned int numChannels, size_t begin, size_t end, float scale, float* dst)
+{
+    size_t i = begin;
+#if defined(METHCLA_SAMPLER_CODEC_SSE)
+    const __m128 s = _mm_set1_ps(scale);
+    if (numChannels == 1) {
+        for (; i + 4 <= end; i += 4, dst += 4) {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[0] + i));
+            _mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(x), s));
+        }
+    } else if (numChannels == 2) {
+        for (; i + 4 <= end; i += 4, dst += 8) {
+            const __m128 l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src[0] + i))), s);
+            const __m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src[1] + i))), s);
+            _mm_storeu_ps(dst, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(l, r));
+        }
+    }
+#elif defined(METHCLA_SAMPLER_CODEC_NEON)
+    if (numChannels == 1) {
+        for (; i + 4 <= end; i += 4, dst += 4) {
+            vst1q_f32(dst, vmulq_n_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(vld1q_u32(src[0] + i))), scale));
+        }
+    } else if (numChannels == 2) {
+        for (; i + 4 <= end; i += 4, dst += 8) {
+            float32x4x2_t lr;
+            lr.val[0] = vmulq_n_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(vld1q_u32(src[0] + i))), scale);
+            lr.val[1] = vmulq_n_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(vld1q_u32(src[1] + i))), scale);
+            vst2q_f32(dst, lr);
+        }
+    }
+#endif
+    detail::toFloatScalar(src, numChannels, i, end, scale, dst);
+}
+
+#endif // BLOCKCODEC_HPP_INCLUDED
@@ -0,0 +1,67 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "CacheFiles.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <tinydir.h>
+
+#include <sys/stat.h>
+
+std::string CacheKey::path(const std::string& dir, const char* extension) const
+{
+    char name[24];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)m_hash);
+    return dir + "/" + name + extension;
+}
+
+void createCacheDir(const std::string& dir)
+{
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Couldn't create cache directory " << dir << std::endl;
+    }
+}
+
+void removeUnusedCacheFiles(const std::string& dir, std::vector<std::string> usedPaths)
+{
+    std::sort(usedPaths.begin(), usedPaths.end());
+
+    tinydir_dir tdir;
+    if (tinydir_open(&tdir, dir.c_str()) == -1) {
+        return;
+    }
+
+    std::vector<std::string> unused;
+    while (tdir.has_next)
+    {
+        tinydir_file file;
+        tinydir_readfile(&tdir, &file);
+        if (!file.is_dir) {
+            const std::string path = dir + "/" + std::string(file.name);
+            if (!std::binary_search(usedPaths.begin(), usedPaths.end(), path)) {
+                unused.push_back(path);
+            }
+        }
+        tinydir_next(&tdir);
+    }
+
+    tinydir_close(&tdir);
+
+    for (const auto& path : unused) {
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,71 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CACHEFILES_HPP_INCLUDED
+#define CACHEFILES_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Helpers for directories of files derived from sounds, such as converted
+// or pre-decoded copies.
+//
+// Cache files are named after a hash of everything their contents depend
+// on, so that a file is never reused after its source or the settings
+// that produced it have changed.
+
+// FNV-1a hash of the inputs of a cache file.
+class CacheKey
+{
+public:
+    CacheKey()
+        : m_hash(14695981039346656037ull)
+    { }
+
+    CacheKey& add(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i=0; i < size; i++) {
+            m_hash = (m_hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return *this;
+    }
+
+    CacheKey& add(const std::string& str)
+    {
+        return add(str.data(), str.size());
+    }
+
+    template <typename T> CacheKey& add(const T& value)
+    {
+        return add(&value, sizeof(value));
+    }
+
+    // Path of the file in dir with this key and extension.
+    std::string path(const std::string& dir, const char* extension) const;
+
+private:
+    uint64_t m_hash;
+};
+
+// Create the cache directory dir unless it exists. Failures are reported
+// on std::cerr; writing files to the directory will fail later.
+void createCacheDir(const std::string& dir);
+
+// Remove all files from dir except for usedPaths.
+void removeUnusedCacheFiles(const std::string& dir, std::vector<std::string> usedPaths);
+
+#endif // CACHEFILES_HPP_INCLUDED
@@ -0,0 +1,447 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "CompressedSound.hpp"
+#include "BlockCodec.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[8] = { 'M', 'S', 'B', 'L', 'O', 'C', 'K', 'S' };
+static const uint32_t kVersion = 1;
+// Written in native byte order; containers from machines with a different
+// byte order are rejected.
+static const uint32_t kByteOrderMark = 0x01020304;
+// Channels of a block are coded independently, or the second channel of a
+// stereo block is coded as the difference of both.
+static const unsigned char kIndependent = 0;
+static const unsigned char kLeftSide = 1;
+static const unsigned int kMaxOrder = 2;
+static const unsigned int kMaxChannels = 8;
+
+const size_t CompressedSound::kBlockFrames;
+const char* const CompressedSound::kExtension = ".blocks";
+
+namespace {
+    struct Header
+    {
+        char        magic[8];
+        uint32_t    byteOrder;
+        uint32_t    version;
+        uint32_t    channels;
+        uint32_t    sampleRate;
+        uint32_t    bitsPerSample;
+        uint32_t    blockFrames;
+        int64_t     frames;
+        uint64_t    numBlocks;
+    };
+}
+
+static size_t numGroups(size_t numFrames)
+{
+    return (numFrames + kCodecGroupSize - 1) / kCodecGroupSize;
+}
+
+// Smallest supported bit depth at which sample is an integer, or zero if
+// there is none.
+static unsigned int sampleBits(float sample, unsigned int minBits)
+{
+    if (sample == 0.f && std::signbit(sample)) {
+        return 0;
+    }
+    for (unsigned int bits=minBits; bits <= 24; bits += 8) {
+        const float range = std::ldexp(1.f, int(bits) - 1);
+        const float x = sample * range;
+        if (x == std::floor(x) && x >= -range && x < range) {
+            return bits;
+        }
+    }
+    return 0;
+}
+
+static unsigned int bitWidth(uint32_t x)
+{
+    unsigned int bits = 0;
+    while (x != 0) {
+        bits++;
+        x >>= 1;
+    }
+    return bits;
+}
+
+// Zigzag coded residuals of predicting the n samples of x with a
+// polynomial of order, padded with zeros to whole groups.
+static void residuals(const uint32_t* x, size_t n, unsigned int order, uint32_t* r)
+{
+    std::copy(x, x + n, r);
+    for (unsigned int k=0; k < order; k++) {
+        uint32_t previous = 0;
+        for (size_t i=0; i < n; i++) {
+            const uint32_t current = r[i];
+            r[i] = current - previous;
+            previous = current;
+        }
+    }
+    for (size_t i=0; i < n; i++) {
+        r[i] = (r[i] << 1) ^ (0u - (r[i] >> 31));
+    }
+    std::fill(r + n, r + numGroups(n) * kCodecGroupSize, 0u);
+}
+
+static size_t codedSize(const uint32_t* r, size_t n)
+{
+    size_t size = 1 + numGroups(n);
+    for (size_t g=0; g < numGroups(n); g++) {
+        uint32_t bits = 0;
+        for (size_t i=0; i < kCodecGroupSize; i++) {
+            bits |= r[g * kCodecGroupSize + i];
+        }
+        size += codecGroupBytes(bitWidth(bits));
+    }
+    return size;
+}
+
+// Return the predictor order that codes x smallest and its size.
+static unsigned int bestOrder(const uint32_t* x, size_t n, std::vector<uint32_t>& r, size_t& size)
+{
+    unsigned int result = 0;
+    for (unsigned int order=0; order <= kMaxOrder; order++) {
+        residuals(x, n, order, r.data());
+        const size_t orderSize = codedSize(r.data(), n);
+        if (order == 0 || orderSize < size) {
+            result = order;
+            size = orderSize;
+        }
+    }
+    return result;
+}
+
+static void encodeChannel(const uint32_t* x, size_t n, unsigned int order, std::vector<uint32_t>& r, std::vector<unsigned char>& out)
+{
+    residuals(x, n, order, r.data());
+    out.push_back((unsigned char)order);
+    const size_t widthsOffset = out.size();
+    out.resize(out.size() + numGroups(n));
+    for (size_t g=0; g < numGroups(n); g++) {
+        const uint32_t* group = r.data() + g * kCodecGroupSize;
+        uint32_t mask = 0;
+        for (size_t i=0; i < kCodecGroupSize; i++) {
+            mask |= group[i];
+        }
+        const unsigned int bits = bitWidth(mask);
+        out[widthsOffset + g] = (unsigned char)bits;
+
+        // Value i goes to lane i % 4 at bit offset i / 4 * bits of the
+        // lane's words.
+        std::vector<uint32_t> words(bits * kCodecLanes, 0);
+        for (size_t i=0; i < kCodecGroupSize && bits > 0; i++) {
+            const size_t lane = i % kCodecLanes;
+            const size_t offset = i / kCodecLanes * bits;
+            const size_t word = offset / 32;
+            const unsigned int shift = offset % 32;
+            words[word * kCodecLanes + lane] |= group[i] << shift;
+            if (shift + bits > 32) {
+                words[(word + 1) * kCodecLanes + lane] |= group[i] >> (32 - shift);
+            }
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(words.data());
+        out.insert(out.end(), bytes, bytes + words.size() * sizeof(uint32_t));
+    }
+}
+
+// Read up to numFrames frames, retrying short reads. A read error throws,
+// so that it isn't mistaken for the end of the sound.
+static size_t readFrames(Methcla_SoundFile* source, const std::string& path, float* dst, unsigned int channels, size_t numFrames)
+{
+    size_t result = 0;
+    while (result < numFrames) {
+        size_t numRead = 0;
+        if (source->read_float(source, dst + result * channels, numFrames - result, &numRead) != kMethcla_NoError) {
+            throw std::runtime_error("Couldn't read sound " + path);
+        }
+        if (numRead == 0) {
+            break;
+        }
+        result += numRead;
+    }
+    return result;
+}
+
+void CompressedSound::write(const std::string& path, Methcla_SoundFile* source, const Methcla_SoundFileInfo& info)
+{
+    const unsigned int channels = info.channels;
+    if (channels == 0 || channels > kMaxChannels) {
+        throw std::runtime_error("Sound " + path + " has an unsupported number of channels");
+    }
+
+    // Find the bit depth of the samples first; compressing a sound after
+    // converting it, e.g. to another sample rate, is not lossless.
+    std::vector<float> frames(kBlockFrames * channels);
+    unsigned int bits = 8;
+    int64_t numFrames = 0;
+    for (;;) {
+        const size_t numRead = readFrames(source, path, frames.data(), channels, kBlockFrames);
+        for (size_t i=0; i < numRead * channels; i++) {
+            bits = sampleBits(frames[i], bits);
+            if (bits == 0) {
+                throw std::runtime_error("Sound " + path + " doesn't have integer samples of at most 24 bits");
+            }
+        }
+        numFrames += numRead;
+        if (numRead < kBlockFrames) {
+            break;
+        }
+    }
+    if (source->seek(source, 0) != kMethcla_NoError) {
+        throw std::runtime_error("Couldn't rewind sound " + path);
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::copy(kMagic, kMagic + sizeof(kMagic), header.magic);
+    header.byteOrder = kByteOrderMark;
+    header.version = kVersion;
+    header.channels = channels;
+    header.sampleRate = info.samplerate;
+    header.bitsPerSample = bits;
+    header.blockFrames = kBlockFrames;
+    header.frames = numFrames;
+    header.numBlocks = (numFrames + kBlockFrames - 1) / kBlockFrames;
+
+    // Write to a temporary file and rename it, so that readers never see
+    // a partial container.
+    const std::string tmpPath = path + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Couldn't create compressed sound " + tmpPath);
+    }
+
+    std::vector<uint64_t> offsets(header.numBlocks + 1);
+    offsets[0] = sizeof(header) + offsets.size() * sizeof(uint64_t);
+    const float scale = std::ldexp(1.f, int(bits) - 1);
+    std::vector<uint32_t> samples(channels * kBlockFrames);
+    std::vector<uint32_t> side(kBlockFrames);
+    std::vector<uint32_t> r(kBlockFrames);
+    std::vector<unsigned char> block;
+    bool success = std::fseek(file, long(offsets[0]), SEEK_SET) == 0;
+    for (size_t b=0; success && b < header.numBlocks; b++) {
+        const size_t n = std::min<size_t>(kBlockFrames, size_t(numFrames - int64_t(b * kBlockFrames)));
+        size_t numRead = 0;
+        try {
+            numRead = readFrames(source, path, frames.data(), channels, n);
+        } catch (...) {
+            std::fclose(file);
+            std::remove(tmpPath.c_str());
+            throw;
+        }
+        if (numRead != n) {
+            success = false;
+            break;
+        }
+        for (unsigned int c=0; c < channels; c++) {
+            for (size_t i=0; i < n; i++) {
+                samples[c * kBlockFrames + i] = uint32_t(int32_t(frames[i * channels + c] * scale));
+            }
+        }
+
+        block.clear();
+        size_t size = 0;
+        unsigned int order = bestOrder(samples.data(), n, r, size);
+        if (channels == 2) {
+            const uint32_t* left = samples.data();
+            const uint32_t* right = samples.data() + kBlockFrames;
+            for (size_t i=0; i < n; i++) {
+                side[i] = left[i] - right[i];
+            }
+            size_t rightSize = 0, sideSize = 0;
+            const unsigned int rightOrder = bestOrder(right, n, r, rightSize);
+            const unsigned int sideOrder = bestOrder(side.data(), n, r, sideSize);
+            block.push_back(sideSize < rightSize ? kLeftSide : kIndependent);
+            encodeChannel(left, n, order, r, block);
+            if (sideSize < rightSize) {
+                encodeChannel(side.data(), n, sideOrder, r, block);
+            } else {
+                encodeChannel(right, n, rightOrder, r, block);
+            }
+        } else {
+            block.push_back(kIndependent);
+            encodeChannel(samples.data(), n, order, r, block);
+            for (unsigned int c=1; c < channels; c++) {
+                const uint32_t* x = samples.data() + c * kBlockFrames;
+                order = bestOrder(x, n, r, size);
+                encodeChannel(x, n, order, r, block);
+            }
+        }
+
+        success = std::fwrite(block.data(), 1, block.size(), file) == block.size();
+        offsets[b + 1] = offsets[b] + block.size();
+    }
+
+    success = success
+           && std::fseek(file, 0, SEEK_SET) == 0
+           && std::fwrite(&header, sizeof(header), 1, file) == 1
+           && std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size();
+
+    if (std::fclose(file) != 0 || !success || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Couldn't write compressed sound " + path);
+    }
+}
+
+bool CompressedSound::hasExtension(const std::string& path)
+{
+    const size_t length = std::strlen(kExtension);
+    return path.size() >= length && path.compare(path.size() - length, length, kExtension) == 0;
+}
+
+static bool readAt(int fd, void* dst, size_t size, uint64_t offset)
+{
+    char* bytes = static_cast<char*>(dst);
+    while (size > 0) {
+        const ssize_t result = pread(fd, bytes, size, off_t(offset));
+        if (result <= 0) {
+            return false;
+        }
+        bytes += result;
+        size -= size_t(result);
+        offset += uint64_t(result);
+    }
+    return true;
+}
+
+std::unique_ptr<CompressedSound> CompressedSound::open(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    Header header;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0
+        && readAt(fd, &header, sizeof(header), 0)
+        && std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+        && header.byteOrder == kByteOrderMark
+        && header.version == kVersion
+        && header.channels > 0 && header.channels <= kMaxChannels
+        && header.bitsPerSample >= 8 && header.bitsPerSample <= 24
+        && header.blockFrames == kBlockFrames
+        && header.frames >= 0
+        && header.numBlocks == (uint64_t(header.frames) + kBlockFrames - 1) / kBlockFrames
+        && header.numBlocks < uint64_t(st.st_size);
+
+    std::vector<uint64_t> offsets;
+    if (valid) {
+        offsets.resize(size_t(header.numBlocks) + 1);
+        valid = readAt(fd, offsets.data(), offsets.size() * sizeof(uint64_t), sizeof(header))
+             && offsets.front() == sizeof(header) + offsets.size() * sizeof(uint64_t)
+             && offsets.back() <= uint64_t(st.st_size)
+             && std::is_sorted(offsets.begin(), offsets.end());
+    }
+    if (!valid) {
+        close(fd);
+        return nullptr;
+    }
+
+    return std::unique_ptr<CompressedSound>(
+        new CompressedSound(fd, header.channels, header.sampleRate, header.bitsPerSample, header.frames, std::move(offsets)));
+}
+
+CompressedSound::CompressedSound(int fd, unsigned int channels, unsigned int sampleRate, unsigned int bitsPerSample, int64_t frames, std::vector<uint64_t> offsets)
+    : m_fd(fd)
+    , m_channels(channels)
+    , m_sampleRate(sampleRate)
+    , m_bitsPerSample(bitsPerSample)
+    , m_frames(frames)
+    , m_offsets(std::move(offsets))
+{
+}
+
+CompressedSound::~CompressedSound()
+{
+    close(m_fd);
+}
+
+bool CompressedSound::readBlocks(size_t first, size_t last, std::vector<unsigned char>& data) const
+{
+    data.resize(size_t(m_offsets[last] - m_offsets[first]));
+    return readAt(m_fd, data.data(), data.size(), m_offsets[first]);
+}
+
+bool CompressedSound::decodeBlock(size_t block, const unsigned char* data, size_t size, std::vector<uint32_t>& samples, bool vectorized) const
+{
+    const size_t n = blockFrames(block);
+    samples.resize(m_channels * kBlockFrames);
+    if (size < 1 || data[0] > kLeftSide || (data[0] == kLeftSide && m_channels != 2)) {
+        return false;
+    }
+
+    size_t pos = 1;
+    for (unsigned int c=0; c < m_channels; c++) {
+        if (pos + 1 + numGroups(n) > size || data[pos] > kMaxOrder) {
+            return false;
+        }
+        const unsigned int order = data[pos];
+        const unsigned char* widths = data + pos + 1;
+        pos += 1 + numGroups(n);
+        uint32_t* dst = samples.data() + c * kBlockFrames;
+        for (size_t g=0; g < numGroups(n); g++) {
+            const unsigned int bits = widths[g];
+            if (bits > 32 || pos + codecGroupBytes(bits) > size) {
+                return false;
+            }
+            if (vectorized) {
+                unpackGroup(data + pos, bits, dst + g * kCodecGroupSize);
+            } else {
+                detail::unpackGroupScalar(data + pos, bits, dst + g * kCodecGroupSize);
+            }
+            pos += codecGroupBytes(bits);
+        }
+        if (vectorized) {
+            integrate(dst, n, order);
+        } else {
+            detail::integrateScalar(dst, n, order);
+        }
+    }
+
+    if (data[0] == kLeftSide) {
+        const uint32_t* left = samples.data();
+        uint32_t* right = samples.data() + kBlockFrames;
+        for (size_t i=0; i < n; i++) {
+            right[i] = left[i] - right[i];
+        }
+    }
+
+    return true;
+}
+
+void CompressedSound::convert(const std::vector<uint32_t>& samples, size_t begin, size_t end, float* dst, bool vectorized) const
+{
+    const uint32_t* channels[kMaxChannels];
+    for (unsigned int c=0; c < m_channels; c++) {
+        channels[c] = samples.data() + c * kBlockFrames;
+    }
+    const float scale = std::ldexp(1.f, 1 - int(m_bitsPerSample));
+    if (vectorized) {
+        toFloat(channels, m_channels, begin, end, scale, dst);
+    } else {
+        detail::toFloatScalar(channels, m_channels, begin, end, scale, dst);
+    }
+}
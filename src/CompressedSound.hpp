@@ -0,0 +1,115 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMPRESSEDSOUND_HPP_INCLUDED
+#define COMPRESSEDSOUND_HPP_INCLUDED
+
+#include <methcla/file.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Losslessly compressed sample container made of independently decodable
+// blocks of kBlockFrames frames, so that a stream can start decoding at
+// any block.
+//
+// Integer PCM samples of up to 24 bits are coded per block and channel as
+// the residuals of the best of three fixed polynomial predictors, with
+// stereo channels optionally coded as left and side. Residuals are bit
+// packed in groups of fixed width (see BlockCodec.hpp), which trades a
+// few percent of compression against entropy coding for a decoder that
+// runs at memory speed. An index of block offsets follows the header.
+// Containers are written in native byte order and are meant to be read on
+// the machine that wrote them.
+class CompressedSound
+{
+public:
+    static const size_t kBlockFrames = 4096;
+    // File name extension of containers.
+    static const char* const kExtension;
+
+    // Write the container at path with the frames read from source, which
+    // has the given info. Writes to a temporary file that is renamed to
+    // path when complete. Throws std::runtime_error on errors, including
+    // sources whose samples aren't integers of at most 24 bits.
+    static void write(const std::string& path, Methcla_SoundFile* source, const Methcla_SoundFileInfo& info);
+
+    // Return true if path has the container extension.
+    static bool hasExtension(const std::string& path);
+
+    // Open the container at path and read its index. Returns nullptr if
+    // the file can't be opened or isn't a valid container.
+    static std::unique_ptr<CompressedSound> open(const std::string& path);
+
+    ~CompressedSound();
+
+    CompressedSound(const CompressedSound& other) = delete;
+    CompressedSound& operator=(const CompressedSound& other) = delete;
+
+    unsigned int channels() const { return m_channels; }
+    unsigned int sampleRate() const { return m_sampleRate; }
+    unsigned int bitsPerSample() const { return m_bitsPerSample; }
+    int64_t frames() const { return m_frames; }
+    size_t numBlocks() const { return m_offsets.size() - 1; }
+
+    // Size in bytes of all compressed blocks.
+    size_t dataSize() const { return size_t(m_offsets.back() - m_offsets.front()); }
+
+    // Number of frames in block.
+    size_t blockFrames(size_t block) const
+    {
+        return size_t(std::min<int64_t>(kBlockFrames, m_frames - int64_t(block * kBlockFrames)));
+    }
+
+    // Read blocks first to last (exclusive) with a single read into data.
+    // Returns false on read errors.
+    bool readBlocks(size_t first, size_t last, std::vector<unsigned char>& data) const;
+
+    // Offset of block in the data returned by readBlocks for first, and
+    // its compressed size.
+    size_t blockOffset(size_t first, size_t block) const
+    {
+        return size_t(m_offsets[block] - m_offsets[first]);
+    }
+    size_t blockSize(size_t block) const
+    {
+        return size_t(m_offsets[block + 1] - m_offsets[block]);
+    }
+
+    // Decode the size bytes of block into samples, holding kBlockFrames
+    // integer samples per channel. Returns false if the data is corrupt.
+    // vectorized false selects the portable kernels, for benchmarking.
+    bool decodeBlock(size_t block, const unsigned char* data, size_t size, std::vector<uint32_t>& samples, bool vectorized=true) const;
+
+    // Convert frames begin to end of a decoded block to interleaved
+    // floats.
+    void convert(const std::vector<uint32_t>& samples, size_t begin, size_t end, float* dst, bool vectorized=true) const;
+
+private:
+    CompressedSound(int fd, unsigned int channels, unsigned int sampleRate, unsigned int bitsPerSample, int64_t frames, std::vector<uint64_t> offsets);
+
+private:
+    int                     m_fd;
+    unsigned int            m_channels;
+    unsigned int            m_sampleRate;
+    unsigned int            m_bitsPerSample;
+    int64_t                 m_frames;
+    // File offset of each block and of the end of the last one.
+    std::vector<uint64_t>   m_offsets;
+};
+
+#endif // COMPRESSEDSOUND_HPP_INCLUDED
@@ -0,0 +1,68 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "CompressedStore.hpp"
+#include "CacheFiles.hpp"
+#include "CompressedSound.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+// Changes whenever compressing produces different containers.
+static const uint32_t kStoreVersion = 1;
+
+CompressedStore::CompressedStore(const std::string& dir, OpenFunction openFile)
+    : m_dir(dir)
+    , m_openFile(openFile)
+{
+    createCacheDir(m_dir);
+}
+
+bool CompressedStore::compress(const std::string& path, const FileStamp& stamp, const std::string& sourcePath, const Methcla_SoundFileInfo& sourceInfo, std::string& outPath)
+{
+    outPath = CacheKey()
+        .add(path)
+        .add(stamp.size)
+        .add(stamp.mtime)
+        .add(uint64_t(sourceInfo.samplerate))
+        .add(kStoreVersion)
+        .path(m_dir, CompressedSound::kExtension);
+
+    if (CompressedSound::open(outPath)) {
+        return true;
+    }
+
+    Methcla_SoundFile* file;
+    Methcla_SoundFileInfo fileInfo;
+    if (m_openFile(sourcePath.c_str(), &file, &fileInfo) != kMethcla_NoError) {
+        std::cerr << "Opening sound file " << sourcePath << " for compressing failed" << std::endl;
+        return false;
+    }
+
+    bool success = true;
+    try {
+        CompressedSound::write(outPath, file, fileInfo);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        success = false;
+    }
+    file->close(file);
+
+    return success;
+}
+
+void CompressedStore::removeUnused(std::vector<std::string> usedPaths)
+{
+    removeUnusedCacheFiles(m_dir, std::move(usedPaths));
+}
@@ -0,0 +1,59 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COMPRESSEDSTORE_HPP_INCLUDED
+#define COMPRESSEDSTORE_HPP_INCLUDED
+
+#include "SoundIndex.hpp"
+
+#include <methcla/file.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Directory of sounds compressed into block containers (see
+// CompressedSound) for disk streaming.
+//
+// Containers are named after a hash of the sound's path, its file stamp
+// and the sample rate of the compressed file, so that a changed sound is
+// compressed anew and an existing container is reused.
+class CompressedStore
+{
+public:
+    typedef std::function<Methcla_Error(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)> OpenFunction;
+
+    // Create the store directory dir if it doesn't exist. Sounds are
+    // opened with openFile.
+    CompressedStore(const std::string& dir, OpenFunction openFile);
+
+    CompressedStore(const CompressedStore& other) = delete;
+    CompressedStore& operator=(const CompressedStore& other) = delete;
+
+    // Compress the sound at path with the given stamp by reading
+    // sourcePath, the file voices would play otherwise, with info
+    // sourceInfo unless a container exists, and return the container's
+    // path in outPath. Returns false if the sound can't be compressed
+    // losslessly or writing failed. Different sounds can be compressed
+    // concurrently.
+    bool compress(const std::string& path, const FileStamp& stamp, const std::string& sourcePath, const Methcla_SoundFileInfo& sourceInfo, std::string& outPath);
+
+    // Remove all files from the store directory except for usedPaths.
+    void removeUnused(std::vector<std::string> usedPaths);
+
+private:
+    std::string     m_dir;
+    OpenFunction    m_openFile;
+};
+
+#endif // COMPRESSEDSTORE_HPP_INCLUDED
@@ -0,0 +1,242 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Config.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+static std::string trim(const std::string& str)
+{
+    const char* whitespace = " \t\r\n";
+    const size_t begin = str.find_first_not_of(whitespace);
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    return str.substr(begin, str.find_last_not_of(whitespace) - begin + 1);
+}
+
+// Parse a non-negative integer that fits into size_t, optionally followed
+// by a binary suffix.
+static size_t parseInteger(const std::string& value, bool withSuffix, const char* expected)
+{
+    char* end;
+    const double x = std::strtod(value.c_str(), &end);
+    const bool haveNumber = end != value.c_str();
+    double scale = 1.;
+    if (withSuffix) {
+        switch (*end) {
+            case 'k': case 'K': scale = 1024.; end++; break;
+            case 'm': case 'M': scale = 1024. * 1024.; end++; break;
+            case 'g': case 'G': scale = 1024. * 1024. * 1024.; end++; break;
+        }
+    }
+    const double n = x * scale;
+    // Also rejects NaN and infinity.
+    if (!haveNumber || *end != '\0' || !(n >= 0.)
+        || n >= std::ldexp(1., std::numeric_limits<size_t>::digits)
+        || n != std::floor(n)) {
+        throw std::invalid_argument(expected);
+    }
+    return size_t(n);
+}
+
+// Sizes in bytes or frames.
+static size_t parseSize(const std::string& value)
+{
+    return parseInteger(value, true, "expected a whole size");
+}
+
+// Counts and rates.
+static size_t parseCount(const std::string& value)
+{
+    return parseInteger(value, false, "expected a whole number");
+}
+
+static double parseDouble(const std::string& value)
+{
+    char* end;
+    const double x = std::strtod(value.c_str(), &end);
+    if (end == value.c_str() || *end != '\0') {
+        throw std::invalid_argument("expected a number");
+    }
+    return x;
+}
+
+static bool parseBool(const std::string& value)
+{
+    if (value == "true" || value == "yes" || value == "1") {
+        return true;
+    }
+    if (value == "false" || value == "no" || value == "0") {
+        return false;
+    }
+    throw std::invalid_argument("expected true or false");
+}
+
+template <typename T> static T parseEnum(const std::string& value, const std::map<std::string,T>& names)
+{
+    auto it = names.find(value);
+    if (it == names.end()) {
+        std::string expected;
+        for (const auto& name : names) {
+            expected += expected.empty() ? name.first : ", " + name.first;
+        }
+        throw std::invalid_argument("expected one of " + expected);
+    }
+    return it->second;
+}
+
+typedef std::function<void(Engine::Options&, const std::string&)> Setter;
+
+#define SIZE(field) [](Engine::Options& o, const std::string& v) { o.field = parseSize(v); }
+#define COUNT(field) [](Engine::Options& o, const std::string& v) { o.field = parseCount(v); }
+#define DOUBLE(field) [](Engine::Options& o, const std::string& v) { o.field = parseDouble(v); }
+#define BOOL(field) [](Engine::Options& o, const std::string& v) { o.field = parseBool(v); }
+#define STRING(field) [](Engine::Options& o, const std::string& v) { o.field = v; }
+
+static const std::map<std::string,Setter>& setters()
+{
+    static const std::map<std::string,Setter> kSetters = {
+        { "sound_dir", STRING(soundDir) },
+        { "buffer_size", SIZE(bufferSize) },
+        { "sample_rate", COUNT(sampleRate) },
+        { "num_output_buses", COUNT(numOutputBuses) },
+        { "realtime_memory_size", SIZE(realtimeMemorySize) },
+        { "num_scan_threads", COUNT(numScanThreads) },
+        { "sound_index_path", STRING(soundIndexPath) },
+        { "resample_sounds", BOOL(resampleSounds) },
+        { "resample_cache_dir", STRING(resampleCacheDir) },
+        { "resampler.zero_crossings", COUNT(resampler.zeroCrossings) },
+        { "resampler.cutoff", DOUBLE(resampler.cutoff) },
+        { "resampler.kaiser_beta", DOUBLE(resampler.kaiserBeta) },
+        { "ingest_samples", BOOL(ingestSamples) },
+        { "sample_store_dir", STRING(sampleStoreDir) },
+        { "sample_layout", [](Engine::Options& o, const std::string& v) {
+            o.sampleLayout = parseEnum<SampleFile::Layout>(v, {
+                { "interleaved", SampleFile::kInterleaved },
+                { "planar", SampleFile::kPlanar }
+            });
+        } },
+        { "mapped_sounds.num_cursors", COUNT(mappedSounds.numCursors) },
+        { "mapped_sounds.prefetch_time", DOUBLE(mappedSounds.prefetchTime) },
+        { "mapped_sounds.head_duration", DOUBLE(mappedSounds.headDuration) },
+        { "mapped_sounds.lock_heads", BOOL(mappedSounds.lockHeads) },
+        { "mapped_sounds.poll_interval", DOUBLE(mappedSounds.pollInterval) },
+        { "compress_streamed_sounds", BOOL(compressStreamedSounds) },
+        { "compressed_sound_dir", STRING(compressedSoundDir) },
+        { "lazy_sound_probing", BOOL(lazySoundProbing) },
+        { "background_sound_probing", BOOL(backgroundSoundProbing) },
+        { "sample_cache.memory_budget", SIZE(sampleCache.memoryBudget) },
+        { "sample_cache.short_sound_duration", DOUBLE(sampleCache.shortSoundDuration) },
+        { "sample_cache.hot_trigger_count", COUNT(sampleCache.hotTriggerCount) },
+        { "sample_cache.aging_period", COUNT(sampleCache.agingPeriod) },
+        { "attack_head_duration", DOUBLE(attackHeadDuration) },
+        { "attack_head_memory_budget", SIZE(attackHeadMemoryBudget) },
+        { "disk_streamer.num_streams", COUNT(diskStreamer.numStreams) },
+        { "disk_streamer.max_channels", COUNT(diskStreamer.maxChannels) },
+        { "disk_streamer.buffer_frames", SIZE(diskStreamer.bufferFrames) },
+        { "disk_streamer.read_frames", SIZE(diskStreamer.readFrames) },
+        { "disk_streamer.reader", [](Engine::Options& o, const std::string& v) {
+            o.diskStreamer.reader = parseEnum<DiskStreamer::Reader>(v, {
+                { "thread", DiskStreamer::kThreadReader },
+                { "uring", DiskStreamer::kUringReader }
+            });
+        } },
+        { "disk_streamer.queue_depth", COUNT(diskStreamer.queueDepth) },
+        { "disk_streamer.poll_interval", DOUBLE(diskStreamer.pollInterval) },
+        { "voice_pool_size", COUNT(voicePoolSize) },
+        { "render_threads", COUNT(renderThreads) },
+        { "render_groups", COUNT(renderGroups) },
+        { "max_voices", COUNT(maxVoices) },
+        { "voice_stealing", [](Engine::Options& o, const std::string& v) {
+            o.voiceStealing = parseEnum<Engine::VoiceStealing>(v, {
+                { "none", Engine::kStealNone },
+                { "oldest", Engine::kStealOldest },
+                { "same_sound_first", Engine::kStealSameSoundFirst }
+            });
+        } },
+        { "voice_steal_fade_time", DOUBLE(voiceStealFadeTime) },
+        { "logger.capacity", COUNT(logger.capacity) },
+        { "logger.level", [](Engine::Options& o, const std::string& v) {
+            o.logger.level = parseEnum<LogLevel>(v, {
+                { "none", kLogNone },
+                { "error", kLogError },
+                { "warning", kLogWarning },
+                { "info", kLogInfo },
+                { "debug", kLogDebug }
+            });
+        } },
+        { "logger.poll_interval", DOUBLE(logger.pollInterval) },
+        { "control_rate", DOUBLE(controlRate) },
+        { "scheduling_latency.adaptive", BOOL(schedulingLatency.adaptive) },
+        { "scheduling_latency.latency", DOUBLE(schedulingLatency.latency) },
+        { "scheduling_latency.safety_margin", DOUBLE(schedulingLatency.safetyMargin) },
+        { "scheduling_latency.percentile", DOUBLE(schedulingLatency.percentile) },
+        { "scheduling_latency.min_latency", DOUBLE(schedulingLatency.minLatency) },
+        { "scheduling_latency.max_latency", DOUBLE(schedulingLatency.maxLatency) },
+        { "scheduling_latency.window", COUNT(schedulingLatency.window) },
+        { "scheduling_latency.probe_interval", DOUBLE(schedulingLatency.probeInterval) },
+        { "voice_load_latency", DOUBLE(voiceLoadLatency) },
+        { "trace_input_latency", BOOL(traceInputLatency) }
+    };
+    return kSetters;
+}
+
+#undef SIZE
+#undef COUNT
+#undef DOUBLE
+#undef BOOL
+#undef STRING
+
+void loadEngineOptions(std::istream& in, const std::string& name, Engine::Options& options)
+{
+    std::string line;
+    for (size_t lineNumber=1; std::getline(in, line); lineNumber++) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const std::string location = name + ":" + std::to_string(lineNumber) + ": ";
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            throw std::runtime_error(location + "expected key = value");
+        }
+        const std::string key = trim(line.substr(0, equals));
+        const std::string value = trim(line.substr(equals + 1));
+        auto it = setters().find(key);
+        if (it == setters().end()) {
+            throw std::runtime_error(location + "unknown setting " + key);
+        }
+        try {
+            it->second(options, value);
+        } catch (std::invalid_argument& e) {
+            throw std::runtime_error(location + key + ": " + e.what());
+        }
+    }
+}
+
+void loadEngineOptions(const std::string& path, Engine::Options& options)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Couldn't open configuration file " + path);
+    }
+    loadEngineOptions(in, path, options);
+}
@@ -0,0 +1,49 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CONFIG_HPP_INCLUDED
+#define CONFIG_HPP_INCLUDED
+
+#include "Engine.hpp"
+
+#include <istream>
+#include <string>
+
+// Engine configuration files.
+//
+// A configuration file contains one "key = value" setting per line; empty
+// lines and lines starting with '#' are ignored. Keys are the snake_case
+// names of Engine::Options fields, nested options are prefixed with the
+// name of their group, e.g.
+//
+//     buffer_size = 128
+//     sample_rate = 48000
+//     max_voices = 32
+//     voice_stealing = same_sound_first
+//     disk_streamer.buffer_frames = 16384
+//     scheduling_latency.adaptive = true
+//     logger.level = warning
+//
+// Settings not present in the file keep their current value. Sizes in
+// bytes or frames accept the suffixes k, M and G (powers of 1024); counts
+// and rates are plain whole numbers.
+
+// Read settings from in into options. name is used in error messages.
+// Throws std::runtime_error on unknown keys or malformed values.
+void loadEngineOptions(std::istream& in, const std::string& name, Engine::Options& options);
+
+// Read settings from the file at path into options.
+void loadEngineOptions(const std::string& path, Engine::Options& options);
+
+#endif // CONFIG_HPP_INCLUDED
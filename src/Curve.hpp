@@ -0,0 +1,127 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CURVE_HPP_INCLUDED
+#define CURVE_HPP_INCLUDED
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+template <typename T> T linmap(T outMin, T outMax, T inMin, T inMax, T x)
+{
+    return (x - inMin) / (inMax - inMin) * (outMax - outMin) + outMin;
+}
+
+template <typename T> T expmap(T outMin, T outMax, T inMin, T inMax, T x)
+{
+    return outMin * std::pow(outMax / outMin, (x - inMin) / (inMax - inMin));
+}
+
+template <typename T> T dbamp(T db)
+{
+    return std::pow(T(10), db/T(20));
+}
+
+namespace detail {
+    constexpr double expTaylor(double x, double term, int k)
+    {
+        return k > 48 ? term : term + expTaylor(x, term * x / k, k + 1);
+    }
+}
+
+// Compile time exp for arguments of moderate magnitude (|x| < 10).
+constexpr double constexp(double x)
+{
+    return detail::expTaylor(x, 1., 1);
+}
+
+// Compile time dbamp for constant gains, e.g. for gains in the range
+// [-80, 40] dB.
+constexpr double dbampConstant(double db)
+{
+    return db < -40. ? constexp(-40. * 0.11512925464970229) * dbampConstant(db + 40.)
+                     : constexp(db * 0.11512925464970229);
+}
+
+// Maps a normalized parameter in [0, 1] to a control value.
+//
+// The mapping function is sampled into a table when the curve is created
+// and evaluated by linear interpolation, so that mapping a parameter on
+// the note path doesn't call into libm. Parameters outside [0, 1] are
+// clamped, NaN maps to 0.
+class Curve
+{
+public:
+    typedef std::function<float(float)> Function;
+
+    // Identity mapping.
+    Curve()
+        : Curve([](float x) { return x; }, 1)
+    { }
+
+    // Sample f at size + 1 evenly spaced points in [0, 1].
+    Curve(const Function& f, size_t size=256)
+        : m_table(size + 2)
+        , m_scale(float(size))
+    {
+        assert( size > 0 );
+        for (size_t i=0; i <= size; i++) {
+            m_table[i] = f(float(double(i) / double(size)));
+        }
+        // Guard entry for x == 1.
+        m_table[size + 1] = m_table[size];
+    }
+
+    // Constant value.
+    static Curve constant(float value)
+    {
+        return Curve([=](float) { return value; }, 1);
+    }
+
+    // Linear mapping to [outMin, outMax].
+    static Curve linear(float outMin, float outMax)
+    {
+        return Curve([=](float x) { return linmap(outMin, outMax, 0.f, 1.f, x); }, 1);
+    }
+
+    // Exponential mapping to [outMin, outMax]; both must have the same sign.
+    static Curve exponential(float outMin, float outMax, size_t size=256)
+    {
+        return Curve([=](float x) { return expmap(outMin, outMax, 0.f, 1.f, x); }, size);
+    }
+
+    // Maps linearly to [dbMin, dbMax] decibels and returns the amplitude.
+    static Curve decibels(float dbMin, float dbMax, size_t size=256)
+    {
+        return Curve([=](float x) { return dbamp(linmap(dbMin, dbMax, 0.f, 1.f, x)); }, size);
+    }
+
+    float operator()(float x) const
+    {
+        // Written so that NaN fails the first comparison.
+        const float pos = (x > 0.f ? (x < 1.f ? x : 1.f) : 0.f) * m_scale;
+        const size_t i = size_t(pos);
+        const float a = pos - float(i);
+        return m_table[i] + a * (m_table[i + 1] - m_table[i]);
+    }
+
+private:
+    std::vector<float>  m_table;
+    float               m_scale;
+};
+
+#endif // CURVE_HPP_INCLUDED
@@ -0,0 +1,580 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "DiskStreamer.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+static std::atomic<DiskStreamer*> gInstance(nullptr);
+
+// Rate assumed for paused consumers, so that their deadlines stay finite.
+static const float kMinRate = 1e-3f;
+
+static size_t nextPowerOfTwo(size_t n)
+{
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+DiskStreamer::Options::Options()
+    : numStreams(64)
+    , maxChannels(2)
+    , bufferFrames(32768)
+    , readFrames(8192)
+#if defined(__linux__)
+    , reader(kUringReader)
+#else
+    , reader(kThreadReader)
+#endif
+    , queueDepth(64)
+    , sampleRate(44100)
+    , pollInterval(0.001)
+{
+}
+
+DiskStreamer::DiskStreamer(const Options& options, size_t numSounds, OpenFunction openFile)
+    : m_options(options)
+    , m_openFile(openFile)
+    , m_sounds(numSounds)
+    , m_streams(new Stream[options.numStreams])
+    , m_quit(false)
+{
+    for (auto& sound : m_sounds) {
+        sound.store(nullptr);
+    }
+
+    m_options.bufferFrames = nextPowerOfTwo(m_options.bufferFrames);
+    m_options.readFrames = std::min(m_options.readFrames, m_options.bufferFrames);
+    m_bufferStorage.resize(m_options.numStreams * m_options.bufferFrames * m_options.maxChannels);
+
+    for (size_t i=0; i < m_options.numStreams; i++) {
+        Stream& stream = m_streams[i];
+        stream.m_state = Stream::kFree;
+        stream.m_buffer = m_bufferStorage.data() + i * m_options.bufferFrames * m_options.maxChannels;
+        stream.m_capacity = m_options.bufferFrames;
+        stream.m_mask = m_options.bufferFrames - 1;
+        stream.m_channels = 0;
+        stream.m_readFrame = 0;
+        stream.m_writeFrame = 0;
+        stream.m_eof = false;
+        stream.m_underruns = 0;
+        stream.m_streamUnderruns = 0;
+        stream.m_rate = 1.f;
+        stream.m_file = nullptr;
+        stream.m_fd = -1;
+        stream.m_pendingFrames = 0;
+        stream.m_data = nullptr;
+    }
+    m_schedule.reserve(m_options.numStreams);
+
+    if (m_options.reader == kUringReader) {
+        try {
+            m_uring.reset(new UringReader(unsigned(m_options.queueDepth)));
+        } catch (std::runtime_error& e) {
+            std::cerr << "DiskStreamer: " << e.what() << ", using blocking reads" << std::endl;
+        }
+    }
+
+    m_thread = std::thread([this]() { process(); });
+
+    DiskStreamer* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "DiskStreamer: another instance is already active" << std::endl;
+    }
+}
+
+DiskStreamer::~DiskStreamer()
+{
+    DiskStreamer* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+    stop();
+}
+
+void DiskStreamer::stop()
+{
+    if (m_thread.joinable()) {
+        m_quit = true;
+        m_thread.join();
+        for (size_t i=0; i < m_options.numStreams; i++) {
+            closeFile(m_streams[i]);
+        }
+    }
+}
+
+DiskStreamer* DiskStreamer::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+void DiskStreamer::registerSound(size_t index, std::unique_ptr<StreamSound> sound)
+{
+    assert( index < m_sounds.size() );
+    std::lock_guard<std::mutex> lock(m_soundStorageMutex);
+    m_sounds[index].store(sound.get(), std::memory_order_release);
+    m_soundStorage.push_back(std::move(sound));
+}
+
+Stream* DiskStreamer::openStream(size_t index, const StreamSound* sound, int64_t startFrame, bool loop)
+{
+    if (sound == nullptr) {
+        return nullptr;
+    }
+    for (size_t i=0; i < m_options.numStreams; i++) {
+        Stream& stream = m_streams[i];
+        int expected = Stream::kFree;
+        if (stream.m_state.compare_exchange_strong(expected, Stream::kClaimed, std::memory_order_acquire)) {
+            stream.m_sound.store(index, std::memory_order_relaxed);
+            stream.m_data = sound;
+            stream.m_startFrame = startFrame;
+            stream.m_loop = loop;
+            stream.m_rate.store(1.f, std::memory_order_relaxed);
+            stream.m_streamUnderruns.store(0, std::memory_order_relaxed);
+            // Nothing is readable until the streamer has opened the file.
+            stream.m_readFrame.store(startFrame, std::memory_order_relaxed);
+            stream.m_writeFrame.store(startFrame, std::memory_order_relaxed);
+            stream.m_eof.store(false, std::memory_order_relaxed);
+            stream.m_state.store(Stream::kOpening, std::memory_order_release);
+            return &stream;
+        }
+    }
+    return nullptr;
+}
+
+void DiskStreamer::closeStream(Stream* stream)
+{
+    stream->m_state.store(Stream::kClosing, std::memory_order_release);
+}
+
+size_t DiskStreamer::numUnderruns() const
+{
+    size_t result = 0;
+    for (size_t i=0; i < m_options.numStreams; i++) {
+        result += m_streams[i].m_underruns.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void DiskStreamer::streamStatus(std::vector<StreamStatus>& status) const
+{
+    status.clear();
+    for (size_t i=0; i < m_options.numStreams; i++) {
+        const Stream& stream = m_streams[i];
+        if (stream.m_state.load(std::memory_order_acquire) != Stream::kActive) {
+            continue;
+        }
+        StreamStatus s;
+        s.sound = stream.m_sound.load(std::memory_order_relaxed);
+        s.bufferedFrames = size_t(std::max<int64_t>(0,
+            stream.m_writeFrame.load(std::memory_order_acquire) - stream.m_readFrame.load(std::memory_order_acquire)));
+        s.capacity = stream.m_capacity;
+        s.rate = stream.m_rate.load(std::memory_order_relaxed);
+        s.deadline = deadline(stream) / m_options.sampleRate;
+        s.underruns = stream.m_streamUnderruns.load(std::memory_order_relaxed);
+        status.push_back(s);
+    }
+    std::sort(status.begin(), status.end(), [](const StreamStatus& a, const StreamStatus& b) {
+        return a.deadline < b.deadline;
+    });
+}
+
+bool DiskStreamer::openFile(Stream& stream)
+{
+    const StreamSound* sound = stream.m_data;
+    assert( sound != nullptr );
+
+    if (CompressedSound::hasExtension(sound->path)) {
+        return openCompressedFile(stream, sound->path);
+    }
+    if (m_uring && openWavFile(stream, sound->path)) {
+        return true;
+    }
+
+    Methcla_SoundFile* file;
+    Methcla_SoundFileInfo info;
+    if (m_openFile(sound->path.c_str(), &file, &info) != kMethcla_NoError) {
+        std::cerr << "DiskStreamer: couldn't open " << sound->path << std::endl;
+        return false;
+    }
+    if (info.channels > m_options.maxChannels || info.frames <= 0) {
+        std::cerr << "DiskStreamer: unsupported sound " << sound->path << std::endl;
+        file->close(file);
+        return false;
+    }
+
+    stream.m_file = file;
+    stream.m_channels = info.channels;
+    stream.m_fileFrames = info.frames;
+    stream.m_filePosition = stream.m_loop ? stream.m_startFrame % info.frames
+                                          : std::min(stream.m_startFrame, info.frames);
+    if (file->seek(file, stream.m_filePosition) != kMethcla_NoError) {
+        closeFile(stream);
+        return false;
+    }
+
+    return true;
+}
+
+// Open path for io_uring reads if it is a WAVE file whose samples can be
+// converted in place. Return false to fall back to the sound file API.
+bool DiskStreamer::openWavFile(Stream& stream, const std::string& path)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    WavFormat format;
+    const bool supported = readWavHeader(file, format) == kMethcla_NoError
+                        && format.bytesPerSample <= sizeof(float)
+                        && format.channels <= m_options.maxChannels
+                        && format.numFrames > 0;
+    const int fd = supported ? dup(fileno(file)) : -1;
+    std::fclose(file);
+    if (fd == -1) {
+        return false;
+    }
+
+    stream.m_fd = fd;
+    stream.m_format = format;
+    stream.m_channels = format.channels;
+    stream.m_fileFrames = format.numFrames;
+    stream.m_filePosition = stream.m_loop ? stream.m_startFrame % format.numFrames
+                                          : std::min(stream.m_startFrame, format.numFrames);
+    return true;
+}
+
+bool DiskStreamer::openCompressedFile(Stream& stream, const std::string& path)
+{
+    std::unique_ptr<CompressedSound> file = CompressedSound::open(path);
+    if (!file) {
+        std::cerr << "DiskStreamer: couldn't open " << path << std::endl;
+        return false;
+    }
+    if (file->channels() > m_options.maxChannels || file->frames() <= 0) {
+        std::cerr << "DiskStreamer: unsupported sound " << path << std::endl;
+        return false;
+    }
+
+    stream.m_channels = file->channels();
+    stream.m_fileFrames = file->frames();
+    stream.m_filePosition = stream.m_loop ? stream.m_startFrame % file->frames()
+                                          : std::min(stream.m_startFrame, file->frames());
+    stream.m_compressed = std::move(file);
+    return true;
+}
+
+void DiskStreamer::closeFile(Stream& stream)
+{
+    stream.m_compressed.reset();
+    if (stream.m_file != nullptr) {
+        stream.m_file->close(stream.m_file);
+        stream.m_file = nullptr;
+    }
+    if (stream.m_fd != -1) {
+        close(stream.m_fd);
+        stream.m_fd = -1;
+    }
+}
+
+double DiskStreamer::deadline(const Stream& stream) const
+{
+    const int64_t readFrame = stream.m_readFrame.load(std::memory_order_acquire);
+    const int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_acquire);
+    const float rate = std::max(std::abs(stream.m_rate.load(std::memory_order_relaxed)), kMinRate);
+    return double(std::max<int64_t>(0, writeFrame - readFrame)) / rate;
+}
+
+bool DiskStreamer::needsFill(const Stream& stream) const
+{
+    if ((stream.m_file == nullptr && stream.m_fd == -1 && !stream.m_compressed)
+        || stream.m_pendingFrames > 0
+        || stream.m_eof.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    const int64_t readFrame = stream.m_readFrame.load(std::memory_order_acquire);
+    const int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_relaxed);
+    const size_t space = stream.m_capacity - size_t(writeFrame - readFrame);
+    return space >= m_options.readFrames || space >= stream.m_capacity / 2;
+}
+
+// Read all free space of the stream's buffer, continuing at the start of
+// the buffer and of a looping sound. Return true if any data was read.
+bool DiskStreamer::fill(Stream& stream)
+{
+    bool didRead = false;
+
+    while (!stream.m_eof.load(std::memory_order_relaxed)) {
+        const int64_t readFrame = stream.m_readFrame.load(std::memory_order_acquire);
+        const int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_relaxed);
+        const size_t space = stream.m_capacity - size_t(writeFrame - readFrame);
+        if (space == 0) {
+            break;
+        }
+
+        if (stream.m_filePosition >= stream.m_fileFrames) {
+            if (!stream.m_loop) {
+                stream.m_eof.store(true, std::memory_order_release);
+                break;
+            }
+            if (stream.m_file->seek(stream.m_file, 0) != kMethcla_NoError) {
+                stream.m_eof.store(true, std::memory_order_release);
+                break;
+            }
+            stream.m_filePosition = 0;
+        }
+
+        // Read up to the end of the free space, the end of the buffer or
+        // the end of the file, whichever comes first.
+        const size_t offset = size_t(writeFrame) & stream.m_mask;
+        const size_t numFrames = std::min(std::min(space, stream.m_capacity - offset),
+                                          size_t(stream.m_fileFrames - stream.m_filePosition));
+        size_t numRead = 0;
+        stream.m_file->read_float(stream.m_file, stream.m_buffer + offset * stream.m_channels, numFrames, &numRead);
+        if (numRead == 0) {
+            // Treat read errors as a premature end of file.
+            stream.m_eof.store(true, std::memory_order_release);
+            break;
+        }
+        stream.m_filePosition += numRead;
+        stream.m_writeFrame.store(writeFrame + numRead, std::memory_order_release);
+        didRead = true;
+    }
+
+    return didRead;
+}
+
+// Read and decode the blocks covering the stream's free space, continuing
+// at the start of a looping sound. Return true if any data was read.
+bool DiskStreamer::fillCompressed(Stream& stream)
+{
+    const CompressedSound& file = *stream.m_compressed;
+    const int64_t blockFrames = CompressedSound::kBlockFrames;
+    bool didRead = false;
+
+    while (!stream.m_eof.load(std::memory_order_relaxed)) {
+        const int64_t readFrame = stream.m_readFrame.load(std::memory_order_acquire);
+        int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_relaxed);
+        const size_t space = stream.m_capacity - size_t(writeFrame - readFrame);
+        if (space == 0) {
+            break;
+        }
+
+        if (stream.m_filePosition >= stream.m_fileFrames) {
+            if (!stream.m_loop) {
+                stream.m_eof.store(true, std::memory_order_release);
+                break;
+            }
+            stream.m_filePosition = 0;
+        }
+
+        // Stop at the last block boundary within the free space unless
+        // that is less than a block, so that blocks are rarely decoded
+        // twice.
+        int64_t end = std::min(stream.m_filePosition + int64_t(space), stream.m_fileFrames);
+        if (end < stream.m_fileFrames && end / blockFrames * blockFrames > stream.m_filePosition) {
+            end = end / blockFrames * blockFrames;
+        }
+        const size_t first = size_t(stream.m_filePosition / blockFrames);
+        const size_t last = size_t((end + blockFrames - 1) / blockFrames);
+        if (!file.readBlocks(first, last, m_compressedData)) {
+            // Treat read errors as a premature end of file.
+            stream.m_eof.store(true, std::memory_order_release);
+            break;
+        }
+
+        for (size_t block=first; block < last; block++) {
+            if (!file.decodeBlock(block, m_compressedData.data() + file.blockOffset(first, block), file.blockSize(block), m_decoded)) {
+                std::cerr << "DiskStreamer: corrupt block " << block << " in compressed sound" << std::endl;
+                stream.m_eof.store(true, std::memory_order_release);
+                return didRead;
+            }
+            // Convert the needed frames of the block into the buffer,
+            // continuing at its start, and publish them right away.
+            const int64_t blockStart = int64_t(block) * blockFrames;
+            size_t begin = size_t(stream.m_filePosition - blockStart);
+            const size_t blockEnd = size_t(std::min(end, blockStart + blockFrames) - blockStart);
+            while (begin < blockEnd) {
+                const size_t offset = size_t(writeFrame) & stream.m_mask;
+                const size_t numFrames = std::min(blockEnd - begin, stream.m_capacity - offset);
+                file.convert(m_decoded, begin, begin + numFrames, stream.m_buffer + offset * stream.m_channels);
+                begin += numFrames;
+                writeFrame += numFrames;
+                stream.m_filePosition += numFrames;
+            }
+            stream.m_writeFrame.store(writeFrame, std::memory_order_release);
+            didRead = true;
+        }
+    }
+
+    return didRead;
+}
+
+// The raw samples of a read are placed at the end of the float samples
+// they convert to, so that they can be converted in place.
+static unsigned char* rawSamples(float* dst, size_t numSamples, const WavFormat& format)
+{
+    return reinterpret_cast<unsigned char*>(dst) + numSamples * (sizeof(float) - format.bytesPerSample);
+}
+
+bool DiskStreamer::queueRead(Stream& stream)
+{
+    const int64_t readFrame = stream.m_readFrame.load(std::memory_order_acquire);
+    const int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_relaxed);
+    const size_t space = stream.m_capacity - size_t(writeFrame - readFrame);
+
+    if (stream.m_filePosition >= stream.m_fileFrames) {
+        if (!stream.m_loop) {
+            stream.m_eof.store(true, std::memory_order_release);
+            return false;
+        }
+        stream.m_filePosition = 0;
+    }
+
+    // Read up to the end of the free space, the end of the buffer or the
+    // end of the file; the rest follows once this read has completed.
+    const size_t offset = size_t(writeFrame) & stream.m_mask;
+    const size_t numFrames = std::min(std::min(space, stream.m_capacity - offset),
+                                      size_t(stream.m_fileFrames - stream.m_filePosition));
+    const size_t frameSize = stream.m_format.frameSize();
+    unsigned char* raw = rawSamples(stream.m_buffer + offset * stream.m_channels, numFrames * stream.m_channels, stream.m_format);
+    const uint64_t fileOffset = uint64_t(stream.m_format.dataOffset) + uint64_t(stream.m_filePosition) * frameSize;
+    if (!m_uring->prepareRead(stream.m_fd, raw, numFrames * frameSize, fileOffset, uint64_t(&stream - m_streams.get()))) {
+        return false;
+    }
+    stream.m_pendingFrames = numFrames;
+    return true;
+}
+
+bool DiskStreamer::completeReads()
+{
+    bool didRead = false;
+    uint64_t index;
+    int result;
+
+    while (m_uring->complete(index, result)) {
+        Stream& stream = m_streams[index];
+        const size_t frameSize = stream.m_format.frameSize();
+        const size_t numFrames = result > 0 ? std::min(size_t(result) / frameSize, stream.m_pendingFrames) : 0;
+        if (numFrames == 0) {
+            // Treat read errors as a premature end of file.
+            stream.m_eof.store(true, std::memory_order_release);
+        } else {
+            const int64_t writeFrame = stream.m_writeFrame.load(std::memory_order_relaxed);
+            float* dst = stream.m_buffer + (size_t(writeFrame) & stream.m_mask) * stream.m_channels;
+            const unsigned char* raw = rawSamples(dst, stream.m_pendingFrames * stream.m_channels, stream.m_format);
+            convertWavSamples(stream.m_format, raw, dst, numFrames * stream.m_channels);
+            stream.m_filePosition += numFrames;
+            stream.m_writeFrame.store(writeFrame + numFrames, std::memory_order_release);
+            didRead = true;
+        }
+        stream.m_pendingFrames = 0;
+    }
+
+    return didRead;
+}
+
+void DiskStreamer::process()
+{
+    const auto pollInterval = std::chrono::duration<double>(m_options.pollInterval);
+
+    while (!m_quit) {
+        bool didWork = false;
+
+        // Open and close files first; new streams start from their heads,
+        // so opening is what bounds how soon they can be refilled.
+        m_schedule.clear();
+        for (size_t i=0; i < m_options.numStreams; i++) {
+            Stream& stream = m_streams[i];
+            switch (stream.m_state.load(std::memory_order_acquire)) {
+                case Stream::kOpening: {
+                    const bool opened = openFile(stream);
+                    if (!opened) {
+                        stream.m_eof.store(true, std::memory_order_release);
+                    }
+                    int expected = Stream::kOpening;
+                    // The consumer might have closed the stream meanwhile.
+                    stream.m_state.compare_exchange_strong(expected, Stream::kActive, std::memory_order_acq_rel);
+                    didWork = true;
+                    break;
+                }
+                case Stream::kActive:
+                    if (needsFill(stream)) {
+                        m_schedule.push_back(std::make_pair(deadline(stream), &stream));
+                    }
+                    break;
+                case Stream::kClosing:
+                    // The buffer can only be reused once a read in flight
+                    // has completed.
+                    if (stream.m_pendingFrames == 0) {
+                        closeFile(stream);
+                        stream.m_state.store(Stream::kFree, std::memory_order_release);
+                        didWork = true;
+                    }
+                    break;
+            }
+        }
+
+        // Refill streams earliest deadline first. Streams that become more
+        // urgent during the pass are ordered in the next one.
+        std::sort(m_schedule.begin(), m_schedule.end(),
+            [](const std::pair<double,Stream*>& a, const std::pair<double,Stream*>& b) {
+                return a.first < b.first;
+            });
+        for (const auto& entry : m_schedule) {
+            if (m_quit) {
+                break;
+            }
+            Stream& stream = *entry.second;
+            // The consumer might have closed the stream since it was
+            // scheduled; the file is only closed by this thread though.
+            if (stream.m_state.load(std::memory_order_acquire) != Stream::kActive) {
+                continue;
+            }
+            const bool didRead = stream.m_fd != -1 ? queueRead(stream)
+                               : stream.m_compressed ? fillCompressed(stream)
+                               : fill(stream);
+            if (didRead) {
+                didWork = true;
+            }
+        }
+
+        if (m_uring) {
+            // Submit the reads of this pass together and wait for I/O
+            // rather than polling while reads are in flight.
+            m_uring->submit(!didWork && m_uring->numPending() > 0);
+            if (completeReads()) {
+                didWork = true;
+            }
+        }
+
+        if (!didWork) {
+            std::this_thread::sleep_for(pollInterval);
+        }
+    }
+
+    // Buffers and files must outlive the reads in flight.
+    while (m_uring && m_uring->numPending() > 0) {
+        m_uring->submit(true);
+        completeReads();
+    }
+}
@@ -0,0 +1,311 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DISKSTREAMER_HPP_INCLUDED
+#define DISKSTREAMER_HPP_INCLUDED
+
+#include "CompressedSound.hpp"
+#include "UringReader.hpp"
+#include "WavFormat.hpp"
+
+#include <methcla/file.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A sound that can be played by the stream sampler plugin.
+//
+// The first headFrames frames are kept in memory so that a voice can start
+// playing before its disk stream has delivered any data.
+struct StreamSound
+{
+    std::string             path;
+    Methcla_SoundFileInfo   info;
+    // Interleaved samples of the first headFrames frames.
+    std::vector<float>      head;
+    int64_t                 headFrames;
+};
+
+// Single producer, single consumer ring buffer of interleaved frames read
+// from a sound file, indexed by frame position in the sound.
+//
+// The audio thread claims a stream and reads frames from it, the streamer
+// thread opens the file and keeps the buffer filled ahead of the consumer.
+class Stream
+{
+public:
+    enum State
+    {
+        kFree,
+        kClaimed,
+        kOpening,
+        kActive,
+        kClosing
+    };
+
+    // Return true if frame is available in the buffer.
+    bool contains(int64_t frame) const
+    {
+        return frame >= m_readFrame.load(std::memory_order_relaxed)
+            && frame < m_writeFrame.load(std::memory_order_acquire);
+    }
+
+    // Return a pointer to the interleaved samples of frame, which must be
+    // available.
+    const float* frame(int64_t frame) const
+    {
+        return m_buffer + (size_t(frame) & m_mask) * m_channels;
+    }
+
+    // Release all frames before frame to the producer.
+    void release(int64_t frame)
+    {
+        if (frame > m_readFrame.load(std::memory_order_relaxed)) {
+            m_readFrame.store(std::min(frame, m_writeFrame.load(std::memory_order_acquire)), std::memory_order_release);
+        }
+    }
+
+    // True when the producer has reached the end of a non-looping sound.
+    bool isEndOfFile() const
+    {
+        return m_eof.load(std::memory_order_acquire);
+    }
+
+    // Count a buffer underrun, i.e. a block in which stream data wasn't
+    // available when needed.
+    void underrun()
+    {
+        m_underruns.fetch_add(1, std::memory_order_relaxed);
+        m_streamUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Set the number of sound frames the consumer advances per output
+    // frame, which determines how soon the buffered frames run out.
+    // Called once per block.
+    void setRate(float rate)
+    {
+        m_rate.store(rate, std::memory_order_relaxed);
+    }
+
+private:
+    friend class DiskStreamer;
+
+    std::atomic<int>        m_state;
+    // Request written by the consumer before switching to kOpening.
+    std::atomic<size_t>     m_sound;
+    const StreamSound*      m_data;
+    int64_t                 m_startFrame;
+    bool                    m_loop;
+
+    float*                  m_buffer;
+    size_t                  m_mask;
+    size_t                  m_capacity;
+    unsigned int            m_channels;
+
+    std::atomic<int64_t>    m_readFrame;
+    std::atomic<int64_t>    m_writeFrame;
+    std::atomic<bool>       m_eof;
+    std::atomic<size_t>     m_underruns;
+    // Underruns since the stream was opened.
+    std::atomic<size_t>     m_streamUnderruns;
+    std::atomic<float>      m_rate;
+
+    // Producer state.
+    Methcla_SoundFile*      m_file;
+    // WAVE file read through io_uring instead of m_file, or -1.
+    int                     m_fd;
+    WavFormat               m_format;
+    // Block compressed container read instead of m_file, or nullptr.
+    std::unique_ptr<CompressedSound> m_compressed;
+    // Frames of the read in flight, zero if none.
+    size_t                  m_pendingFrames;
+    int64_t                 m_fileFrames;
+    int64_t                 m_filePosition;
+};
+
+// Snapshot of an active stream for monitoring.
+struct StreamStatus
+{
+    size_t  sound;
+    // Frames buffered ahead of the consumer.
+    size_t  bufferedFrames;
+    size_t  capacity;
+    float   rate;
+    // Time in seconds until the buffered frames run out at the current
+    // rate.
+    double  deadline;
+    // Underruns since the stream was opened.
+    size_t  underruns;
+};
+
+// Streams sound files from disk into a fixed number of preallocated ring
+// buffers on a background thread.
+//
+// Sounds are registered by index before voices refer to them; lookups and
+// stream (de)allocation are lock-free and can be called from the audio
+// thread.
+//
+// Streams are refilled in order of their deadlines, i.e. the time until
+// their buffered frames run out at the rate published by their consumer,
+// so that under I/O pressure the stream closest to underrunning is served
+// first. Each refill reads all free space of a buffer in one sequential
+// request instead of several small ones.
+//
+// On Linux uncompressed WAVE files are read through io_uring by default:
+// the reads of all streams that need data are submitted together and
+// complete asynchronously, so that the device sees a deep queue instead of
+// one blocking read at a time. Other files, and all files when io_uring
+// isn't available, are read with blocking reads on the streamer thread.
+//
+// Sounds whose path has the CompressedSound extension are streamed from
+// their compressed blocks, which are read with a single blocking read per
+// refill and decoded on the streamer thread straight into the buffer.
+class DiskStreamer
+{
+public:
+    enum Reader
+    {
+        // Blocking reads through the sound file API on the streamer thread.
+        kThreadReader,
+        // Batched asynchronous reads through io_uring, falling back to
+        // kThreadReader.
+        kUringReader
+    };
+
+    struct Options
+    {
+        Options();
+
+        // Maximum number of concurrent streams.
+        size_t numStreams;
+        // Maximum number of channels of streamed sounds.
+        unsigned int maxChannels;
+        // Ring buffer size in frames per stream; rounded up to a power of
+        // two.
+        size_t bufferFrames;
+        // Minimum number of frames read from a file at once; streams with
+        // less free space wait until more has been consumed, unless their
+        // buffer is at most half full.
+        size_t readFrames;
+        // How sound files are read.
+        Reader reader;
+        // Maximum number of io_uring reads in flight.
+        size_t queueDepth;
+        // Output sample rate the consumers' rates refer to; only used for
+        // reporting deadlines in seconds.
+        double sampleRate;
+        // Time in seconds the streamer thread sleeps when there is nothing
+        // to do.
+        double pollInterval;
+    };
+
+    typedef std::function<Methcla_Error(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)> OpenFunction;
+
+    DiskStreamer(const Options& options, size_t numSounds, OpenFunction openFile);
+    ~DiskStreamer();
+
+    DiskStreamer(const DiskStreamer& other) = delete;
+    DiskStreamer& operator=(const DiskStreamer& other) = delete;
+
+    // The streamer used by the stream sampler plugin, if any.
+    static DiskStreamer* instance();
+
+    // Stop the streamer thread and close all files. Streams can still be
+    // closed afterwards, but won't receive any more data.
+    void stop();
+
+    // Register sound data for sound index, replacing earlier data, e.g.
+    // after the sound has been converted. All registered data stays alive
+    // until the streamer is destroyed, so voices and streams keep using
+    // the data they were started with.
+    void registerSound(size_t index, std::unique_ptr<StreamSound> sound);
+
+    // Return the sound registered for index or nullptr. Lock-free.
+    const StreamSound* sound(size_t index) const
+    {
+        return index < m_sounds.size() ? m_sounds[index].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Claim a stream for reading sound, the data registered for index,
+    // from startFrame on, wrapping around at the end if loop is true.
+    // Returns nullptr if no stream is available. Lock-free.
+    Stream* openStream(size_t index, const StreamSound* sound, int64_t startFrame, bool loop);
+
+    // Return a stream to the streamer. Lock-free.
+    void closeStream(Stream* stream);
+
+    // Total number of buffer underruns over all streams.
+    size_t numUnderruns() const;
+
+    // Reader actually used, i.e. kThreadReader if io_uring was requested
+    // but isn't available.
+    Reader reader() const
+    {
+        return m_uring ? kUringReader : kThreadReader;
+    }
+
+    // Replace the contents of status with the fill levels and underrun
+    // counts of the active streams, most urgent first. Can be called from
+    // any thread but the audio thread.
+    void streamStatus(std::vector<StreamStatus>& status) const;
+
+private:
+    void process();
+    bool openFile(Stream& stream);
+    bool openWavFile(Stream& stream, const std::string& path);
+    bool openCompressedFile(Stream& stream, const std::string& path);
+    void closeFile(Stream& stream);
+    // Time in output frames until the consumer of stream has played all
+    // buffered frames.
+    double deadline(const Stream& stream) const;
+    // True if stream has enough free space for a read.
+    bool needsFill(const Stream& stream) const;
+    bool fill(Stream& stream);
+    // Like fill for compressed streams.
+    bool fillCompressed(Stream& stream);
+    // Queue an io_uring read of the stream's free space. Return true if a
+    // read was queued.
+    bool queueRead(Stream& stream);
+    // Convert the data of completed io_uring reads. Return true if any
+    // data was read.
+    bool completeReads();
+
+private:
+    Options                                     m_options;
+    OpenFunction                                m_openFile;
+    std::vector<std::atomic<const StreamSound*>> m_sounds;
+    std::mutex                                  m_soundStorageMutex;
+    std::vector<std::unique_ptr<StreamSound>>   m_soundStorage;
+    std::vector<float>                          m_bufferStorage;
+    std::unique_ptr<Stream[]>                   m_streams;
+    // Streams to refill in the current pass and their deadlines.
+    std::vector<std::pair<double,Stream*>>      m_schedule;
+    std::unique_ptr<UringReader>                m_uring;
+    // Compressed blocks and decoded samples of the current refill.
+    std::vector<unsigned char>                  m_compressedData;
+    std::vector<uint32_t>                       m_decoded;
+    std::atomic<bool>                           m_quit;
+    std::thread                                 m_thread;
+};
+
+#endif // DISKSTREAMER_HPP_INCLUDED
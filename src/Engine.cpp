@@ -15,97 +15,805 @@
 #include "Engine.hpp"
 
 #include <methcla/common.h>
-#include <methcla/plugins/pro/soundfile_api_extaudiofile.h>
+#if defined(__APPLE__)
+# include <methcla/plugins/pro/soundfile_api_extaudiofile.h>
+#elif defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+# include <methcla/plugins/soundfile_api_libsndfile.h>
+#else
+# include "plugins/soundfile_api_wav.h"
+#endif
 #include <methcla/plugins/pro/disksampler.h>
-#include <methcla/plugins/sampler.h>
 #include <methcla/plugins/patch-cable.h>
+#include "plugins/latency_probe.h"
+#include "plugins/cached_sampler.h"
+#include "plugins/mapped_sampler.h"
+#include "plugins/parallel_sampler.h"
+#include "plugins/stream_sampler.h"
+
+#include "Parallel.hpp"
+#include "SampleCache.hpp"
+#include "SoundIndex.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <tinydir.h>
 
-Sound::Sound(const Methcla::Engine& engine, const std::string& path)
-    : m_path(path)
+struct Sound::Metadata
 {
-    Methcla_SoundFile* file;
-    Methcla_SoundFileInfo info;
-    Methcla_Error err = methcla_engine_soundfile_open(engine, m_path.c_str(), kMethcla_FileModeRead, &file, &info);
-    if (err != kMethcla_NoError) {
-        throw std::runtime_error("Opening sound file " + path + " failed");
+    enum State
+    {
+        kUnprobed,
+        kValid,
+        kInvalid
+    };
+
+    Metadata()
+        : state(kUnprobed)
+        , duration(0.f)
+        , hasPlaybackFile(false)
+        , hasStreamFile(false)
+    {
+        info.frames = 0;
+        info.channels = 0;
+        info.samplerate = 0;
     }
-    file->close(file);
-    m_duration = (double)info.frames / (double)info.samplerate;
+
+    std::mutex              mutex;
+    std::atomic<int>        state;
+    Methcla_SoundFileInfo   info;
+    float                   duration;
+    // Written once before hasPlaybackFile is set.
+    std::atomic<bool>       hasPlaybackFile;
+    std::string             playbackPath;
+    Methcla_SoundFileInfo   playbackInfo;
+    // Written once before hasStreamFile is set.
+    std::atomic<bool>       hasStreamFile;
+    std::string             streamPath;
+
+    void set(const Methcla_SoundFileInfo& newInfo)
+    {
+        info = newInfo;
+        duration = info.samplerate > 0 ? (double)info.frames / (double)info.samplerate : 0.;
+    }
+};
+
+Sound::Sound(const Methcla::Engine& engine, const std::string& path, const FileStamp& stamp)
+    : m_engine(&engine)
+    , m_path(path)
+    , m_stamp(stamp)
+    , m_metadata(std::make_shared<Metadata>())
+{
 }
 
-// Return a list of sounds in directory path.
-static std::vector<Sound> loadSounds(const Methcla::Engine& engine, const std::string& path)
+Sound::Sound(const Methcla::Engine& engine, const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info)
+    : Sound(engine, path, stamp)
 {
-    std::vector<Sound> result;
+    m_metadata->set(info);
+    m_metadata->state = Metadata::kValid;
+}
+
+bool Sound::probe() const
+{
+    int state = m_metadata->state;
+    if (state == Metadata::kUnprobed) {
+        std::lock_guard<std::mutex> lock(m_metadata->mutex);
+        state = m_metadata->state;
+        if (state == Metadata::kUnprobed) {
+            Methcla_SoundFile* file;
+            Methcla_SoundFileInfo info;
+            Methcla_Error err = methcla_engine_soundfile_open(*m_engine, m_path.c_str(), kMethcla_FileModeRead, &file, &info);
+            if (err == kMethcla_NoError) {
+                file->close(file);
+                m_metadata->set(info);
+                state = Metadata::kValid;
+            } else {
+                std::cerr << "Opening sound file " << m_path << " failed" << std::endl;
+                state = Metadata::kInvalid;
+            }
+            m_metadata->state = state;
+        }
+    }
+    return state == Metadata::kValid;
+}
+
+bool Sound::isProbed() const
+{
+    return m_metadata->state != Metadata::kUnprobed;
+}
+
+const Methcla_SoundFileInfo& Sound::info() const
+{
+    probe();
+    return m_metadata->info;
+}
+
+float Sound::duration() const
+{
+    probe();
+    return m_metadata->duration;
+}
+
+void Sound::setPlaybackFile(const std::string& path, const Methcla_SoundFileInfo& info) const
+{
+    std::lock_guard<std::mutex> lock(m_metadata->mutex);
+    if (!m_metadata->hasPlaybackFile) {
+        m_metadata->playbackPath = path;
+        m_metadata->playbackInfo = info;
+        m_metadata->hasPlaybackFile.store(true, std::memory_order_release);
+    }
+}
+
+const std::string& Sound::playbackPath() const
+{
+    return m_metadata->hasPlaybackFile.load(std::memory_order_acquire) ? m_metadata->playbackPath : m_path;
+}
+
+const Methcla_SoundFileInfo& Sound::playbackInfo() const
+{
+    return m_metadata->hasPlaybackFile.load(std::memory_order_acquire) ? m_metadata->playbackInfo : info();
+}
+
+void Sound::setStreamFile(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(m_metadata->mutex);
+    if (!m_metadata->hasStreamFile) {
+        m_metadata->streamPath = path;
+        m_metadata->hasStreamFile.store(true, std::memory_order_release);
+    }
+}
+
+const std::string& Sound::streamPath() const
+{
+    return m_metadata->hasStreamFile.load(std::memory_order_acquire) ? m_metadata->streamPath : playbackPath();
+}
+
+// Return the sorted list of regular files in directory path.
+static std::vector<std::string> listSoundFiles(const std::string& path)
+{
+    std::vector<std::string> result;
 
     tinydir_dir dir;
-    tinydir_open(&dir, path.c_str());
+    if (tinydir_open(&dir, path.c_str()) == -1) {
+        std::cerr << "Couldn't open sound directory " << path << std::endl;
+        return result;
+    }
 
     while (dir.has_next)
     {
         tinydir_file file;
         tinydir_readfile(&dir, &file);
-        if (!file.is_dir) {
-            try {
-                result.push_back(Sound(engine, path + "/" + std::string(file.name)));
-            } catch (std::exception& e) {
-                std::cerr << "Exception while registering sound " << file.name << ": " << e.what() << std::endl;
-            }
+        // Skip directories and hidden files
+        if (!file.is_dir && file.name[0] != '.') {
+            result.push_back(path + "/" + std::string(file.name));
         }
         tinydir_next(&dir);
     }
 
     tinydir_close(&dir);
 
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+// Return a list of sounds in directory path, sorted by file name.
+//
+// Sounds with an up to date entry in index are registered with their
+// metadata, the others are registered for lazy probing. Files are stat'ed
+// concurrently by numThreads worker threads (0 means one per hardware
+// thread).
+static std::vector<Sound> loadSounds(const Methcla::Engine& engine, const std::string& path, const SoundIndex& index, size_t numThreads)
+{
+    const std::vector<std::string> files = listSoundFiles(path);
+    std::vector<std::unique_ptr<Sound>> sounds(files.size());
+
+    parallelFor(files.size(), numThreads, [&](size_t i) {
+        FileStamp stamp;
+        if (getFileStamp(files[i], stamp)) {
+            Methcla_SoundFileInfo info;
+            if (index.lookup(files[i], stamp, info)) {
+                sounds[i].reset(new Sound(engine, files[i], stamp, info));
+            } else {
+                sounds[i].reset(new Sound(engine, files[i], stamp));
+            }
+        }
+    });
+
+    std::vector<Sound> result;
+    result.reserve(files.size());
+
+    for (size_t i=0; i < files.size(); i++) {
+        if (sounds[i]) {
+            result.push_back(*sounds[i]);
+        } else {
+            std::cerr << "Couldn't stat sound file " << files[i] << std::endl;
+        }
+    }
+
     return result;
 }
 
+Engine::Options::Options(const std::string& soundDir_)
+    : soundDir(soundDir_)
+    , bufferSize(256)
+    , sampleRate(0)
+    , numOutputBuses(2)
+    , realtimeMemorySize(0)
+    , soundFileAPI(Engine::defaultSoundFileAPI())
+    , numScanThreads(0)
+    , resampleSounds(true)
+    , ingestSamples(false)
+    , sampleLayout(SampleFile::kInterleaved)
+    , compressStreamedSounds(false)
+    , lazySoundProbing(true)
+    , backgroundSoundProbing(true)
+    , attackHeadDuration(0.2)
+    , attackHeadMemoryBudget(64*1024*1024)
+    , voicePoolSize(32)
+    , renderThreads(1)
+    , renderGroups(0)
+    , maxVoices(64)
+    , voiceStealing(kStealOldest)
+    , voiceStealFadeTime(0.01)
+    , controlRate(200.)
+    , voiceLoadLatency(0.1)
+    , traceInputLatency(true)
+{
+}
+
+// Default voice amplitude.
+static constexpr float kVoiceAmp = float(dbampConstant(-3.));
+
+const Engine::InstrumentId Engine::kDefaultInstrument;
+
+Engine::VoiceCurves::VoiceCurves()
+    : amp(Curve::constant(kVoiceAmp))
+    , rate(Curve::exponential(1.f/4.f, 4.f))
+{
+}
+
+Methcla_LibraryFunction Engine::defaultSoundFileAPI()
+{
+#if defined(__APPLE__)
+    return methcla_soundfile_api_extaudiofile;
+#elif defined(METHCLA_SAMPLER_USE_LIBSNDFILE)
+    return methcla_soundfile_api_libsndfile;
+#else
+    return methcla_soundfile_api_wav;
+#endif
+}
+
 Engine::Engine(const std::string& soundDir)
+    : Engine(Options(soundDir))
+{
+}
+
+Engine::Engine(const Options& engineOptions)
     : m_engine(nullptr)
     , m_nextSound(0)
+    , m_soundScanTime(0.)
+    , m_numOutputBuses(std::max<size_t>(engineOptions.numOutputBuses, 1))
+    , m_voices(engineOptions.maxVoices)
+    , m_voiceStealing(engineOptions.voiceStealing)
+    , m_voiceStealFadeTime(engineOptions.voiceStealFadeTime)
+    , m_soundIndexPath(engineOptions.soundIndexPath)
+    , m_numScanThreads(engineOptions.numScanThreads)
+    , m_soundIndexDirty(false)
+    , m_quitProbing(false)
+    , m_attackHeadDuration(engineOptions.attackHeadDuration)
+    , m_attackHeadMemoryBudget(engineOptions.attackHeadMemoryBudget)
+    , m_attackHeadBytes(0)
+    , m_controlRate(engineOptions.controlRate)
+    , m_instruments(1, engineOptions.voiceCurves)
+    , m_schedulingLatency(new SchedulingLatency(engineOptions.schedulingLatency))
+    , m_voiceLoadLatency(engineOptions.voiceLoadLatency)
+    , m_inputLatency(engineOptions.traceInputLatency ? new InputLatency : nullptr)
+    , m_quitControl(false)
 {
     Methcla::EngineOptions options;
-    options.audioDriver.bufferSize = 256;
-    options << methcla_soundfile_api_extaudiofile
-            << methcla_plugins_sampler
+    options.audioDriver.bufferSize = engineOptions.bufferSize;
+    options.audioDriver.numOutputs = m_numOutputBuses;
+    if (engineOptions.sampleRate > 0) {
+        options.audioDriver.sampleRate = engineOptions.sampleRate;
+    }
+    if (engineOptions.realtimeMemorySize > 0) {
+        options.realtimeMemorySize = engineOptions.realtimeMemorySize;
+    }
+    for (auto plugin : engineOptions.plugins) {
+        options << plugin;
+    }
+    options << engineOptions.soundFileAPI
             << methcla_plugins_disksampler
-            << methcla_plugins_patch_cable;
+            << methcla_plugins_patch_cable
+            << methcla_sampler_plugins_stream_sampler
+            << methcla_sampler_plugins_parallel_sampler
+            << methcla_sampler_plugins_mapped_sampler
+            << methcla_sampler_plugins_cached_sampler
+            << methcla_sampler_plugins_latency_probe;
 
     // Create the engine with a set of plugins.
     m_engine = new Methcla::Engine(options);
 
-    m_sounds = loadSounds(*m_engine, soundDir);
+    const std::string resampleCacheDir = engineOptions.resampleCacheDir.empty() && !m_soundIndexPath.empty()
+                                       ? m_soundIndexPath + ".resampled"
+                                       : engineOptions.resampleCacheDir;
+    if (engineOptions.resampleSounds && engineOptions.sampleRate > 0 && !resampleCacheDir.empty()) {
+        m_resampleCache.reset(new ResampleCache(
+            resampleCacheDir,
+            engineOptions.sampleRate,
+            engineOptions.resampler,
+            [this](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                return methcla_engine_soundfile_open(*m_engine, path, kMethcla_FileModeRead, file, info);
+            }
+        ));
+    }
+
+    const std::string sampleStoreDir = engineOptions.sampleStoreDir.empty() && !m_soundIndexPath.empty()
+                                     ? m_soundIndexPath + ".samples"
+                                     : engineOptions.sampleStoreDir;
+    if (engineOptions.ingestSamples && !sampleStoreDir.empty()) {
+        m_sampleStore.reset(new SampleStore(
+            sampleStoreDir,
+            engineOptions.sampleLayout,
+            [this](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                return methcla_engine_soundfile_open(*m_engine, path, kMethcla_FileModeRead, file, info);
+            }
+        ));
+    }
+
+    const std::string compressedSoundDir = engineOptions.compressedSoundDir.empty() && !m_soundIndexPath.empty()
+                                         ? m_soundIndexPath + ".compressed"
+                                         : engineOptions.compressedSoundDir;
+    if (engineOptions.compressStreamedSounds && m_attackHeadDuration > 0. && !compressedSoundDir.empty()) {
+        m_compressedStore.reset(new CompressedStore(
+            compressedSoundDir,
+            [this](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                return methcla_engine_soundfile_open(*m_engine, path, kMethcla_FileModeRead, file, info);
+            }
+        ));
+    }
+
+    const auto scanStartTime = std::chrono::steady_clock::now();
+    size_t numUnprobed = 0;
+    {
+        const SoundIndex index(m_soundIndexPath);
+        m_sounds = loadSounds(*m_engine, engineOptions.soundDir, index, m_numScanThreads);
+        for (const auto& sound : m_sounds) {
+            if (!sound.isProbed()) {
+                numUnprobed++;
+            }
+        }
+        m_soundIndexDirty = numUnprobed > 0 || index.size() != m_sounds.size();
+    }
+    m_soundInstruments.assign(m_sounds.size(), kDefaultInstrument);
+    if (m_sampleStore) {
+        m_mappedSounds.reset(new MappedSounds(engineOptions.mappedSounds, m_sounds.size()));
+        m_sampleFilePaths.resize(m_sounds.size());
+    }
+    if (!engineOptions.lazySoundProbing) {
+        probeSounds();
+    }
+    m_soundScanTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - scanStartTime).count();
+
+    std::cout << "Registered " << m_sounds.size() << " sounds"
+              << " from " << engineOptions.soundDir
+              << " (" << numUnprobed << " not indexed)"
+              << " in " << m_soundScanTime << "s"
+              << std::endl;
+
+    Logger::Sink logSink = engineOptions.logSink;
+    if (!logSink) {
+        // m_sounds isn't modified after construction and can be read from
+        // the logger thread.
+        logSink = [this](const LogRecord& record) {
+            Logger::format(std::cout, record);
+            if (record.sound < m_sounds.size()) {
+                std::cout << " " << m_sounds[record.sound].path();
+            }
+            std::cout << std::endl;
+        };
+    }
+    m_logger.reset(new Logger(engineOptions.logger, logSink));
+
+    m_sampleCache.reset(new SampleCache(
+        engineOptions.sampleCache,
+        m_sounds.size(),
+        [this](size_t sound, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+            return methcla_engine_soundfile_open(*m_engine, m_sounds[sound].playbackPath().c_str(), kMethcla_FileModeRead, file, info);
+        }
+    ));
+    m_voicePlans.reserve(engineOptions.maxVoices);
+    m_voicesToStop.reserve(engineOptions.maxVoices);
+    m_pendingUpdates.reserve(engineOptions.maxVoices);
+
+    if (m_attackHeadDuration > 0.) {
+        DiskStreamer::Options diskStreamerOptions(engineOptions.diskStreamer);
+        if (engineOptions.sampleRate > 0) {
+            diskStreamerOptions.sampleRate = double(engineOptions.sampleRate);
+        }
+        m_diskStreamer.reset(new DiskStreamer(
+            diskStreamerOptions,
+            m_sounds.size(),
+            [this](const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info) {
+                return methcla_engine_soundfile_open(*m_engine, path, kMethcla_FileModeRead, file, info);
+            }
+        ));
+    }
+
+    if (m_diskStreamer && engineOptions.voicePoolSize > 0 && engineOptions.renderThreads != 1) {
+        ParallelRenderer::Options rendererOptions;
+        rendererOptions.numThreads = engineOptions.renderThreads;
+        m_renderer.reset(new ParallelRenderer(rendererOptions));
+    }
+
+    if (engineOptions.lazySoundProbing && engineOptions.backgroundSoundProbing && numUnprobed > 0) {
+        m_soundProber = std::thread([this]() { probeSounds(); });
+    }
+
+    if (m_diskStreamer) {
+        m_headRequests.reserve(m_sounds.size());
+        m_headLoads.reserve(m_sounds.size());
+        m_headRequested.resize(m_sounds.size());
+        m_headLoader = std::thread([this]() { loadRequestedAttackHeads(); });
+    }
 
     // Start the engine.
     engine().start();
 
     m_voiceGroup = engine().group(engine().root());
 
-    for (auto bus : { 0, 1 })
+    for (size_t bus=0; bus < m_numOutputBuses; bus++)
     {
         Methcla::Request request(engine());
         request.openBundle(Methcla::immediately);
         auto synth = request.synth(METHCLA_PLUGINS_PATCH_CABLE_URI, engine().root(), {});
         request.activate(synth);
-        request.mapInput(synth, 0, Methcla::AudioBusId(bus));
-        request.mapOutput(synth, 0, Methcla::AudioBusId(bus), Methcla::kBusMappingExternal);
+        request.mapInput(synth, 0, Methcla::AudioBusId(int32_t(bus)));
+        request.mapOutput(synth, 0, Methcla::AudioBusId(int32_t(bus)), Methcla::kBusMappingExternal);
         request.closeBundle();
         request.send();
         m_patchCables.push_back(synth);
     }
+
+    if (m_renderer) {
+        // Pooled voices stay silent until their gate opens.
+        const size_t numVoices = engineOptions.voicePoolSize;
+        const size_t numGroups = engineOptions.renderGroups > 0 ? engineOptions.renderGroups : 4 * m_renderer->numThreads();
+        std::vector<float> controls;
+        controls.reserve(numVoices * kMethclaSampler_ParallelSamplerNumVoiceControls);
+        for (size_t i=0; i < numVoices; i++) {
+            controls.insert(controls.end(), { 0.f, 1.f, -1.f, 0.f, 0.f, -1.f });
+        }
+        Methcla::Request request(engine());
+        request.openBundle(Methcla::immediately);
+        const Methcla::SynthId synth = request.synth(
+            METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_URI,
+            m_voiceGroup,
+            controls,
+            { Methcla::Value(int(numVoices)), Methcla::Value(int(numGroups)), Methcla::Value(true) }
+        );
+        request.mapOutput(synth, 0, outputBus(0));
+        request.mapOutput(synth, 1, outputBus(1));
+        request.activate(synth);
+        request.closeBundle();
+        request.send();
+        for (size_t i=0; i < numVoices; i++) {
+            m_voicePool.push_back({ synth, Methcla_PortCount(i * kMethclaSampler_ParallelSamplerNumVoiceControls), 0. });
+        }
+        std::cout << "Rendering " << numVoices << " pooled voices in " << numGroups
+                  << " groups on " << m_renderer->numThreads() << " threads" << std::endl;
+    } else if (m_diskStreamer && engineOptions.voicePoolSize > 0) {
+        Methcla::Request request(engine());
+        request.openBundle(Methcla::immediately);
+        for (size_t i=0; i < engineOptions.voicePoolSize; i++) {
+            // Pooled voices stay silent until their gate opens.
+            const Methcla::SynthId synth = request.synth(
+                METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_URI,
+                m_voiceGroup,
+                { 0.f, 1.f, -1.f, 0.f, 0.f, -1.f },
+                { Methcla::Value(true) }
+            );
+            request.mapOutput(synth, 0, outputBus(0));
+            request.mapOutput(synth, 1, outputBus(1));
+            request.activate(synth);
+            m_voicePool.push_back({ synth, 0, 0. });
+        }
+        request.closeBundle();
+        request.send();
+    }
+
+    const bool adaptiveLatency = m_schedulingLatency->options().adaptive;
+    if (m_controlRate > 0. || adaptiveLatency) {
+        m_controlThread = std::thread([this, adaptiveLatency]() {
+            const double probeInterval = m_schedulingLatency->options().probeInterval;
+            const std::chrono::duration<double> controlPeriod(m_controlRate > 0. ? 1. / m_controlRate : probeInterval);
+            auto nextFlush = std::chrono::steady_clock::now();
+            auto nextProbe = nextFlush;
+            while (!m_quitControl) {
+                // Don't try to catch up with missed periods.
+                nextFlush = std::max(
+                    nextFlush + std::chrono::duration_cast<std::chrono::steady_clock::duration>(controlPeriod),
+                    std::chrono::steady_clock::now()
+                );
+                std::this_thread::sleep_until(nextFlush);
+                if (m_controlRate > 0.) {
+                    flushVoiceUpdates();
+                }
+                if (m_inputLatency) {
+                    m_inputLatency->update();
+                }
+                if (adaptiveLatency) {
+                    m_schedulingLatency->update();
+                    if (nextFlush >= nextProbe) {
+                        sendLatencyProbe();
+                        nextProbe = nextFlush + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(probeInterval)
+                        );
+                    }
+                }
+            }
+        });
+    }
 }
 
 Engine::~Engine()
 {
+    m_quitControl = true;
+    if (m_controlThread.joinable()) {
+        m_controlThread.join();
+    }
+    m_quitProbing = true;
+    if (m_soundProber.joinable()) {
+        m_soundProber.join();
+    }
+    if (m_headLoader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_headMutex);
+            m_headCondition.notify_one();
+        }
+        m_headLoader.join();
+    }
+    writeSoundIndex();
+
     engine().free(m_voiceGroup);
     for (auto synth : m_patchCables) {
         engine().free(synth);
     }
+    // The streamer thread opens files through the engine, so stop it first;
+    // synths closing their streams still need the streamer object though.
+    if (m_diskStreamer) {
+        m_diskStreamer->stop();
+    }
     delete m_engine;
+    m_diskStreamer.reset();
+}
+
+// Probe all sounds that haven't been probed yet, convert them to the
+// engine's sample rate and update the index.
+void Engine::probeSounds()
+{
+    parallelFor(m_sounds.size(), m_numScanThreads, [this](size_t i) {
+        if (!m_quitProbing) {
+            if (m_sounds[i].probe()) {
+                resampleSound(i);
+                ingestSound(i);
+                compressSound(i);
+                if (m_diskStreamer) {
+                    loadAttackHead(i);
+                }
+            }
+        }
+    });
+    if (!m_quitProbing) {
+        writeSoundIndex();
+        if (m_resampleCache) {
+            // All sounds have been converted; the other files are left
+            // over from changed or removed sounds.
+            std::vector<std::string> used;
+            for (const auto& sound : m_sounds) {
+                if (sound.playbackPath() != sound.path()) {
+                    used.push_back(sound.playbackPath());
+                }
+            }
+            m_resampleCache->removeUnused(std::move(used));
+        }
+        if (m_sampleStore) {
+            m_sampleStore->removeUnused(m_sampleFilePaths);
+        }
+        if (m_compressedStore) {
+            std::vector<std::string> used;
+            for (const auto& sound : m_sounds) {
+                if (sound.streamPath() != sound.playbackPath()) {
+                    used.push_back(sound.streamPath());
+                }
+            }
+            m_compressedStore->removeUnused(std::move(used));
+        }
+    }
+}
+
+// Play a sound from a copy converted to the engine's sample rate if its
+// rate differs.
+void Engine::resampleSound(size_t soundIndex)
+{
+    const Sound& sound = m_sounds[soundIndex];
+    if (!m_resampleCache || !sound.probe()) {
+        return;
+    }
+    const Methcla_SoundFileInfo& info = sound.info();
+    if (info.frames == 0 || info.samplerate == m_resampleCache->sampleRate()) {
+        return;
+    }
+    std::string path;
+    Methcla_SoundFileInfo playbackInfo;
+    if (m_resampleCache->convert(sound.path(), sound.stamp(), info, path, playbackInfo)) {
+        sound.setPlaybackFile(path, playbackInfo);
+    }
+}
+
+// Decode a sound into its sample container and register the mapping for
+// the mapped sampler.
+void Engine::ingestSound(size_t soundIndex)
+{
+    const Sound& sound = m_sounds[soundIndex];
+    if (!m_sampleStore || !sound.probe() || sound.info().frames == 0) {
+        return;
+    }
+    std::unique_ptr<SampleFile> sampleFile = m_sampleStore->ingest(
+        sound.path(), sound.stamp(), sound.playbackPath(), sound.playbackInfo(), m_sampleFilePaths[soundIndex]);
+    if (sampleFile) {
+        m_mappedSounds->registerSound(soundIndex, std::move(sampleFile));
+    }
+}
+
+// Stream a sound from a losslessly compressed copy of its playback file.
+void Engine::compressSound(size_t soundIndex)
+{
+    const Sound& sound = m_sounds[soundIndex];
+    if (!m_compressedStore || !sound.probe() || sound.info().frames == 0) {
+        return;
+    }
+    std::string path;
+    if (m_compressedStore->compress(sound.path(), sound.stamp(), sound.playbackPath(), sound.playbackInfo(), path)) {
+        sound.setStreamFile(path);
+    }
+}
+
+// Read the first attackHeadDuration seconds of a sound into memory and
+// register it with the disk streamer, replacing a head read before the
+// sound's playback or stream file changed. Return true if the sound has a
+// head.
+bool Engine::loadAttackHead(size_t soundIndex)
+{
+    const Sound& sound = m_sounds[soundIndex];
+    for (;;) {
+        // The files are only ever switched once, after conversion, so
+        // comparing the stream path tells whether the head is current.
+        const StreamSound* current = m_diskStreamer->sound(soundIndex);
+        if (current != nullptr && current->path == sound.streamPath()) {
+            return true;
+        }
+        if (!sound.probe()) {
+            return false;
+        }
+
+        const std::string& playbackPath = sound.playbackPath();
+        const std::string& streamPath = sound.streamPath();
+        const Methcla_SoundFileInfo info = sound.playbackInfo();
+        const int64_t headFrames = std::min(info.frames, int64_t(std::ceil(m_attackHeadDuration * info.samplerate)));
+        const size_t headBytes = size_t(headFrames) * info.channels * sizeof(float);
+        // Reserve the memory up front; heads are loaded by the prober
+        // threads and the head loader concurrently. Replaced heads stay
+        // alive and keep their share.
+        size_t bytes = m_attackHeadBytes.load();
+        do {
+            if (bytes + headBytes > m_attackHeadMemoryBudget) {
+                return current != nullptr;
+            }
+        } while (!m_attackHeadBytes.compare_exchange_weak(bytes, bytes + headBytes));
+
+        std::unique_ptr<StreamSound> head(new StreamSound);
+        head->path = streamPath;
+        head->info = info;
+        head->head.resize(size_t(headFrames) * info.channels);
+
+        Methcla_SoundFile* file;
+        Methcla_SoundFileInfo fileInfo;
+        if (methcla_engine_soundfile_open(engine(), playbackPath.c_str(), kMethcla_FileModeRead, &file, &fileInfo) != kMethcla_NoError) {
+            m_attackHeadBytes -= headBytes;
+            return current != nullptr;
+        }
+        size_t numFrames = 0;
+        while (numFrames < size_t(headFrames)) {
+            size_t numRead = 0;
+            file->read_float(file, head->head.data() + numFrames * info.channels, size_t(headFrames) - numFrames, &numRead);
+            if (numRead == 0) {
+                break;
+            }
+            numFrames += numRead;
+        }
+        file->close(file);
+        head->headFrames = numFrames;
+
+        {
+            // Only register the head if the files haven't changed while it
+            // was read, and don't replace a head registered by another
+            // thread in the meantime.
+            std::lock_guard<std::mutex> lock(m_headRegisterMutex);
+            if (sound.playbackPath() == playbackPath && sound.streamPath() == streamPath
+                && m_diskStreamer->sound(soundIndex) == current) {
+                m_diskStreamer->registerSound(soundIndex, std::move(head));
+                return true;
+            }
+        }
+        m_attackHeadBytes -= headBytes;
+    }
+}
+
+bool Engine::requestAttackHead(size_t soundIndex)
+{
+    if (m_diskStreamer->sound(soundIndex) != nullptr) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_headMutex);
+    if (!m_headRequested[soundIndex]) {
+        m_headRequested[soundIndex] = true;
+        m_headRequests.push_back(soundIndex);
+        m_headCondition.notify_one();
+    }
+    return false;
+}
+
+// Load the heads requested by starting voices until the engine quits.
+void Engine::loadRequestedAttackHeads()
+{
+    while (!m_quitProbing) {
+        {
+            std::unique_lock<std::mutex> lock(m_headMutex);
+            m_headCondition.wait(lock, [this]() { return m_quitProbing || !m_headRequests.empty(); });
+            std::swap(m_headLoads, m_headRequests);
+        }
+        for (auto soundIndex : m_headLoads) {
+            if (m_quitProbing) {
+                break;
+            }
+            loadAttackHead(soundIndex);
+        }
+        m_headLoads.clear();
+    }
+}
+
+// Write the metadata of all probed sounds to the index if it is out of date.
+void Engine::writeSoundIndex()
+{
+    if (m_soundIndexPath.empty() || !m_soundIndexDirty) {
+        return;
+    }
+
+    std::vector<SoundIndex::Entry> entries;
+    entries.reserve(m_sounds.size());
+    for (const auto& sound : m_sounds) {
+        // Skip sounds that haven't been probed yet; they will be probed
+        // again next time.
+        if (sound.isProbed() && sound.info().frames > 0) {
+            entries.push_back({ sound.path(), sound.stamp(), sound.info() });
+        }
+    }
+
+    try {
+        SoundIndex::write(m_soundIndexPath, std::move(entries));
+        m_soundIndexDirty = false;
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
 }
 
 size_t Engine::nextSound()
@@ -118,91 +826,480 @@ size_t Engine::nextSound()
     return result;
 }
 
-static Methcla_Time kLatency = 0.1;
-
-template <typename T> T linmap(T outMin, T outMax, T inMin, T inMax, T x)
+void Engine::startVoice(VoiceId voice, size_t sound, float param)
 {
-    return (x - inMin) / (inMax - inMin) * (outMax - outMin) + outMin;
+    const VoiceStart start = { voice, sound, param, 0. };
+    startVoices(&start, 1);
 }
 
-template <typename T> T expmap(T outMin, T outMax, T inMin, T inMax, T x)
+void Engine::updateVoice(VoiceId voice, float param)
 {
-    return outMin * std::pow(outMax / outMin, (x - inMin) / (inMax - inMin));
+    const VoiceUpdate update = { voice, param };
+    updateVoices(&update, 1);
 }
 
-template <typename T> T dbamp(T db)
+void Engine::stopVoice(VoiceId voice)
 {
-    return std::pow(T(10), db/T(20));
+    stopVoices(&voice, 1);
 }
 
-static float mapRate(float value)
+// Return true if the voice of start i is started again later in the same
+// batch; only the last start of a voice takes effect.
+static bool isRestartedLater(const Engine::VoiceStart* voices, size_t numVoices, size_t i)
 {
-#if 1
-    const float numOctaves = 4.f;
-    return expmap(1.f/numOctaves, numOctaves, 0.f, 1.f, value);
-#else
-    return 1.f;
-#endif
+    for (size_t j=i+1; j < numVoices; j++) {
+        if (voices[j].voice == voices[i].voice) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void Engine::startVoice(VoiceId voice, size_t soundIndex, float param)
+void Engine::startVoices(const VoiceStart* voices, size_t numVoices)
 {
-    if (m_voices.find(voice) != m_voices.end()) {
-        stopVoice(voice);
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+
+    // Stop voices that are restarted.
+    m_voicesToStop.clear();
+    for (size_t i=0; i < numVoices; i++) {
+        if (!isRestartedLater(voices, numVoices, i) && m_voices.find(voices[i].voice) != nullptr) {
+            m_voicesToStop.push_back(voices[i].voice);
+        }
     }
-    if (soundIndex < m_sounds.size()) {
-        const Sound& sound = m_sounds[soundIndex];
-        Methcla::Request request(engine());
-        request.openBundle(Methcla::immediately);
-            const Methcla::SynthId synth = request.synth(
-                // Comment this line ...
-                METHCLA_PLUGINS_DISKSAMPLER_URI,
-                // ... and uncomment this one for memory-based playback.
-                // METHCLA_PLUGINS_SAMPLER_URI,
-                m_voiceGroup,
-                { dbamp(-3.f), mapRate(param) },
-                { Methcla::Value(sound.path())
-                , Methcla::Value(true) }
-            );
-            // Map to an internal bus for the fun of it
-            request.mapOutput(synth, 0, Methcla::AudioBusId(0));
-            request.mapOutput(synth, 1, Methcla::AudioBusId(1));
-            request.openBundle(engine().currentTime() + kLatency);
-                request.activate(synth);
-            request.closeBundle();
+    if (!m_voicesToStop.empty()) {
+        releaseVoices(m_voicesToStop.data(), m_voicesToStop.size(), 0.);
+    }
+
+    if (m_voiceStealing != kStealNone) {
+        stealVoices(voices, numVoices);
+    }
+
+    // Choose a playback mode for each voice; all voices are activated
+    // together, as early as the slowest of them allows.
+    m_voicePlans.clear();
+    const Methcla_Time schedulingLatency = m_schedulingLatency->latency();
+    Methcla_Time latency = 0.;
+    for (size_t i=0; i < numVoices; i++) {
+        const VoiceStart& start = voices[i];
+        if (isRestartedLater(voices, numVoices, i)) {
+            continue;
+        }
+        if (m_voices.size() + m_voicePlans.size() >= m_voices.maxSize()) {
+            if (m_logger->enabled(kLogWarning)) {
+                m_logger->log({ kLogWarning, LogRecord::kVoiceDrop, engine().currentTime(), start.voice, -1, start.sound, start.param, 0.f, "polyphony limit" });
+            }
+            continue;
+        }
+        if (start.sound >= m_sounds.size() || !m_sounds[start.sound].probe()) {
+            continue;
+        }
+        const Sound& sound = m_sounds[start.sound];
+        const Methcla_SoundFileInfo& info = sound.playbackInfo();
+        VoicePlan plan;
+        plan.start = &start;
+        plan.mapped = m_mappedSounds && m_mappedSounds->sound(start.sound) != nullptr;
+        plan.inMemory = !plan.mapped && m_sampleCache->acquire(
+            start.sound,
+            size_t(info.frames) * info.channels * sizeof(float),
+            sound.duration()
+        );
+        plan.withAttackHead = !plan.mapped && !plan.inMemory && m_diskStreamer && requestAttackHead(start.sound);
+        plan.pooled = false;
+        plan.instrument = m_soundInstruments[start.sound];
+        plan.amp = m_instruments[plan.instrument].amp(start.param);
+        plan.rate = m_instruments[plan.instrument].rate(start.param);
+        // Voices starting from memory, a preloaded head or a mapped
+        // container only need their request to arrive in time.
+        latency = std::max(latency, plan.mapped || plan.inMemory || plan.withAttackHead ? schedulingLatency : std::max(schedulingLatency, m_voiceLoadLatency));
+        m_voicePlans.push_back(plan);
+    }
+
+    if (m_voicePlans.empty()) {
+        return;
+    }
+
+    const Methcla_Time now = engine().currentTime();
+    const Methcla_Time time = now + latency;
+
+    // Only stream sampler voices can report when they become audible.
+    for (auto& plan : m_voicePlans) {
+        plan.trace = m_inputLatency && plan.withAttackHead
+                   ? m_inputLatency->beginTrace(plan.start->inputTime, now)
+                   : -1;
+    }
+
+    Methcla::Request request(engine());
+    request.openBundle(Methcla::immediately);
+        for (auto& plan : m_voicePlans) {
+            const VoiceStart& start = *plan.start;
+            // Only reuse pooled voices whose gate will have been closed
+            // by the time this voice starts.
+            plan.pooled = plan.withAttackHead
+                       && !m_voicePool.empty()
+                       && m_voicePool.front().availableTime < time;
+            if (plan.pooled) {
+                plan.synth = m_voicePool.front().synth;
+                plan.controls = m_voicePool.front().controls;
+                m_voicePool.pop_front();
+            } else {
+                plan.controls = 0;
+                plan.synth = plan.mapped
+                    ? request.synth(
+                        METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_URI,
+                        m_voiceGroup,
+                        { plan.amp, plan.rate, float(start.sound) },
+                        { Methcla::Value(true) }
+                      )
+                    : plan.inMemory
+                    ? request.synth(
+                        METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_URI,
+                        m_voiceGroup,
+                        { plan.amp, plan.rate },
+                        { Methcla::Value(int32_t(start.sound))
+                        , Methcla::Value(true) }
+                      )
+                    : plan.withAttackHead
+                    ? request.synth(
+                        METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_URI,
+                        m_voiceGroup,
+                        { plan.amp, plan.rate, float(start.sound), 1.f, 0.f, float(plan.trace) },
+                        { Methcla::Value(true) }
+                      )
+                    : request.synth(
+                        METHCLA_PLUGINS_DISKSAMPLER_URI,
+                        m_voiceGroup,
+                        { plan.amp, plan.rate },
+                        { Methcla::Value(m_sounds[start.sound].playbackPath())
+                        , Methcla::Value(true) }
+                      );
+                // Map to an internal bus for the fun of it
+                request.mapOutput(plan.synth, 0, outputBus(0));
+                request.mapOutput(plan.synth, 1, outputBus(1));
+            }
+        }
+        request.openBundle(time);
+            for (const auto& plan : m_voicePlans) {
+                if (plan.pooled) {
+                    // Retarget a pooled voice and open its gate.
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerAmp, plan.amp);
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerRate, plan.rate);
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerSound, plan.start->sound);
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerRelease, 0);
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerTrace, plan.trace);
+                    request.set(plan.synth, plan.controls + kMethclaSampler_StreamSamplerGate, 1);
+                } else {
+                    request.activate(plan.synth);
+                }
+            }
         request.closeBundle();
-        request.send();
-        m_voices[voice] = synth;
-        std::cout << "Synth " << synth.id()
-                  << sound.path()
-                  << " duration=" << sound.duration()
-                  << " param=" << param
-                  << " rate=" << mapRate(param)
-                  << std::endl;
+    request.closeBundle();
+    request.send();
+
+    for (const auto& plan : m_voicePlans) {
+        const VoiceStart& start = *plan.start;
+        const Voice voice = { plan.synth, plan.controls, start.sound, plan.withAttackHead, plan.pooled, plan.instrument, plan.amp, time, 0.f, false };
+        m_voices.insert(start.voice, voice);
+        logVoice(kLogInfo, LogRecord::kVoiceStart, start.voice, voice, start.param, plan.rate,
+                 plan.mapped ? "mapped" : plan.inMemory ? "memory" : plan.pooled ? "head+stream pooled" : plan.withAttackHead ? "head+stream" : "disk");
     }
 }
 
-void Engine::updateVoice(VoiceId voice, float param)
+void Engine::updateVoices(const VoiceUpdate* voices, size_t numVoices)
 {
-    auto it = m_voices.find(voice);
-    assert( it != m_voices.end() );
-    const float rate = mapRate(param);
-    m_engine->set(it->second, 1, rate);
-    std::cout << "Synth " << it->second.id()
-              << " param=" << param
-              << " rate=" << rate
-              << std::endl;
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    for (size_t i=0; i < numVoices; i++) {
+        // The voice may not have been started when the voice table was full.
+        Voice* voice = m_voices.find(voices[i].voice);
+        if (voice != nullptr) {
+            voice->pendingParam = voices[i].param;
+            if (!voice->updatePending) {
+                voice->updatePending = true;
+                m_pendingUpdates.push_back(voices[i].voice);
+            }
+        }
+    }
+    if (m_controlRate <= 0.) {
+        sendVoiceUpdates();
+    }
 }
 
-void Engine::stopVoice(VoiceId voice)
+// Send a request that reports when it has been processed by the audio
+// thread; called from the control thread only.
+void Engine::sendLatencyProbe()
 {
-    auto it = m_voices.find(voice);
-    if (it != m_voices.end()) {
-        Methcla::Request request(engine());
-        request.openBundle(engine().currentTime() + kLatency);
-        request.free(it->second);
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    Methcla::Request request(engine());
+    request.openBundle(Methcla::immediately);
+    const int32_t token = m_schedulingLatency->beginProbe(engine().currentTime());
+    auto synth = request.synth(METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_URI, engine().root(), {}, { Methcla::Value(token) });
+    // The probe frees itself after reporting its first block.
+    request.whenDone(synth, Methcla::kNodeDoneFreeSelf);
+    request.activate(synth);
+    request.closeBundle();
+    request.send();
+}
+
+InputLatency::Stats Engine::inputLatency()
+{
+    return m_inputLatency ? m_inputLatency->stats() : InputLatency::Stats();
+}
+
+std::vector<StreamStatus> Engine::streamStatus() const
+{
+    std::vector<StreamStatus> status;
+    if (m_diskStreamer) {
+        m_diskStreamer->streamStatus(status);
+    }
+    return status;
+}
+
+size_t Engine::numStreamUnderruns() const
+{
+    return m_diskStreamer ? m_diskStreamer->numUnderruns() : 0;
+}
+
+Engine::InstrumentId Engine::addInstrument(const VoiceCurves& curves)
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    m_instruments.push_back(curves);
+    return m_instruments.size() - 1;
+}
+
+void Engine::setVoiceCurves(InstrumentId instrument, const VoiceCurves& curves)
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    if (instrument < m_instruments.size()) {
+        m_instruments[instrument] = curves;
+    }
+}
+
+void Engine::setSoundInstrument(size_t sound, InstrumentId instrument)
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    if (sound < m_soundInstruments.size() && instrument < m_instruments.size()) {
+        m_soundInstruments[sound] = instrument;
+    }
+}
+
+void Engine::setRateCurve(const Curve& curve)
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    m_instruments[kDefaultInstrument].rate = curve;
+}
+
+void Engine::flushVoiceUpdates()
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    sendVoiceUpdates();
+}
+
+// Send the latest update of each voice in a single bundle.
+void Engine::sendVoiceUpdates()
+{
+    if (m_pendingUpdates.empty()) {
+        return;
+    }
+    const Methcla_Time now = engine().currentTime();
+    Methcla::Request request(engine());
+    request.openBundle(Methcla::immediately);
+    for (auto id : m_pendingUpdates) {
+        // Voices stopped in the meantime have been removed.
+        Voice* voice = m_voices.find(id);
+        if (voice != nullptr && voice->updatePending) {
+            // A pooled voice is retargeted with its start values at its
+            // start time; updates before then are sent for just after it,
+            // so that the retarget can't overwrite them.
+            const bool beforeStart = voice->pooled && voice->time > now;
+            if (beforeStart) {
+                request.openBundle(std::nextafter(voice->time, std::numeric_limits<Methcla_Time>::infinity()));
+            }
+            const VoiceCurves& curves = m_instruments[voice->instrument];
+            const float amp = curves.amp(voice->pendingParam);
+            const float rate = curves.rate(voice->pendingParam);
+            // Constant amplitude curves don't cost an extra command.
+            if (amp != voice->amp) {
+                request.set(voice->synth, voice->controls + 0, amp);
+                voice->amp = amp;
+            }
+            request.set(voice->synth, voice->controls + 1, rate);
+            if (beforeStart) {
+                request.closeBundle();
+            }
+            voice->updatePending = false;
+            logVoice(kLogDebug, LogRecord::kVoiceUpdate, id, *voice, voice->pendingParam, rate);
+        }
+    }
+    request.closeBundle();
+    request.send();
+    m_pendingUpdates.clear();
+}
+
+void Engine::logVoice(LogLevel level, LogRecord::Event event, VoiceId voice, const Voice& state, float param, float rate, const char* detail)
+{
+    if (m_logger->enabled(level)) {
+        m_logger->log({ level, event, engine().currentTime(), voice, state.synth.id(), state.sound, param, rate, detail });
+    }
+}
+
+void Engine::stopVoices(const VoiceId* voices, size_t numVoices)
+{
+    std::lock_guard<std::mutex> lock(m_voiceMutex);
+    releaseVoices(voices, numVoices, 0.);
+}
+
+void Engine::releaseVoices(const VoiceId* voices, size_t numVoices, Methcla_Time fadeTime)
+{
+    const Methcla_Time now = engine().currentTime();
+
+    // Close the gates of pooled voices no earlier than they were opened and
+    // with at least the latency pooled voices are started with, so that a
+    // stop can't overtake the restart of the same synth. Other voices are
+    // released no earlier than they are activated, each on its own.
+    const Methcla_Time schedulingLatency = m_schedulingLatency->latency();
+    Methcla_Time pooledTime = now + schedulingLatency;
+    bool havePooled = false, haveFreed = false;
+    for (size_t i=0; i < numVoices; i++) {
+        const Voice* voice = m_voices.find(voices[i]);
+        if (voice != nullptr) {
+            if (voice->pooled) {
+                pooledTime = std::max(pooledTime, voice->time);
+                havePooled = true;
+            } else {
+                haveFreed = true;
+            }
+        }
+    }
+
+    if (!havePooled && !haveFreed) {
+        return;
+    }
+
+    // The sampler plugins have no release envelope; fade them out by
+    // stepping their amplitude down at block boundaries.
+    const size_t kFadeSteps = 16;
+
+    Methcla::Request request(engine());
+    request.openBundle(Methcla::immediately);
+    if (havePooled) {
+        request.openBundle(pooledTime);
+        for (size_t i=0; i < numVoices; i++) {
+            const Voice* voice = m_voices.find(voices[i]);
+            if (voice != nullptr && voice->pooled) {
+                request.set(voice->synth, voice->controls + kMethclaSampler_StreamSamplerRelease, fadeTime);
+                request.set(voice->synth, voice->controls + kMethclaSampler_StreamSamplerGate, 0);
+            }
+        }
         request.closeBundle();
-        request.send();
-        m_voices.erase(it);
     }
+    if (haveFreed) {
+        for (size_t i=0; i < numVoices; i++) {
+            const Voice* voice = m_voices.find(voices[i]);
+            if (voice == nullptr || voice->pooled) {
+                continue;
+            }
+            const Methcla_Time freeTime = std::max(now + schedulingLatency, voice->time);
+            if (fadeTime > 0.) {
+                if (voice->streamed) {
+                    request.openBundle(freeTime);
+                    request.set(voice->synth, kMethclaSampler_StreamSamplerRelease, fadeTime);
+                    request.set(voice->synth, kMethclaSampler_StreamSamplerGate, 0);
+                    request.closeBundle();
+                } else {
+                    // Ramp down from the current amplitude, reaching zero
+                    // when the synth is freed.
+                    for (size_t k=1; k <= kFadeSteps; k++) {
+                        request.openBundle(freeTime + fadeTime * k / kFadeSteps);
+                        request.set(voice->synth, voice->controls, voice->amp * (kFadeSteps - k) / kFadeSteps);
+                        request.closeBundle();
+                    }
+                }
+            }
+            request.openBundle(freeTime + fadeTime);
+            request.free(voice->synth);
+            request.closeBundle();
+        }
+    }
+    request.closeBundle();
+    request.send();
+
+    for (size_t i=0; i < numVoices; i++) {
+        const Voice* voice = m_voices.find(voices[i]);
+        if (voice != nullptr) {
+            if (fadeTime > 0.) {
+                logVoice(kLogInfo, LogRecord::kVoiceSteal, voices[i], *voice, 0.f, 0.f);
+            } else {
+                logVoice(kLogDebug, LogRecord::kVoiceStop, voices[i], *voice, 0.f, 0.f);
+            }
+            if (voice->pooled) {
+                m_voicePool.push_back({ voice->synth, voice->controls, pooledTime + fadeTime });
+            }
+            m_voices.erase(voices[i]);
+        }
+    }
+}
+
+void Engine::stealVoices(const VoiceStart* voices, size_t numVoices)
+{
+    // Number of voices that don't fit; voices that can never fit aren't
+    // made room for.
+    const size_t maxVoices = m_voices.maxSize();
+    size_t numDistinct = 0;
+    for (size_t i=0; i < numVoices; i++) {
+        if (!isRestartedLater(voices, numVoices, i)) {
+            numDistinct++;
+        }
+    }
+    const size_t numStarts = std::min(numDistinct, maxVoices);
+    if (m_voices.size() + numStarts <= maxVoices) {
+        return;
+    }
+    const size_t numSteals = m_voices.size() + numStarts - maxVoices;
+
+    auto playsStartingSound = [voices, numVoices](size_t sound) {
+        for (size_t i=0; i < numVoices; i++) {
+            if (voices[i].sound == sound && !isRestartedLater(voices, numVoices, i)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto isStolen = [this](VoiceId voice) {
+        return std::find(m_voicesToStop.begin(), m_voicesToStop.end(), voice) != m_voicesToStop.end();
+    };
+
+    // Return true if voice a should be stolen before voice b.
+    auto stealFirst = [this, &playsStartingSound](const Voice& a, const Voice& b) {
+        switch (m_voiceStealing) {
+            case kStealSameSoundFirst: {
+                const bool sameA = playsStartingSound(a.sound);
+                const bool sameB = playsStartingSound(b.sound);
+                if (sameA != sameB) {
+                    return sameA;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        return a.time < b.time;
+    };
+
+    m_voicesToStop.clear();
+    for (size_t i=0; i < numSteals; i++) {
+        VoiceId victim = 0;
+        const Voice* victimVoice = nullptr;
+        m_voices.forEach([&](VoiceId id, const Voice& voice) {
+            if (!isStolen(id) && (victimVoice == nullptr || stealFirst(voice, *victimVoice))) {
+                victim = id;
+                victimVoice = &voice;
+            }
+        });
+        if (victimVoice == nullptr) {
+            break;
+        }
+        m_voicesToStop.push_back(victim);
+    }
+
+    releaseVoices(m_voicesToStop.data(), m_voicesToStop.size(), m_voiceStealFadeTime);
 }
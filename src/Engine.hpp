@@ -15,34 +15,270 @@
 #ifndef ENGINE_HPP_INCLUDED
 #define ENGINE_HPP_INCLUDED
 
+#include "CompressedStore.hpp"
+#include "Curve.hpp"
+#include "DiskStreamer.hpp"
+#include "InputLatency.hpp"
+#include "Logger.hpp"
+#include "MappedSounds.hpp"
+#include "ParallelRenderer.hpp"
+#include "ResampleCache.hpp"
+#include "SchedulingLatency.hpp"
+#include "SampleCache.hpp"
+#include "SampleStore.hpp"
+#include "SoundIndex.hpp"
+#include "VoiceTable.hpp"
+
 #include <methcla/engine.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <unordered_map>
 
+// A sound file registered with the engine.
+//
+// Constructing a Sound only records its path; the file's header is probed
+// on first use (see probe()), unless the metadata is already known, e.g.
+// from the sound index. Copies share the probed metadata.
 class Sound
 {
 public:
-    Sound(const Methcla::Engine& engine, const std::string& path);
+    // Register the sound file at path for lazy probing.
+    Sound(const Methcla::Engine& engine, const std::string& path, const FileStamp& stamp);
+    // Register a sound with known metadata.
+    Sound(const Methcla::Engine& engine, const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info);
 
     const std::string& path() const
     {
         return m_path;
     }
 
-    float duration() const
+    // Size and modification time at registration.
+    const FileStamp& stamp() const
     {
-        return m_duration;
+        return m_stamp;
     }
 
+    // Probe the sound file's header unless this has been done already.
+    // Returns false if the file couldn't be opened. Thread-safe.
+    bool probe() const;
+
+    // Return true if the metadata is available without probing.
+    bool isProbed() const;
+
+    // Metadata of the sound file; probes the file if necessary. Invalid
+    // sound files report zero frames.
+    const Methcla_SoundFileInfo& info() const;
+
+    // Duration in seconds; probes the file if necessary.
+    float duration() const;
+
+    // Play the file at path with the given info instead of the sound
+    // file, e.g. the sound converted to the engine's sample rate. Can be
+    // called once; thread-safe.
+    void setPlaybackFile(const std::string& path, const Methcla_SoundFileInfo& info) const;
+
+    // Path and metadata of the file voices play; the sound file itself
+    // unless setPlaybackFile() has been called.
+    const std::string& playbackPath() const;
+    const Methcla_SoundFileInfo& playbackInfo() const;
+
+    // Stream the file at path, holding the same frames as the playback
+    // file, e.g. the playback file compressed. Can be called once;
+    // thread-safe.
+    void setStreamFile(const std::string& path) const;
+
+    // Path of the file disk streamed voices read; the playback file unless
+    // setStreamFile() has been called.
+    const std::string& streamPath() const;
+
 private:
-    std::string m_path;
-    float m_duration;
+    struct Metadata;
+
+    const Methcla::Engine*      m_engine;
+    std::string                 m_path;
+    FileStamp                   m_stamp;
+    std::shared_ptr<Metadata>   m_metadata;
 };
 
 class Engine
 {
 public:
+    // How to choose a voice to steal when the polyphony limit is reached.
+    enum VoiceStealing
+    {
+        // Don't steal; further voices are not started.
+        kStealNone,
+        // Steal the voice that was started first.
+        kStealOldest,
+        // Steal the oldest voice playing the same sound as the new voice,
+        // or the oldest voice if there is none.
+        kStealSameSoundFirst
+    };
+
+    // Mappings from a voice parameter to the controls of the voices of an
+    // instrument.
+    struct VoiceCurves
+    {
+        VoiceCurves();
+
+        // Amplitude; a constant -3 dB by default.
+        Curve amp;
+        // Playback rate; four octaves around the original pitch by default.
+        Curve rate;
+    };
+
+    typedef size_t InstrumentId;
+
+    // Instrument of the sounds that haven't been assigned to another one.
+    static const InstrumentId kDefaultInstrument = 0;
+
+    struct Options
+    {
+        Options(const std::string& soundDir_="");
+
+        // Directory to scan for sounds.
+        std::string soundDir;
+        // Audio driver buffer size in frames.
+        size_t bufferSize;
+        // Sample rate in Hz; zero uses the audio driver's default.
+        size_t sampleRate;
+        // Number of output buses. Each is routed to the hardware output of
+        // the same index, voice channels are distributed over them.
+        size_t numOutputBuses;
+        // Size in bytes of the engine's realtime memory pool; zero uses the
+        // engine's default.
+        size_t realtimeMemorySize;
+        // Plugin libraries loaded in addition to the ones the sampler
+        // needs.
+        std::vector<Methcla_LibraryFunction> plugins;
+        // Plugin library providing the sound file API used for probing
+        // and playing sounds. Defaults to the platform's native API
+        // (see defaultSoundFileAPI).
+        Methcla_LibraryFunction soundFileAPI;
+        // Number of threads used for probing sound files at startup
+        // (0 means one per hardware thread).
+        size_t numScanThreads;
+        // Path of the persistent sound metadata index. Sounds whose size
+        // and modification time match their index entry aren't opened at
+        // startup. Empty disables the index.
+        std::string soundIndexPath;
+        // Convert sounds whose sample rate differs from sampleRate to it
+        // when they are probed at startup or in the background, so that
+        // voices only transpose them. The
+        // converted files are cached in resampleCacheDir. Requires
+        // sampleRate to be set; sounds played before their conversion has
+        // finished keep playing at their native rate until the next start.
+        bool resampleSounds;
+        // Directory of converted sounds; empty means soundIndexPath with
+        // the suffix ".resampled". Without either sounds aren't converted.
+        std::string resampleCacheDir;
+        // Quality of the sample rate conversion.
+        Resampler::Options resampler;
+        // Decode sounds into sample containers in sampleStoreDir when they
+        // are probed at startup or in the background, after converting
+        // their sample rate. Voices of sounds with a container are played
+        // from its memory mapping by the mapped sampler, without decoding,
+        // copying or streaming.
+        bool ingestSamples;
+        // Directory of sample containers; empty means soundIndexPath with
+        // the suffix ".samples". Without either sounds aren't ingested.
+        std::string sampleStoreDir;
+        // Sample layout of the containers.
+        SampleFile::Layout sampleLayout;
+        // Prefaulting of the pages mapped sampler voices are about to
+        // read.
+        MappedSounds::Options mappedSounds;
+        // Compress sounds losslessly into block containers in
+        // compressedSoundDir when they are probed at startup or in the
+        // background, after converting their sample rate. Disk streamed
+        // voices of sounds with a container read and decode its blocks
+        // instead of the sound file, which reduces the data read from
+        // disk. Sounds without integer samples of at most 24 bits, e.g.
+        // converted ones, are streamed from their playback file.
+        bool compressStreamedSounds;
+        // Directory of compressed sounds; empty means soundIndexPath with
+        // the suffix ".compressed". Without either sounds aren't
+        // compressed.
+        std::string compressedSoundDir;
+        // Defer probing sound files not found in the index until they are
+        // first used, so that the engine can start right away.
+        bool lazySoundProbing;
+        // When probing lazily, probe the remaining sounds on a background
+        // thread and update the index afterwards.
+        bool backgroundSoundProbing;
+        // Budget and admission policy for decoded sounds held in memory
+        // and played by the cached sampler instead of streaming them from
+        // disk.
+        SampleCache::Options sampleCache;
+        // Duration in seconds of the start of each sound that is kept in
+        // memory, so that disk streamed voices can start with lower latency.
+        // Heads are loaded in the background; sounds started before their
+        // head is loaded play with the disk sampler. Zero disables
+        // preloading.
+        double attackHeadDuration;
+        // Memory budget in bytes for preloaded sound heads. Sounds whose
+        // head doesn't fit are played with the disk sampler.
+        size_t attackHeadMemoryBudget;
+        // Configuration of the disk streamer used for voices with a
+        // preloaded head.
+        DiskStreamer::Options diskStreamer;
+        // Number of preconstructed stream sampler voices that are reused
+        // for voices with a preloaded head, so that starting and stopping
+        // them doesn't construct or destroy synths. Zero disables the pool.
+        size_t voicePoolSize;
+        // Number of threads rendering the voice pool in parallel,
+        // including the audio thread; 0 means one per hardware thread. With
+        // 1 pooled voices are separate synths rendered by the audio thread,
+        // otherwise they are voices of a parallel sampler bank.
+        size_t renderThreads;
+        // Number of subgroups the pool is split into for parallel
+        // rendering; more groups than threads balance uneven voice costs.
+        // 0 means four per render thread.
+        size_t renderGroups;
+        // Maximum number of voices sounding at the same time.
+        size_t maxVoices;
+        // Policy for making room for new voices when maxVoices are
+        // playing.
+        VoiceStealing voiceStealing;
+        // Duration in seconds of the fade out of stolen voices.
+        double voiceStealFadeTime;
+        // Queue size and initial level of the voice event log. Voice
+        // starts are logged at kLogInfo, updates and stops at kLogDebug.
+        Logger::Options logger;
+        // Receives voice event log records on the logger thread. Defaults
+        // to writing them to std::cout.
+        Logger::Sink logSink;
+        // Rate in Hz at which voice updates are sent to the engine. Only
+        // the latest update of each voice within a control period is sent,
+        // all of them in a single bundle. The default is close to one
+        // period of 256 frames at 48 kHz. Zero sends every update right
+        // away.
+        double controlRate;
+        // Curves of the default instrument.
+        VoiceCurves voiceCurves;
+        // Lookahead of timed requests. In adaptive mode, probe requests
+        // are sent from the control thread to measure it.
+        SchedulingLatency::Options schedulingLatency;
+        // Minimum lookahead in seconds for voices whose synth opens or
+        // loads its sound file when it is created.
+        double voiceLoadLatency;
+        // Collect input to audio latency histograms of voices played by
+        // the stream sampler (see inputLatency()).
+        bool traceInputLatency;
+    };
+
+    // Return the sound file API library selected for this platform at
+    // build time: ExtAudioFile on Apple platforms, libsndfile when
+    // METHCLA_SAMPLER_USE_LIBSNDFILE is defined and the built-in WAV
+    // reader otherwise.
+    static Methcla_LibraryFunction defaultSoundFileAPI();
+
+    Engine(const Options& options);
     Engine(const std::string& soundDir);
     ~Engine();
 
@@ -53,8 +289,37 @@ public:
     // Simply cycles through all available sounds.
     size_t nextSound();
 
+    // Return the wall clock time in seconds spent scanning the sound
+    // directory at startup (excluding lazy and background probing).
+    double soundScanTime() const
+    {
+        return m_soundScanTime;
+    }
+
+    // Logger for voice events; the level can be changed at runtime.
+    Logger& logger()
+    {
+        return *m_logger;
+    }
+
     typedef intptr_t VoiceId;
 
+    struct VoiceStart
+    {
+        VoiceId voice;
+        size_t  sound;
+        float   param;
+        // Host time of the input event in seconds on the clock of
+        // InputLatency::hostTime(), or zero for the time of the call.
+        double  inputTime;
+    };
+
+    struct VoiceUpdate
+    {
+        VoiceId voice;
+        float   param;
+    };
+
     // Start a voice with a certain sound and amplitude.
     void startVoice(VoiceId voice, size_t sound, float amp);
     // Update a voice's amplitude while playing.
@@ -62,16 +327,178 @@ public:
     // Stop a voice.
     void stopVoice(VoiceId voice);
 
+    // Start several voices in a single request; all voices start in the
+    // same audio block.
+    void startVoices(const VoiceStart* voices, size_t numVoices);
+    // Update several voices. Updates are coalesced and sent at the control
+    // rate, unless it is zero.
+    void updateVoices(const VoiceUpdate* voices, size_t numVoices);
+    // Stop several voices in a single request.
+    void stopVoices(const VoiceId* voices, size_t numVoices);
+
+    // Send pending voice updates right away.
+    void flushVoiceUpdates();
+
+    // Register an instrument with its own voice curves and return its id.
+    InstrumentId addInstrument(const VoiceCurves& curves);
+    // Replace the curves of an instrument; voices already playing switch
+    // to them with their next update.
+    void setVoiceCurves(InstrumentId instrument, const VoiceCurves& curves);
+    // Play sound with the curves of instrument from the next voice on.
+    void setSoundInstrument(size_t sound, InstrumentId instrument);
+    // Replace the mapping from voice parameters to playback rate of the
+    // default instrument.
+    void setRateCurve(const Curve& curve);
+
+    // Latency histograms from input events to the first audible sample of
+    // the resulting voices. Empty unless traceInputLatency is enabled.
+    InputLatency::Stats inputLatency();
+
+    // Fill levels and underrun counts of the active disk streams, most
+    // urgent first.
+    std::vector<StreamStatus> streamStatus() const;
+    // Total number of disk stream underruns.
+    size_t numStreamUnderruns() const;
+
+    // Current lookahead of timed requests and measured request delays.
+    const SchedulingLatency& schedulingLatency() const
+    {
+        return *m_schedulingLatency;
+    }
+
 private:
+    struct Voice
+    {
+        Methcla::SynthId    synth;
+        // Index of the voice's first control in synth; nonzero for voices
+        // of a parallel sampler bank.
+        Methcla_PortCount   controls;
+        size_t              sound;
+        // True if synth is a stream sampler.
+        bool                streamed;
+        // True if synth belongs to the voice pool.
+        bool                pooled;
+        InstrumentId        instrument;
+        // Amplitude last sent to synth.
+        float               amp;
+        // Activation time.
+        Methcla_Time        time;
+        // Latest update not sent yet.
+        float               pendingParam;
+        bool                updatePending;
+    };
+
+    struct PooledVoice
+    {
+        Methcla::SynthId    synth;
+        Methcla_PortCount   controls;
+        // Time after which the voice's gate has been closed.
+        Methcla_Time        availableTime;
+    };
+
+    // Playback mode chosen for a voice to be started.
+    struct VoicePlan
+    {
+        const VoiceStart*   start;
+        // True if the sound is played from the sample cache.
+        bool                inMemory;
+        bool                withAttackHead;
+        // True if the sound is played from its sample container.
+        bool                mapped;
+        bool                pooled;
+        Methcla::SynthId    synth;
+        Methcla_PortCount   controls;
+        InstrumentId        instrument;
+        float               amp;
+        float               rate;
+        // InputLatency trace token or -1.
+        int32_t             trace;
+    };
+
     Methcla::Engine& engine() { return *m_engine; }
 
+    // Output bus of voice output channel.
+    Methcla::AudioBusId outputBus(size_t channel) const
+    {
+        return Methcla::AudioBusId(int32_t(channel % m_numOutputBuses));
+    }
+
+    void probeSounds();
+    void resampleSound(size_t soundIndex);
+    void ingestSound(size_t soundIndex);
+    void compressSound(size_t soundIndex);
+    bool loadAttackHead(size_t soundIndex);
+    // Return true if the sound's head has been loaded, otherwise queue it
+    // for loading on the head loader thread.
+    bool requestAttackHead(size_t soundIndex);
+    void loadRequestedAttackHeads();
+    void logVoice(LogLevel level, LogRecord::Event event, VoiceId voice, const Voice& state, float param, float rate, const char* detail=nullptr);
+    void sendVoiceUpdates();
+    void sendLatencyProbe();
+    // Stop voices after fading them out over fadeTime seconds.
+    void releaseVoices(const VoiceId* voices, size_t numVoices, Methcla_Time fadeTime);
+    // Stop up to numVoices playing voices according to the stealing
+    // policy to make room for starting voices.
+    void stealVoices(const VoiceStart* voices, size_t numVoices);
+    void writeSoundIndex();
+
 private:
     std::vector<Sound>  m_sounds;
     Methcla::Engine*    m_engine;
     size_t              m_nextSound;
+    double              m_soundScanTime;
+    size_t              m_numOutputBuses;
     Methcla::GroupId    m_voiceGroup;
     std::vector<Methcla::SynthId> m_patchCables;
-    std::unordered_map<VoiceId,Methcla::SynthId> m_voices;
+    VoiceTable<VoiceId,Voice> m_voices;
+    std::unique_ptr<SampleCache> m_sampleCache;
+    // Pooled synths that aren't playing, least recently stopped first.
+    std::deque<PooledVoice> m_voicePool;
+    // Scratch space for startVoices and stopVoices.
+    std::vector<VoicePlan> m_voicePlans;
+    std::vector<VoiceId> m_voicesToStop;
+    VoiceStealing       m_voiceStealing;
+    double              m_voiceStealFadeTime;
+    std::string         m_soundIndexPath;
+    size_t              m_numScanThreads;
+    bool                m_soundIndexDirty;
+    std::atomic<bool>   m_quitProbing;
+    std::unique_ptr<ResampleCache> m_resampleCache;
+    std::unique_ptr<SampleStore> m_sampleStore;
+    std::unique_ptr<MappedSounds> m_mappedSounds;
+    // Container path of each ingested sound.
+    std::vector<std::string> m_sampleFilePaths;
+    std::unique_ptr<CompressedStore> m_compressedStore;
+    std::unique_ptr<DiskStreamer> m_diskStreamer;
+    std::unique_ptr<ParallelRenderer> m_renderer;
+    double              m_attackHeadDuration;
+    size_t              m_attackHeadMemoryBudget;
+    std::atomic<size_t> m_attackHeadBytes;
+    std::thread         m_soundProber;
+    // Heads requested by starting voices; each sound is queued at most
+    // once, so the queue never grows beyond its reserved size.
+    std::mutex          m_headMutex;
+    std::condition_variable m_headCondition;
+    std::vector<size_t> m_headRequests;
+    std::vector<size_t> m_headLoads;
+    std::vector<bool>   m_headRequested;
+    std::thread         m_headLoader;
+    // Serializes replacing registered heads.
+    std::mutex          m_headRegisterMutex;
+    std::unique_ptr<Logger> m_logger;
+    // Serializes the voice functions with the control thread.
+    std::mutex          m_voiceMutex;
+    // Voices with pending updates, in the order they were first updated.
+    std::vector<VoiceId> m_pendingUpdates;
+    double              m_controlRate;
+    // Voice curves by instrument and instrument by sound.
+    std::vector<VoiceCurves> m_instruments;
+    std::vector<InstrumentId> m_soundInstruments;
+    std::unique_ptr<SchedulingLatency> m_schedulingLatency;
+    double              m_voiceLoadLatency;
+    std::unique_ptr<InputLatency> m_inputLatency;
+    std::atomic<bool>   m_quitControl;
+    std::thread         m_controlThread;
 };
 
 #endif // ENGINE_HPP_INCLUDED
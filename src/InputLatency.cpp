@@ -0,0 +1,179 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "InputLatency.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+static std::atomic<InputLatency*> gInstance(nullptr);
+
+LatencyHistogram::LatencyHistogram(double bucketWidth, size_t numBuckets)
+    : m_bucketWidth(bucketWidth)
+    , m_buckets(numBuckets + 1)
+    , m_count(0)
+    , m_sum(0.)
+    , m_max(0.)
+{
+}
+
+void LatencyHistogram::add(double latency)
+{
+    latency = std::max(0., latency);
+    const size_t bucket = std::min(size_t(latency / m_bucketWidth), m_buckets.size() - 1);
+    m_buckets[bucket]++;
+    m_count++;
+    m_sum += latency;
+    m_max = std::max(m_max, latency);
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), 0);
+    m_count = 0;
+    m_sum = 0.;
+    m_max = 0.;
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+    const size_t rank = size_t(p * m_count);
+    size_t count = 0;
+    for (size_t i=0; i + 1 < m_buckets.size(); i++) {
+        count += m_buckets[i];
+        if (count > rank) {
+            return (i + 1) * m_bucketWidth;
+        }
+    }
+    return m_max;
+}
+
+InputLatency::InputLatency()
+    : m_nextToken(0)
+    , m_reportsWritten(0)
+    , m_reportsRead(0)
+{
+    m_stats.numIncomplete = 0;
+    for (auto& trace : m_traces) {
+        trace.token = -1;
+    }
+    for (size_t i=0; i < kMaxTraces; i++) {
+        m_reports[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    InputLatency* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "InputLatency: another instance is already active" << std::endl;
+    }
+}
+
+InputLatency::~InputLatency()
+{
+    InputLatency* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+}
+
+InputLatency* InputLatency::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+double InputLatency::hostTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int32_t InputLatency::beginTrace(double inputTime, Methcla_Time sendTime)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const int32_t token = m_nextToken;
+    m_nextToken = (m_nextToken + 1) & kTokenMask;
+    Trace& trace = m_traces[token % kMaxTraces];
+    if (trace.token >= 0) {
+        // The previous trace in this slot was never reported.
+        m_stats.numIncomplete++;
+    }
+    const double now = hostTime();
+    trace = { token, inputTime > 0. ? inputTime : now, now, sendTime };
+    return token;
+}
+
+void InputLatency::endTrace(int32_t token, Methcla_Time startTime, Methcla_Time soundTime)
+{
+    size_t pos = m_reportsWritten.load(std::memory_order_relaxed);
+    for (;;) {
+        ReportCell& cell = m_reports[pos % kMaxTraces];
+        const size_t seq = cell.sequence.load(std::memory_order_acquire);
+        const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (m_reportsWritten.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.report = { token, startTime, soundTime };
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return;
+            }
+        } else if (diff < 0) {
+            // The queue is full; the trace will count as incomplete.
+            return;
+        } else {
+            pos = m_reportsWritten.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void InputLatency::update()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (;; m_reportsRead++) {
+        ReportCell& cell = m_reports[m_reportsRead % kMaxTraces];
+        if (cell.sequence.load(std::memory_order_acquire) != m_reportsRead + 1) {
+            break;
+        }
+        const Report report = cell.report;
+        cell.sequence.store(m_reportsRead + kMaxTraces, std::memory_order_release);
+        Trace& trace = m_traces[report.token % kMaxTraces];
+        if (report.token < 0 || trace.token != report.token) {
+            continue;
+        }
+        trace.token = -1;
+        if (report.soundTime < 0.) {
+            m_stats.numIncomplete++;
+            continue;
+        }
+        const double input = trace.sendHostTime - trace.inputTime;
+        const double schedule = report.startTime - trace.sendTime;
+        const double render = report.soundTime - report.startTime;
+        m_stats.input.add(input);
+        m_stats.schedule.add(schedule);
+        m_stats.render.add(render);
+        m_stats.total.add(input + schedule + render);
+    }
+}
+
+InputLatency::Stats InputLatency::stats()
+{
+    update();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void InputLatency::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.input.clear();
+    m_stats.schedule.clear();
+    m_stats.render.clear();
+    m_stats.total.clear();
+    m_stats.numIncomplete = 0;
+}
@@ -0,0 +1,150 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INPUTLATENCY_HPP_INCLUDED
+#define INPUTLATENCY_HPP_INCLUDED
+
+#include <methcla/common.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Histogram of latencies in seconds with fixed width buckets and an
+// overflow bucket.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram(double bucketWidth=0.0005, size_t numBuckets=400);
+
+    void add(double latency);
+    void clear();
+
+    size_t count() const { return m_count; }
+    double mean() const { return m_count > 0 ? m_sum / m_count : 0.; }
+    double max() const { return m_max; }
+
+    // Upper bound of the bucket containing the p-th quantile (0 <= p <= 1),
+    // or max() if it lies in the overflow bucket.
+    double percentile(double p) const;
+
+    double bucketWidth() const { return m_bucketWidth; }
+    // Bucket counts; the last bucket counts latencies beyond the range.
+    const std::vector<size_t>& buckets() const { return m_buckets; }
+
+private:
+    double              m_bucketWidth;
+    std::vector<size_t> m_buckets;
+    size_t              m_count;
+    double              m_sum;
+    double              m_max;
+};
+
+// Traces voices from the input event to their first audible sample.
+//
+// Each traced voice passes four points in time: input arrival and request
+// send are taken on the host clock when the voice is started; execution
+// of the start bundle and the first non-silent output sample are reported
+// in engine time by the stream sampler plugin. The intervals between
+// consecutive points and the total are collected into histograms.
+class InputLatency
+{
+public:
+    struct Stats
+    {
+        // Input event to request send.
+        LatencyHistogram input;
+        // Request send to execution of the start bundle; includes the
+        // scheduling lookahead.
+        LatencyHistogram schedule;
+        // Start of playback to the first non-silent sample.
+        LatencyHistogram render;
+        // Input event to the first non-silent sample.
+        LatencyHistogram total;
+        // Voices that stopped before producing sound or whose report was
+        // lost.
+        size_t numIncomplete;
+    };
+
+    InputLatency();
+    ~InputLatency();
+
+    InputLatency(const InputLatency& other) = delete;
+    InputLatency& operator=(const InputLatency& other) = delete;
+
+    // The instance the stream sampler plugin reports to, if any.
+    static InputLatency* instance();
+
+    // Seconds on the monotonic host clock used for input times.
+    static double hostTime();
+
+    // Start tracing a voice whose input arrived at host time inputTime
+    // and whose request is sent now, at engine time sendTime. Returns the
+    // trace token to pass to the synth.
+    int32_t beginTrace(double inputTime, Methcla_Time sendTime);
+
+    // Report the engine times at which a traced voice started playing and
+    // produced its first non-silent sample; soundTime is negative if the
+    // voice stopped before. Called on the audio thread or on the threads
+    // rendering voices in parallel; lock-free.
+    void endTrace(int32_t token, Methcla_Time startTime, Methcla_Time soundTime);
+
+    // Collect reports from the audio thread into the histograms.
+    void update();
+
+    // Copy of the histograms, including all reports received so far.
+    Stats stats();
+
+    // Reset all histograms.
+    void clear();
+
+private:
+    struct Trace
+    {
+        int32_t         token;
+        double          inputTime;
+        double          sendHostTime;
+        Methcla_Time    sendTime;
+    };
+
+    struct Report
+    {
+        int32_t         token;
+        Methcla_Time    startTime;
+        Methcla_Time    soundTime;
+    };
+
+    struct ReportCell
+    {
+        std::atomic<size_t> sequence;
+        Report              report;
+    };
+
+    // Tokens are passed as float controls and must be exactly
+    // representable.
+    enum { kMaxTraces = 256, kTokenMask = (1 << 24) - 1 };
+
+    std::mutex              m_mutex;
+    int32_t                 m_nextToken;
+    Trace                   m_traces[kMaxTraces];
+    // Bounded multi-producer queue of reports, see Logger.
+    ReportCell              m_reports[kMaxTraces];
+    std::atomic<size_t>     m_reportsWritten;
+    size_t                  m_reportsRead;
+    Stats                   m_stats;
+};
+
+#endif // INPUTLATENCY_HPP_INCLUDED
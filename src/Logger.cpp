@@ -0,0 +1,144 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Logger.hpp"
+
+#include <chrono>
+#include <iostream>
+
+Logger::Options::Options()
+    : capacity(1024)
+    , level(kLogInfo)
+    , pollInterval(0.01)
+{
+}
+
+Logger::Logger(const Options& options, Sink sink)
+    : m_sink(sink)
+    , m_pollInterval(options.pollInterval)
+    , m_level(options.level)
+    , m_enqueuePos(0)
+    , m_dequeuePos(0)
+    , m_dropped(0)
+    , m_quit(false)
+{
+    if (!m_sink) {
+        m_sink = [](const LogRecord& record) {
+            format(std::cout, record);
+            std::cout << std::endl;
+        };
+    }
+
+    size_t capacity = 2;
+    while (capacity < options.capacity) {
+        capacity <<= 1;
+    }
+    m_cells.reset(new Cell[capacity]);
+    m_mask = capacity - 1;
+    for (size_t i=0; i < capacity; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    m_thread = std::thread([this]() { process(); });
+}
+
+Logger::~Logger()
+{
+    m_quit = true;
+    m_thread.join();
+}
+
+// Bounded multi-producer queue after Dmitry Vyukov: each cell's sequence
+// number tells producers and the consumer whose turn it is.
+bool Logger::log(const LogRecord& record)
+{
+    if (!enabled(record.level)) {
+        return true;
+    }
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = m_cells[pos & m_mask];
+        const size_t seq = cell.sequence.load(std::memory_order_acquire);
+        const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.record = record;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Logger::pop(LogRecord& record)
+{
+    Cell& cell = m_cells[m_dequeuePos & m_mask];
+    const size_t seq = cell.sequence.load(std::memory_order_acquire);
+    if (seq != m_dequeuePos + 1) {
+        return false;
+    }
+    record = cell.record;
+    cell.sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+    m_dequeuePos++;
+    return true;
+}
+
+void Logger::process()
+{
+    const std::chrono::duration<double> pollInterval(m_pollInterval);
+    LogRecord record;
+    for (;;) {
+        // Read the flag before draining so that records queued before
+        // destruction are written.
+        const bool quit = m_quit.load();
+        while (pop(record)) {
+            m_sink(record);
+        }
+        if (quit) {
+            break;
+        }
+        std::this_thread::sleep_for(pollInterval);
+    }
+}
+
+static const char* eventName(LogRecord::Event event)
+{
+    switch (event) {
+        case LogRecord::kVoiceStart: return "start";
+        case LogRecord::kVoiceUpdate: return "update";
+        case LogRecord::kVoiceStop: return "stop";
+        case LogRecord::kVoiceSteal: return "steal";
+        case LogRecord::kVoiceDrop: return "drop";
+    }
+    return "unknown";
+}
+
+void Logger::format(std::ostream& out, const LogRecord& record)
+{
+    out << record.time
+        << " " << eventName(record.event)
+        << " voice=" << record.voice
+        << " synth=" << record.synth
+        << " sound=" << record.sound
+        << " param=" << record.param
+        << " rate=" << record.rate;
+    if (record.detail != nullptr) {
+        out << " " << record.detail;
+    }
+}
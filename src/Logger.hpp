@@ -0,0 +1,146 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LOGGER_HPP_INCLUDED
+#define LOGGER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <thread>
+
+enum LogLevel
+{
+    kLogNone,
+    kLogError,
+    kLogWarning,
+    kLogInfo,
+    kLogDebug
+};
+
+// Structured log record. Records are copied by value into the logger's
+// queue, so they must not refer to memory that might go away before the
+// record has been written; detail should point to a string literal.
+struct LogRecord
+{
+    enum Event
+    {
+        kVoiceStart,
+        kVoiceUpdate,
+        kVoiceStop,
+        kVoiceSteal,
+        kVoiceDrop
+    };
+
+    LogLevel        level;
+    Event           event;
+    // Engine time at which the record was created.
+    double          time;
+    intptr_t        voice;
+    int32_t         synth;
+    size_t          sound;
+    float           param;
+    float           rate;
+    const char*     detail;
+};
+
+// Asynchronous logger for the note path.
+//
+// Records are pushed into a bounded lock-free queue and written to a sink
+// by a background thread, so that logging neither formats nor blocks in
+// the caller. When the queue is full records are dropped and counted.
+// Checking enabled() before building a record makes disabled levels cost a
+// single relaxed load.
+class Logger
+{
+public:
+    typedef std::function<void(const LogRecord&)> Sink;
+
+    struct Options
+    {
+        Options();
+
+        // Number of records that can be queued; rounded up to a power of
+        // two.
+        size_t capacity;
+        // Records above this level are discarded.
+        LogLevel level;
+        // Time in seconds the writer thread sleeps when the queue is empty.
+        double pollInterval;
+    };
+
+    // Create a logger writing to sink, or to std::cout if sink is empty.
+    Logger(const Options& options, Sink sink=Sink());
+    // Write all queued records and stop the writer thread.
+    ~Logger();
+
+    Logger(const Logger& other) = delete;
+    Logger& operator=(const Logger& other) = delete;
+
+    LogLevel level() const
+    {
+        return LogLevel(m_level.load(std::memory_order_relaxed));
+    }
+
+    void setLevel(LogLevel level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    bool enabled(LogLevel level) const
+    {
+        return level <= m_level.load(std::memory_order_relaxed);
+    }
+
+    // Queue a record unless its level is disabled. Lock-free and safe to
+    // call from multiple threads. Returns false if the record was dropped
+    // because the queue was full.
+    bool log(const LogRecord& record);
+
+    // Number of records dropped because the queue was full.
+    size_t numDropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Format a record as a single line of text (without newline).
+    static void format(std::ostream& out, const LogRecord& record);
+
+private:
+    bool pop(LogRecord& record);
+    void process();
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        LogRecord           record;
+    };
+
+    Sink                        m_sink;
+    double                      m_pollInterval;
+    std::unique_ptr<Cell[]>     m_cells;
+    size_t                      m_mask;
+    std::atomic<int>            m_level;
+    std::atomic<size_t>         m_enqueuePos;
+    size_t                      m_dequeuePos;
+    std::atomic<size_t>         m_dropped;
+    std::atomic<bool>           m_quit;
+    std::thread                 m_thread;
+};
+
+#endif // LOGGER_HPP_INCLUDED
@@ -0,0 +1,161 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "MappedSounds.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+static std::atomic<MappedSounds*> gInstance(nullptr);
+
+MappedSounds::Options::Options()
+    : numCursors(64)
+    , prefetchTime(0.5)
+    , headDuration(0.2)
+    , lockHeads(false)
+    , pollInterval(0.01)
+{
+}
+
+MappedSounds::MappedSounds(const Options& options, size_t numSounds)
+    : m_options(options)
+    , m_sounds(numSounds)
+    , m_mappedBytes(0)
+    , m_cursors(new MappedCursor[options.numCursors])
+    , m_numPrefaultedPages(0)
+    , m_lockFailed(false)
+    , m_quit(false)
+{
+    for (auto& sound : m_sounds) {
+        sound.store(nullptr);
+    }
+
+    for (size_t i=0; i < m_options.numCursors; i++) {
+        MappedCursor& cursor = m_cursors[i];
+        cursor.m_state = MappedCursor::kFree;
+        cursor.m_sound = nullptr;
+        cursor.m_loop = false;
+        cursor.m_position = 0;
+        cursor.m_rate = 1.f;
+    }
+
+    m_thread = std::thread([this]() { process(); });
+
+    MappedSounds* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "MappedSounds: another instance is already active" << std::endl;
+    }
+}
+
+MappedSounds::~MappedSounds()
+{
+    MappedSounds* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+    m_quit = true;
+    m_thread.join();
+}
+
+MappedSounds* MappedSounds::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+bool MappedSounds::registerSound(size_t index, std::unique_ptr<SampleFile> sound)
+{
+    assert( index < m_sounds.size() );
+    std::lock_guard<std::mutex> lock(m_soundStorageMutex);
+    if (m_sounds[index].load() != nullptr) {
+        return false;
+    }
+
+    const int64_t headFrames = int64_t(std::ceil(m_options.headDuration * sound->sampleRate()));
+    m_numPrefaultedPages.fetch_add(sound->prefault(0, headFrames), std::memory_order_relaxed);
+    if (m_options.lockHeads && !sound->lock(0, headFrames) && !m_lockFailed) {
+        std::cerr << "MappedSounds: couldn't lock sound heads into memory" << std::endl;
+        m_lockFailed = true;
+    }
+
+    m_mappedBytes.fetch_add(sound->dataSize(), std::memory_order_relaxed);
+    m_sounds[index].store(sound.get(), std::memory_order_release);
+    m_soundStorage.push_back(std::move(sound));
+    return true;
+}
+
+MappedCursor* MappedSounds::openCursor(const SampleFile* sound, bool loop)
+{
+    for (size_t i=0; i < m_options.numCursors; i++) {
+        MappedCursor& cursor = m_cursors[i];
+        int expected = MappedCursor::kFree;
+        if (cursor.m_state.compare_exchange_strong(expected, MappedCursor::kClaimed, std::memory_order_acquire)) {
+            cursor.m_sound = sound;
+            cursor.m_loop = loop;
+            cursor.update(0., 1.f);
+            cursor.m_state.store(MappedCursor::kActive, std::memory_order_release);
+            return &cursor;
+        }
+    }
+    return nullptr;
+}
+
+void MappedSounds::closeCursor(MappedCursor* cursor)
+{
+    cursor->m_state.store(MappedCursor::kClosing, std::memory_order_release);
+}
+
+// Prefault the frames a voice is going to play within the next
+// prefetchTime seconds.
+void MappedSounds::prefetch(const MappedCursor& cursor)
+{
+    const SampleFile& sound = *cursor.m_sound;
+    const int64_t position = cursor.m_position.load(std::memory_order_relaxed);
+    const double rate = std::max(1.f, std::abs(cursor.m_rate.load(std::memory_order_relaxed)));
+    const int64_t numFrames = int64_t(std::ceil(m_options.prefetchTime * sound.sampleRate() * rate));
+
+    size_t numFaulted = 0;
+    const bool hasLoop = sound.loopEnd() > sound.loopStart();
+    const int64_t loopStart = hasLoop ? sound.loopStart() : 0;
+    const int64_t loopEnd = hasLoop ? sound.loopEnd() : sound.frames();
+    if (cursor.m_loop && loopEnd > loopStart && position + numFrames > loopEnd) {
+        // Continue at the loop start; the voice wraps its own position
+        // before publishing it, so it is at most one loop behind.
+        numFaulted += sound.prefault(position, loopEnd);
+        numFaulted += sound.prefault(loopStart, std::min(loopEnd, loopStart + position + numFrames - loopEnd));
+    } else {
+        numFaulted += sound.prefault(position, position + numFrames);
+    }
+    m_numPrefaultedPages.fetch_add(numFaulted, std::memory_order_relaxed);
+}
+
+void MappedSounds::process()
+{
+    const auto pollInterval = std::chrono::duration<double>(m_options.pollInterval);
+
+    while (!m_quit) {
+        for (size_t i=0; i < m_options.numCursors; i++) {
+            MappedCursor& cursor = m_cursors[i];
+            switch (cursor.m_state.load(std::memory_order_acquire)) {
+                case MappedCursor::kActive:
+                    prefetch(cursor);
+                    break;
+                case MappedCursor::kClosing:
+                    cursor.m_state.store(MappedCursor::kFree, std::memory_order_release);
+                    break;
+            }
+        }
+        std::this_thread::sleep_for(pollInterval);
+    }
+}
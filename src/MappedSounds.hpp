@@ -0,0 +1,149 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MAPPEDSOUNDS_HPP_INCLUDED
+#define MAPPEDSOUNDS_HPP_INCLUDED
+
+#include "SampleFile.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Playback position of a voice reading from a mapped sound, published by
+// the audio thread so that the pages ahead of it can be prefaulted.
+class MappedCursor
+{
+public:
+    // Set the current position in frames and playback rate. Lock-free.
+    void update(double position, float rate)
+    {
+        m_position.store(int64_t(position), std::memory_order_relaxed);
+        m_rate.store(rate, std::memory_order_relaxed);
+    }
+
+private:
+    friend class MappedSounds;
+
+    enum State
+    {
+        kFree,
+        kClaimed,
+        kActive,
+        kClosing
+    };
+
+    std::atomic<int>        m_state;
+    // Written by the audio thread before switching to kActive.
+    const SampleFile*       m_sound;
+    bool                    m_loop;
+    std::atomic<int64_t>    m_position;
+    std::atomic<float>      m_rate;
+};
+
+// Memory mapped sample containers of the sounds played by the mapped
+// sampler plugin.
+//
+// Sounds are registered by index before voices refer to them; lookups are
+// lock-free and can be called from the audio thread. Voices share the
+// physical pages of a sound and don't buffer anything themselves. To keep
+// the audio thread from faulting, the start of each sound is prefaulted
+// when it is registered and a background thread prefaults the pages
+// ahead of every playing voice.
+class MappedSounds
+{
+public:
+    struct Options
+    {
+        Options();
+
+        // Maximum number of voices whose upcoming pages are prefaulted.
+        size_t numCursors;
+        // Playback time in seconds ahead of each voice that is prefaulted,
+        // scaled by the voice's rate if it is faster than the original.
+        double prefetchTime;
+        // Duration in seconds of the start of each sound that is
+        // prefaulted on registration, so that voices start without
+        // faulting.
+        double headDuration;
+        // Also lock the start of each sound into memory so that it can't
+        // be evicted.
+        bool lockHeads;
+        // Time in seconds between prefetch passes.
+        double pollInterval;
+    };
+
+    MappedSounds(const Options& options, size_t numSounds);
+    ~MappedSounds();
+
+    MappedSounds(const MappedSounds& other) = delete;
+    MappedSounds& operator=(const MappedSounds& other) = delete;
+
+    // The instance used by the mapped sampler plugin, if any.
+    static MappedSounds* instance();
+
+    // Register the container of sound index and prefault its start. Sounds
+    // can only be registered once and stay mapped until this object is
+    // destroyed. Return false if the sound was registered already.
+    bool registerSound(size_t index, std::unique_ptr<SampleFile> sound);
+
+    // Return the container registered for index or nullptr. Lock-free.
+    const SampleFile* sound(size_t index) const
+    {
+        return index < m_sounds.size() ? m_sounds[index].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Sum of the sample data sizes of all registered sounds.
+    size_t mappedBytes() const
+    {
+        return m_mappedBytes.load(std::memory_order_relaxed);
+    }
+
+    // Claim a cursor for a voice playing sound from the start, wrapping
+    // around at its loop points if loop is true. Returns nullptr if no
+    // cursor is available, in which case the voice's pages aren't
+    // prefaulted. Lock-free.
+    MappedCursor* openCursor(const SampleFile* sound, bool loop);
+
+    // Return a cursor. Lock-free.
+    void closeCursor(MappedCursor* cursor);
+
+    // Number of pages that weren't resident when the prefetcher touched
+    // them, i.e. faults the audio thread would have taken otherwise.
+    size_t numPrefaultedPages() const
+    {
+        return m_numPrefaultedPages.load(std::memory_order_relaxed);
+    }
+
+private:
+    void process();
+    void prefetch(const MappedCursor& cursor);
+
+private:
+    Options                                     m_options;
+    std::vector<std::atomic<const SampleFile*>> m_sounds;
+    std::mutex                                  m_soundStorageMutex;
+    std::vector<std::unique_ptr<SampleFile>>    m_soundStorage;
+    std::atomic<size_t>                         m_mappedBytes;
+    std::unique_ptr<MappedCursor[]>             m_cursors;
+    std::atomic<size_t>                         m_numPrefaultedPages;
+    bool                                        m_lockFailed;
+    std::atomic<bool>                           m_quit;
+    std::thread                                 m_thread;
+};
+
+#endif // MAPPEDSOUNDS_HPP_INCLUDED
@@ -0,0 +1,67 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PARALLEL_HPP_INCLUDED
+#define PARALLEL_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Return the number of worker threads to use when numThreads is 0.
+inline size_t defaultNumThreads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Call f(i) for every i in [0, n) from a pool of numThreads worker threads
+// (0 means one per hardware thread). Work items are handed out one at a
+// time, so uneven item costs are balanced across workers. f must not
+// throw and must be safe to call concurrently for different indices.
+template <class F> void parallelFor(size_t n, size_t numThreads, F f)
+{
+    if (numThreads == 0) {
+        numThreads = defaultNumThreads();
+    }
+    numThreads = std::min(numThreads, n);
+
+    if (numThreads <= 1) {
+        for (size_t i=0; i < n; i++) {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            f(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (size_t i=1; i < numThreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    // The calling thread takes part in the work as well.
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+#endif // PARALLEL_HPP_INCLUDED
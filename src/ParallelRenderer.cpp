@@ -0,0 +1,164 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ParallelRenderer.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#if defined(__i386__) || defined(__x86_64__)
+# include <xmmintrin.h>
+#endif
+
+static std::atomic<ParallelRenderer*> gInstance(nullptr);
+
+// Hint to the CPU that we're busy waiting.
+static inline void cpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    _mm_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+ParallelRenderer::Options::Options()
+    : numThreads(0)
+    , spinTime(0.1)
+    , pollInterval(0.0005)
+{
+}
+
+ParallelRenderer::ParallelRenderer(const Options& options)
+    : m_spinTime(options.spinTime)
+    , m_pollInterval(options.pollInterval)
+    , m_work(0)
+    , m_done(0)
+    , m_batch(0)
+    , m_task(nullptr)
+    , m_data(nullptr)
+    , m_quit(false)
+{
+    const size_t numThreads = options.numThreads == 0 ? defaultNumThreads() : options.numThreads;
+    for (size_t i=1; i < numThreads; i++) {
+        m_workers.push_back(std::thread([this]() { work(); }));
+    }
+
+    ParallelRenderer* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "ParallelRenderer: another instance is already active" << std::endl;
+    }
+}
+
+ParallelRenderer::~ParallelRenderer()
+{
+    ParallelRenderer* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+    m_quit = true;
+    for (auto& thread : m_workers) {
+        thread.join();
+    }
+}
+
+ParallelRenderer* ParallelRenderer::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+// Claim the next task of batch; fails when the batch has been handed out
+// completely or has been superseded.
+bool ParallelRenderer::claim(uint32_t batch, size_t& index)
+{
+    uint64_t work = m_work.load(std::memory_order_acquire);
+    for (;;) {
+        const size_t next = work & 0xffff;
+        const size_t count = (work >> 16) & 0xffff;
+        if (uint32_t(work >> 32) != batch || next >= count) {
+            return false;
+        }
+        if (m_work.compare_exchange_weak(work, work + 1, std::memory_order_acquire, std::memory_order_acquire)) {
+            index = next;
+            return true;
+        }
+    }
+}
+
+void ParallelRenderer::run(Task task, void* data, size_t numTasks)
+{
+    numTasks = std::min<size_t>(numTasks, kMaxTasks);
+
+    if (m_workers.empty() || numTasks <= 1) {
+        for (size_t i=0; i < numTasks; i++) {
+            task(data, i);
+        }
+        return;
+    }
+
+    // Workers only read the task after claiming an index of the new batch,
+    // and all tasks of the previous batch have completed at this point.
+    m_task = task;
+    m_data = data;
+    m_done.store(0, std::memory_order_relaxed);
+    const uint32_t batch = ++m_batch;
+    m_work.store(uint64_t(batch) << 32 | uint64_t(numTasks) << 16, std::memory_order_release);
+
+    size_t numDone = 0;
+    size_t index;
+    while (claim(batch, index)) {
+        task(data, index);
+        numDone++;
+    }
+
+    // Wait for the tasks still running on worker threads.
+    while (numDone + m_done.load(std::memory_order_acquire) < numTasks) {
+        cpuRelax();
+    }
+}
+
+void ParallelRenderer::work()
+{
+    typedef std::chrono::steady_clock Clock;
+    const auto spinTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_spinTime));
+    const auto pollInterval = std::chrono::duration<double>(m_pollInterval);
+
+    uint32_t lastBatch = 0;
+    auto lastWork = Clock::now();
+    size_t numSpins = 0;
+    bool idle = false;
+
+    while (!m_quit.load(std::memory_order_relaxed)) {
+        const uint32_t batch = uint32_t(m_work.load(std::memory_order_acquire) >> 32);
+        if (batch != lastBatch) {
+            lastBatch = batch;
+            size_t index;
+            while (claim(batch, index)) {
+                m_task(m_data, index);
+                m_done.fetch_add(1, std::memory_order_release);
+            }
+            lastWork = Clock::now();
+            numSpins = 0;
+            idle = false;
+        } else if (idle) {
+            std::this_thread::sleep_for(pollInterval);
+        } else {
+            cpuRelax();
+            // Only look at the clock every now and then.
+            if (++numSpins % 1024 == 0) {
+                idle = Clock::now() - lastWork >= spinTime;
+            }
+        }
+    }
+}
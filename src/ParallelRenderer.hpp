@@ -0,0 +1,93 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PARALLELRENDERER_HPP_INCLUDED
+#define PARALLELRENDERER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Runs the independent tasks of an audio period, e.g. voice subgroups, on
+// a pool of worker threads together with the audio thread.
+//
+// Tasks are claimed one at a time through a single atomic word holding the
+// batch number, the number of tasks and the next task index; a counter of
+// completed tasks serves as the barrier at the end of the period. The
+// audio thread never takes a lock or makes a system call: it renders every
+// task no worker has claimed, so at worst it waits for the tasks already
+// running on other threads.
+//
+// Idle workers spin for a while after their last task and then poll, so
+// that they don't occupy cores while the engine is silent. A worker that
+// oversleeps a period leaves its share to the other threads.
+class ParallelRenderer
+{
+public:
+    struct Options
+    {
+        Options();
+
+        // Number of threads rendering in parallel, including the audio
+        // thread; 0 means one per hardware thread.
+        size_t numThreads;
+        // Time in seconds a worker keeps spinning after its last task.
+        double spinTime;
+        // Time in seconds an idle worker sleeps between checks for work.
+        double pollInterval;
+    };
+
+    typedef void (*Task)(void* data, size_t index);
+
+    ParallelRenderer(const Options& options);
+    ~ParallelRenderer();
+
+    ParallelRenderer(const ParallelRenderer& other) = delete;
+    ParallelRenderer& operator=(const ParallelRenderer& other) = delete;
+
+    // The renderer used by the parallel sampler plugin, if any.
+    static ParallelRenderer* instance();
+
+    // Number of threads rendering in parallel, including the caller of
+    // run().
+    size_t numThreads() const { return m_workers.size() + 1; }
+
+    // Call task(data, i) for every i in [0, numTasks) and return when all
+    // calls have finished. Must not be called concurrently; lock-free.
+    void run(Task task, void* data, size_t numTasks);
+
+    // Maximum number of tasks per call to run().
+    enum { kMaxTasks = 0xffff };
+
+private:
+    bool claim(uint32_t batch, size_t& index);
+    void work();
+
+private:
+    double                      m_spinTime;
+    double                      m_pollInterval;
+    // Batch number in the upper 32 bits, number of tasks and next task
+    // index in the lower two 16 bit halves.
+    std::atomic<uint64_t>       m_work;
+    std::atomic<size_t>         m_done;
+    uint32_t                    m_batch;
+    Task                        m_task;
+    void*                       m_data;
+    std::atomic<bool>           m_quit;
+    std::vector<std::thread>    m_workers;
+};
+
+#endif // PARALLELRENDERER_HPP_INCLUDED
@@ -0,0 +1,197 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ResampleCache.hpp"
+#include "CacheFiles.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+// Changes whenever the conversion produces different output, which
+// invalidates all cached files.
+static const uint32_t kFormatVersion = 1;
+
+// RIFF header, fmt chunk with WAVE_FORMAT_IEEE_FLOAT, fact chunk and data
+// chunk header.
+static const size_t kWavHeaderSize = 58;
+static const size_t kBlockFrames = 4096;
+
+static unsigned char* putLE16(unsigned char* dst, uint16_t x)
+{
+    dst[0] = x & 0xff;
+    dst[1] = x >> 8;
+    return dst + 2;
+}
+
+static unsigned char* putLE32(unsigned char* dst, uint32_t x)
+{
+    putLE16(dst, x & 0xffff);
+    return putLE16(dst + 2, x >> 16);
+}
+
+static unsigned char* putTag(unsigned char* dst, const char* tag)
+{
+    std::copy(tag, tag + 4, dst);
+    return dst + 4;
+}
+
+static bool writeWavHeader(FILE* file, size_t numChannels, size_t sampleRate, size_t numFrames)
+{
+    const uint32_t dataSize = uint32_t(numFrames * numChannels * sizeof(float));
+    unsigned char header[kWavHeaderSize];
+    unsigned char* p = header;
+    p = putTag(p, "RIFF");
+    p = putLE32(p, uint32_t(kWavHeaderSize - 8 + dataSize));
+    p = putTag(p, "WAVE");
+    p = putTag(p, "fmt ");
+    p = putLE32(p, 18);
+    p = putLE16(p, 3); // WAVE_FORMAT_IEEE_FLOAT
+    p = putLE16(p, uint16_t(numChannels));
+    p = putLE32(p, uint32_t(sampleRate));
+    p = putLE32(p, uint32_t(sampleRate * numChannels * sizeof(float)));
+    p = putLE16(p, uint16_t(numChannels * sizeof(float)));
+    p = putLE16(p, 32);
+    p = putLE16(p, 0);
+    p = putTag(p, "fact");
+    p = putLE32(p, 4);
+    p = putLE32(p, uint32_t(numFrames));
+    p = putTag(p, "data");
+    p = putLE32(p, dataSize);
+    return std::fseek(file, 0, SEEK_SET) == 0
+        && std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+// Append samples to file in little endian byte order.
+static bool writeSamples(FILE* file, const std::vector<float>& samples)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    std::vector<unsigned char> bytes(samples.size() * sizeof(float));
+    for (size_t i=0; i < samples.size(); i++) {
+        uint32_t bits;
+        std::memcpy(&bits, &samples[i], sizeof(bits));
+        putLE32(&bytes[i * sizeof(float)], bits);
+    }
+    return std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+#else
+    return std::fwrite(samples.data(), sizeof(float), samples.size(), file) == samples.size();
+#endif
+}
+
+ResampleCache::ResampleCache(const std::string& dir, size_t sampleRate, const Resampler::Options& options, OpenFunction openFile)
+    : m_dir(dir)
+    , m_sampleRate(sampleRate)
+    , m_options(options)
+    , m_openFile(openFile)
+{
+    createCacheDir(m_dir);
+}
+
+std::string ResampleCache::cachePath(const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info) const
+{
+    return CacheKey()
+        .add(path)
+        .add(stamp.size)
+        .add(stamp.mtime)
+        .add(uint64_t(info.samplerate))
+        .add(uint64_t(m_sampleRate))
+        .add(uint64_t(m_options.zeroCrossings))
+        .add(m_options.cutoff)
+        .add(m_options.kaiserBeta)
+        .add(kFormatVersion)
+        .path(m_dir, ".wav");
+}
+
+bool ResampleCache::convert(const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info, std::string& outPath, Methcla_SoundFileInfo& outInfo)
+{
+    if (info.channels == 0 || info.samplerate == 0) {
+        return false;
+    }
+
+    outPath = cachePath(path, stamp, info);
+    outInfo.channels = info.channels;
+    outInfo.samplerate = m_sampleRate;
+
+    const size_t frameSize = info.channels * sizeof(float);
+    struct stat st;
+    if (stat(outPath.c_str(), &st) == 0
+        && size_t(st.st_size) >= kWavHeaderSize
+        && (size_t(st.st_size) - kWavHeaderSize) % frameSize == 0) {
+        outInfo.frames = (size_t(st.st_size) - kWavHeaderSize) / frameSize;
+        return true;
+    }
+
+    Methcla_SoundFile* file;
+    Methcla_SoundFileInfo fileInfo;
+    if (m_openFile(path.c_str(), &file, &fileInfo) != kMethcla_NoError) {
+        std::cerr << "Opening sound file " << path << " for resampling failed" << std::endl;
+        return false;
+    }
+
+    const std::string tmpPath = outPath + ".tmp";
+    FILE* out = std::fopen(tmpPath.c_str(), "wb");
+    if (out == nullptr) {
+        file->close(file);
+        std::cerr << "Couldn't create resampled sound file " << tmpPath << std::endl;
+        return false;
+    }
+
+    // Reserve space for the header, which is written when the number of
+    // frames is known.
+    bool success = writeWavHeader(out, fileInfo.channels, m_sampleRate, 0);
+    Resampler resampler(fileInfo.channels, fileInfo.samplerate, m_sampleRate, m_options);
+    std::vector<float> input(kBlockFrames * fileInfo.channels);
+    std::vector<float> output;
+    size_t numFrames = 0;
+    while (success) {
+        size_t numRead = 0;
+        if (file->read_float(file, input.data(), kBlockFrames, &numRead) != kMethcla_NoError) {
+            // Don't cache a truncated sound.
+            std::cerr << "Reading sound file " << path << " for resampling failed" << std::endl;
+            success = false;
+            break;
+        }
+        if (numRead == 0) {
+            resampler.flush(output);
+        } else {
+            resampler.process(input.data(), numRead, output);
+        }
+        numFrames += output.size() / fileInfo.channels;
+        success = writeSamples(out, output);
+        output.clear();
+        if (numRead == 0) {
+            break;
+        }
+    }
+    file->close(file);
+
+    success = success && writeWavHeader(out, fileInfo.channels, m_sampleRate, numFrames);
+    if (std::fclose(out) != 0 || !success || std::rename(tmpPath.c_str(), outPath.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        std::cerr << "Writing resampled sound file " << outPath << " failed" << std::endl;
+        return false;
+    }
+
+    outInfo.channels = fileInfo.channels;
+    outInfo.frames = numFrames;
+    return true;
+}
+
+void ResampleCache::removeUnused(std::vector<std::string> usedPaths)
+{
+    removeUnusedCacheFiles(m_dir, std::move(usedPaths));
+}
@@ -0,0 +1,69 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RESAMPLECACHE_HPP_INCLUDED
+#define RESAMPLECACHE_HPP_INCLUDED
+
+#include "Resampler.hpp"
+#include "SoundIndex.hpp"
+
+#include <methcla/file.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Directory of sounds converted to a fixed sample rate.
+//
+// Converted sounds are stored as 32 bit float WAV files named after a hash
+// of the source path, its file stamp, both rates and the resampler
+// options, so that a changed source file or configuration is converted
+// anew and a cache hit costs a single stat. Files are written under a
+// temporary name and renamed when complete.
+class ResampleCache
+{
+public:
+    typedef std::function<Methcla_Error(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)> OpenFunction;
+
+    // Create the cache directory dir if it doesn't exist. Sounds are
+    // opened with openFile.
+    ResampleCache(const std::string& dir, size_t sampleRate, const Resampler::Options& options, OpenFunction openFile);
+
+    ResampleCache(const ResampleCache& other) = delete;
+    ResampleCache& operator=(const ResampleCache& other) = delete;
+
+    size_t sampleRate() const
+    {
+        return m_sampleRate;
+    }
+
+    // Return the path and info of the sound at path with the given stamp
+    // and info converted to sampleRate(), converting it unless it's
+    // cached. Returns false if the conversion failed. Different sounds can
+    // be converted concurrently.
+    bool convert(const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info, std::string& outPath, Methcla_SoundFileInfo& outInfo);
+
+    // Remove all files from the cache directory except for usedPaths.
+    void removeUnused(std::vector<std::string> usedPaths);
+
+private:
+    std::string cachePath(const std::string& path, const FileStamp& stamp, const Methcla_SoundFileInfo& info) const;
+
+private:
+    std::string         m_dir;
+    size_t              m_sampleRate;
+    Resampler::Options  m_options;
+    OpenFunction        m_openFile;
+};
+
+#endif // RESAMPLECACHE_HPP_INCLUDED
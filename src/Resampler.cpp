@@ -0,0 +1,142 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Resampler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+static const size_t kTableResolution = 512;
+
+// Zeroth order modified Bessel function of the first kind.
+static double besselI0(double x)
+{
+    double sum = 1.;
+    double term = 1.;
+    for (int k=1; term > sum * 1e-12; k++) {
+        const double y = x / (2. * k);
+        term *= y * y;
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Options::Options()
+    : zeroCrossings(64)
+    , cutoff(0.95)
+    , kaiserBeta(8.6)
+{
+}
+
+Resampler::Resampler(size_t numChannels, size_t sourceRate, size_t targetRate, const Options& options)
+    : m_numChannels(numChannels)
+    , m_sourceRate(sourceRate)
+    , m_targetRate(targetRate)
+    , m_cutoff(options.cutoff * std::min(1., double(targetRate) / double(sourceRate)))
+    , m_halfWidth(int64_t(std::ceil(double(options.zeroCrossings) / m_cutoff)))
+    , m_table(options.zeroCrossings * kTableResolution + 2, 0.f)
+    , m_weights(2 * size_t(m_halfWidth))
+    , m_inputStart(0)
+    , m_inputEnd(0)
+    , m_outputFrame(0)
+{
+    assert(numChannels > 0 && sourceRate > 0 && targetRate > 0);
+    const double zeroCrossings = double(options.zeroCrossings);
+    const double norm = 1. / besselI0(options.kaiserBeta);
+    // The last two entries stay zero for interpolating at the edge.
+    for (size_t i=0; i < options.zeroCrossings * kTableResolution; i++) {
+        const double u = double(i) / kTableResolution;
+        const double sinc = i == 0 ? 1. : std::sin(M_PI * u) / (M_PI * u);
+        const double t = u / zeroCrossings;
+        const double window = besselI0(options.kaiserBeta * std::sqrt(1. - t * t)) * norm;
+        m_table[i] = float(sinc * window);
+    }
+}
+
+int64_t Resampler::outputFrames(int64_t numFrames, size_t sourceRate, size_t targetRate)
+{
+    return int64_t((uint64_t(numFrames) * targetRate + sourceRate - 1) / sourceRate);
+}
+
+// Kernel value at a distance of x input frames.
+float Resampler::kernel(double x) const
+{
+    const double pos = std::abs(x) * m_cutoff * kTableResolution;
+    const size_t i = size_t(pos);
+    if (i + 1 >= m_table.size()) {
+        return 0.f;
+    }
+    const float frac = float(pos - double(i));
+    return float(m_cutoff) * (m_table[i] + frac * (m_table[i+1] - m_table[i]));
+}
+
+void Resampler::process(const float* input, size_t numFrames, std::vector<float>& output)
+{
+    m_input.insert(m_input.end(), input, input + numFrames * m_numChannels);
+    m_inputEnd += int64_t(numFrames);
+    render(output, false);
+}
+
+void Resampler::flush(std::vector<float>& output)
+{
+    render(output, true);
+}
+
+void Resampler::render(std::vector<float>& output, bool flush)
+{
+    const uint64_t endFrame = flush
+        ? uint64_t(outputFrames(m_inputEnd, m_sourceRate, m_targetRate))
+        : std::numeric_limits<uint64_t>::max();
+    const int64_t numTaps = 2 * m_halfWidth;
+
+    for (; m_outputFrame < endFrame; m_outputFrame++) {
+        // The output frame lies at input position center + frac.
+        const uint64_t position = m_outputFrame * m_sourceRate;
+        const int64_t center = int64_t(position / m_targetRate);
+        if (!flush && center + m_halfWidth >= m_inputEnd) {
+            break;
+        }
+        const double frac = double(position % m_targetRate) / double(m_targetRate);
+
+        // Taps cover the input frames first to first + numTaps - 1;
+        // those outside the buffered input are silent.
+        const int64_t first = center - m_halfWidth + 1;
+        for (int64_t k=0; k < numTaps; k++) {
+            m_weights[k] = kernel(double(k - m_halfWidth + 1) - frac);
+        }
+        const int64_t begin = std::max<int64_t>(0, m_inputStart - first);
+        const int64_t end = std::min<int64_t>(numTaps, m_inputEnd - first);
+
+        const float* src = m_input.data() + (first + begin - m_inputStart) * int64_t(m_numChannels);
+        for (size_t c=0; c < m_numChannels; c++) {
+            double sum = 0.;
+            for (int64_t k=begin; k < end; k++) {
+                sum += m_weights[k] * src[(k - begin) * int64_t(m_numChannels) + int64_t(c)];
+            }
+            output.push_back(float(sum));
+        }
+    }
+
+    // Drop input that no later output frame needs, in large steps so that
+    // the buffer isn't shifted for every block.
+    const uint64_t nextPosition = m_outputFrame * m_sourceRate;
+    const int64_t needed = std::min(m_inputEnd, int64_t(nextPosition / m_targetRate) - m_halfWidth + 1);
+    const int64_t numDropped = needed - m_inputStart;
+    if (numDropped > 0 && 2 * numDropped >= m_inputEnd - m_inputStart) {
+        m_input.erase(m_input.begin(), m_input.begin() + numDropped * int64_t(m_numChannels));
+        m_inputStart = needed;
+    }
+}
@@ -0,0 +1,87 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RESAMPLER_HPP_INCLUDED
+#define RESAMPLER_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Offline sample rate converter for interleaved audio.
+//
+// Output frames are band-limited interpolations of the input with a
+// Kaiser windowed sinc kernel, whose cutoff is scaled down when
+// converting to a lower rate to avoid aliasing. Input positions are
+// computed exactly from the integer rate ratio, so long sounds don't
+// drift. Meant for converting sounds ahead of playback; much too slow for
+// the audio thread.
+class Resampler
+{
+public:
+    struct Options
+    {
+        Options();
+
+        // Number of zero crossings of the kernel on each side. More give a
+        // narrower transition band at a proportional cost.
+        size_t zeroCrossings;
+        // Cutoff frequency as a fraction of the lower of the two Nyquist
+        // frequencies.
+        double cutoff;
+        // Shape of the Kaiser window; higher values trade a wider
+        // transition band for more stopband attenuation.
+        double kaiserBeta;
+    };
+
+    Resampler(size_t numChannels, size_t sourceRate, size_t targetRate, const Options& options=Options());
+
+    Resampler(const Resampler& other) = delete;
+    Resampler& operator=(const Resampler& other) = delete;
+
+    // Number of output frames for numFrames input frames.
+    static int64_t outputFrames(int64_t numFrames, size_t sourceRate, size_t targetRate);
+
+    // Consume numFrames input frames and append the output frames that
+    // can be computed from the input so far to output.
+    void process(const float* input, size_t numFrames, std::vector<float>& output);
+
+    // Append the remaining output frames to output, treating the input as
+    // silent after its end.
+    void flush(std::vector<float>& output);
+
+private:
+    void render(std::vector<float>& output, bool flush);
+    float kernel(double x) const;
+
+private:
+    size_t              m_numChannels;
+    uint64_t            m_sourceRate;
+    uint64_t            m_targetRate;
+    // Cutoff relative to the source Nyquist frequency.
+    double              m_cutoff;
+    // Kernel taps on each side of an output frame's input position.
+    int64_t             m_halfWidth;
+    // Kernel over one side sampled at kTableResolution points per zero
+    // crossing.
+    std::vector<float>  m_table;
+    std::vector<float>  m_weights;
+    // Input frames from m_inputStart to m_inputEnd that are still needed.
+    std::vector<float>  m_input;
+    int64_t             m_inputStart;
+    int64_t             m_inputEnd;
+    uint64_t            m_outputFrame;
+};
+
+#endif // RESAMPLER_HPP_INCLUDED
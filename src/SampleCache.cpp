@@ -0,0 +1,283 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SampleCache.hpp"
+
+#include <cassert>
+#include <iostream>
+
+static std::atomic<SampleCache*> gInstance(nullptr);
+
+const size_t SampleCache::kNone;
+
+SampleCache::Options::Options()
+    : memoryBudget(32*1024*1024)
+    , shortSoundDuration(2.)
+    , hotTriggerCount(3)
+    , agingPeriod(1024)
+{
+}
+
+SampleCache::SampleCache(const Options& options, size_t numSounds, OpenFunction openFile)
+    : m_options(options)
+    , m_openFile(openFile)
+    , m_entries(numSounds)
+    , m_lruHead(kNone)
+    , m_lruTail(kNone)
+    , m_residentBytes(0)
+    , m_numTriggers(0)
+    , m_quit(false)
+{
+    m_victims.reserve(numSounds);
+    m_jobs.reserve(2 * numSounds);
+    m_runningJobs.reserve(2 * numSounds);
+
+    m_thread = std::thread([this]() { process(); });
+
+    SampleCache* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "SampleCache: another instance is already active" << std::endl;
+    }
+}
+
+SampleCache::~SampleCache()
+{
+    SampleCache* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_quit = true;
+    }
+    m_jobCondition.notify_one();
+    m_thread.join();
+
+    for (const auto& job : m_jobs) {
+        delete job.garbage;
+    }
+    for (auto& entry : m_entries) {
+        delete entry.data.load();
+    }
+}
+
+SampleCache* SampleCache::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+bool SampleCache::acquire(size_t sound, size_t bytes, double duration)
+{
+    assert( sound < m_entries.size() );
+    Entry& entry = m_entries[sound];
+
+    if (++m_numTriggers % m_options.agingPeriod == 0) {
+        age();
+    }
+    entry.triggers++;
+
+    if (entry.resident) {
+        // Move to the most recently used position.
+        lruRemove(sound);
+        lruAppend(sound);
+    } else {
+        entry.bytes = bytes;
+        if (entry.failed || !admit(sound, duration)) {
+            return false;
+        }
+    }
+
+    // Voices triggered while the sound is being decoded are played from
+    // disk.
+    switch (entry.state.load(std::memory_order_acquire)) {
+        case kLoaded:
+            entry.users.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        case kFailed:
+            evict(sound);
+            entry.failed = true;
+            return false;
+    }
+    return false;
+}
+
+void SampleCache::release(size_t sound)
+{
+    assert( sound < m_entries.size() );
+    assert( m_entries[sound].users.load(std::memory_order_relaxed) > 0 );
+    m_entries[sound].users.fetch_sub(1, std::memory_order_release);
+}
+
+bool SampleCache::admit(size_t sound, double duration)
+{
+    Entry& entry = m_entries[sound];
+
+    if (entry.bytes > m_options.memoryBudget
+        || (duration > m_options.shortSoundDuration && entry.triggers < m_options.hotTriggerCount)) {
+        return false;
+    }
+
+    // Collect eviction candidates in LRU order until there is enough room;
+    // sounds triggered more often than this one are kept.
+    size_t freed = 0;
+    m_victims.clear();
+    for (size_t i = m_lruHead;
+         i != kNone && m_residentBytes - freed + entry.bytes > m_options.memoryBudget;
+         i = m_entries[i].lruNext) {
+        const Entry& other = m_entries[i];
+        if (other.triggers <= entry.triggers && isEvictable(other)) {
+            m_victims.push_back(i);
+            freed += other.bytes;
+        }
+    }
+
+    if (m_residentBytes - freed + entry.bytes > m_options.memoryBudget) {
+        return false;
+    }
+
+    for (auto victim : m_victims) {
+        evict(victim);
+    }
+
+    entry.resident = true;
+    entry.state.store(kLoading, std::memory_order_relaxed);
+    lruAppend(sound);
+    m_residentBytes += entry.bytes;
+    schedule({ sound, nullptr });
+
+    return true;
+}
+
+// Sounds can be evicted once they have been decoded and no voice plays
+// them anymore; the releasing voice was the last one to read the samples.
+bool SampleCache::isEvictable(const Entry& entry) const
+{
+    return entry.state.load(std::memory_order_acquire) != kLoading
+        && entry.users.load(std::memory_order_acquire) == 0;
+}
+
+void SampleCache::evict(size_t sound)
+{
+    Entry& entry = m_entries[sound];
+    assert( entry.resident && isEvictable(entry) );
+    lruRemove(sound);
+    entry.resident = false;
+    entry.state.store(kAbsent, std::memory_order_relaxed);
+    m_residentBytes -= entry.bytes;
+    const CachedSound* data = entry.data.exchange(nullptr, std::memory_order_relaxed);
+    if (data != nullptr) {
+        schedule({ sound, data });
+    }
+}
+
+void SampleCache::age()
+{
+    for (auto& entry : m_entries) {
+        entry.triggers /= 2;
+    }
+}
+
+void SampleCache::lruRemove(size_t sound)
+{
+    Entry& entry = m_entries[sound];
+    if (entry.lruPrev == kNone) {
+        m_lruHead = entry.lruNext;
+    } else {
+        m_entries[entry.lruPrev].lruNext = entry.lruNext;
+    }
+    if (entry.lruNext == kNone) {
+        m_lruTail = entry.lruPrev;
+    } else {
+        m_entries[entry.lruNext].lruPrev = entry.lruPrev;
+    }
+    entry.lruPrev = entry.lruNext = kNone;
+}
+
+void SampleCache::lruAppend(size_t sound)
+{
+    Entry& entry = m_entries[sound];
+    entry.lruPrev = m_lruTail;
+    entry.lruNext = kNone;
+    if (m_lruTail == kNone) {
+        m_lruHead = sound;
+    } else {
+        m_entries[m_lruTail].lruNext = sound;
+    }
+    m_lruTail = sound;
+}
+
+void SampleCache::schedule(const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        assert( m_jobs.size() < m_jobs.capacity() );
+        m_jobs.push_back(job);
+    }
+    m_jobCondition.notify_one();
+}
+
+void SampleCache::process()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_jobMutex);
+            m_jobCondition.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+            if (m_quit) {
+                break;
+            }
+            m_runningJobs.swap(m_jobs);
+        }
+        for (const auto& job : m_runningJobs) {
+            if (job.garbage != nullptr) {
+                delete job.garbage;
+            } else {
+                Entry& entry = m_entries[job.sound];
+                const CachedSound* data = load(job.sound);
+                entry.data.store(data, std::memory_order_release);
+                entry.state.store(data == nullptr ? kFailed : kLoaded, std::memory_order_release);
+            }
+        }
+        m_runningJobs.clear();
+    }
+}
+
+const CachedSound* SampleCache::load(size_t sound)
+{
+    Methcla_SoundFile* file;
+    Methcla_SoundFileInfo info;
+    if (m_openFile(sound, &file, &info) != kMethcla_NoError) {
+        std::cerr << "SampleCache: couldn't open sound " << sound << std::endl;
+        return nullptr;
+    }
+
+    CachedSound* result = new CachedSound;
+    result->channels = info.channels;
+    result->samples.resize(size_t(info.frames) * info.channels);
+    size_t numFrames = 0;
+    while (numFrames < size_t(info.frames)) {
+        size_t numRead = 0;
+        file->read_float(file, result->samples.data() + numFrames * info.channels, size_t(info.frames) - numFrames, &numRead);
+        if (numRead == 0) {
+            break;
+        }
+        numFrames += numRead;
+    }
+    file->close(file);
+    result->frames = int64_t(numFrames);
+
+    if (info.channels == 0 || numFrames == 0) {
+        delete result;
+        return nullptr;
+    }
+    return result;
+}
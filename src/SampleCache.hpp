@@ -0,0 +1,184 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SAMPLECACHE_HPP_INCLUDED
+#define SAMPLECACHE_HPP_INCLUDED
+
+#include <methcla/file.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Decoded samples of a sound held by the sample cache.
+struct CachedSound
+{
+    unsigned int        channels;
+    int64_t             frames;
+    // Interleaved samples.
+    std::vector<float>  samples;
+};
+
+// Holds decoded sounds in memory within a fixed budget and decides per
+// voice whether a sound is played from memory or streamed from disk.
+//
+// Sounds become resident in the cache when they are short or have been
+// triggered often; the decoded sizes of all resident sounds are kept
+// within the budget by evicting the least recently used resident sounds
+// that have been triggered less often than the sound being admitted and
+// that no voice is playing. Admitted sounds are decoded on a background
+// thread, which also frees the samples of evicted sounds; voices play a
+// sound from memory once it has been decoded. All voices of a sound share
+// its samples.
+//
+// acquire() is meant to be called from the thread starting voices and
+// neither allocates nor blocks on decoding; voices look up and release
+// sounds lock-free from the audio thread.
+class SampleCache
+{
+public:
+    struct Options
+    {
+        Options();
+
+        // Memory budget in bytes for decoded samples.
+        size_t memoryBudget;
+        // Sounds up to this duration in seconds are admitted on first use.
+        double shortSoundDuration;
+        // Longer sounds are admitted after this many triggers.
+        size_t hotTriggerCount;
+        // Trigger counts are halved every agingPeriod triggers, so that
+        // sounds that aren't used anymore eventually lose their status.
+        size_t agingPeriod;
+    };
+
+    // Opens the file voices of sound index play.
+    typedef std::function<Methcla_Error(size_t sound, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)> OpenFunction;
+
+    SampleCache(const Options& options, size_t numSounds, OpenFunction openFile);
+    ~SampleCache();
+
+    SampleCache(const SampleCache& other) = delete;
+    SampleCache& operator=(const SampleCache& other) = delete;
+
+    // The cache used by the cached sampler plugin, if any.
+    static SampleCache* instance();
+
+    // Register a trigger of sound, whose decoded samples occupy bytes and
+    // last duration seconds. Return true if the voice should play the
+    // sound from memory, in which case the voice must call release() once
+    // it doesn't read the samples anymore; the sound isn't evicted before.
+    bool acquire(size_t sound, size_t bytes, double duration);
+
+    // Decoded samples of a sound acquired for a voice. Lock-free.
+    const CachedSound* sound(size_t sound) const
+    {
+        return sound < m_entries.size() ? m_entries[sound].data.load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Release a voice of sound acquired before. Lock-free.
+    void release(size_t sound);
+
+    // Sum of the decoded sizes of resident sounds, including those still
+    // being decoded.
+    size_t residentBytes() const
+    {
+        return m_residentBytes;
+    }
+
+private:
+    enum State
+    {
+        kAbsent,
+        kLoading,
+        kLoaded,
+        kFailed
+    };
+
+    static const size_t kNone = size_t(-1);
+
+    struct Entry
+    {
+        Entry()
+            : triggers(0)
+            , bytes(0)
+            , resident(false)
+            , failed(false)
+            , lruPrev(kNone)
+            , lruNext(kNone)
+            , state(kAbsent)
+            , data(nullptr)
+            , users(0)
+        { }
+
+        size_t triggers;
+        size_t bytes;
+        bool resident;
+        // Decoding failed; the sound isn't admitted again.
+        bool failed;
+        // Neighbours in the LRU list when resident.
+        size_t lruPrev;
+        size_t lruNext;
+        // Written by the loader thread while kLoading.
+        std::atomic<int> state;
+        std::atomic<const CachedSound*> data;
+        // Voices playing the sound from memory.
+        std::atomic<size_t> users;
+    };
+
+    // Decode a sound or free the samples of an evicted one.
+    struct Job
+    {
+        size_t              sound;
+        const CachedSound*  garbage;
+    };
+
+    bool admit(size_t sound, double duration);
+    bool isEvictable(const Entry& entry) const;
+    void evict(size_t sound);
+    void age();
+    void lruRemove(size_t sound);
+    void lruAppend(size_t sound);
+    void schedule(const Job& job);
+    void process();
+    const CachedSound* load(size_t sound);
+
+private:
+    Options                     m_options;
+    OpenFunction                m_openFile;
+    std::vector<Entry>          m_entries;
+    // Resident sounds, least recently used first.
+    size_t                      m_lruHead;
+    size_t                      m_lruTail;
+    // Scratch space for admit().
+    std::vector<size_t>         m_victims;
+    size_t                      m_residentBytes;
+    size_t                      m_numTriggers;
+    // Jobs for the loader thread; each sound has at most one pending
+    // decode and one pending free, so the queues never grow beyond their
+    // initial capacity.
+    std::mutex                  m_jobMutex;
+    std::condition_variable     m_jobCondition;
+    std::vector<Job>            m_jobs;
+    std::vector<Job>            m_runningJobs;
+    bool                        m_quit;
+    std::thread                 m_thread;
+};
+
+#endif // SAMPLECACHE_HPP_INCLUDED
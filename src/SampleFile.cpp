@@ -0,0 +1,277 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SampleFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[8] = { 'M', 'S', 'A', 'M', 'P', 'L', 'E', 'S' };
+static const uint32_t kVersion = 1;
+// Written in native byte order; containers from machines with a different
+// byte order are rejected.
+static const uint32_t kByteOrderMark = 0x01020304;
+static const size_t kBlockFrames = 4096;
+
+struct SampleFile::Header
+{
+    char        magic[8];
+    uint32_t    byteOrder;
+    uint32_t    version;
+    uint32_t    layout;
+    uint32_t    channels;
+    uint32_t    sampleRate;
+    uint32_t    reserved;
+    int64_t     frames;
+    int64_t     loopStart;
+    int64_t     loopEnd;
+    // Offset of the samples from the start of the file in bytes.
+    uint64_t    dataOffset;
+    // Distance in samples between the first samples of adjacent channels
+    // and between adjacent frames of a channel.
+    uint64_t    channelStride;
+    uint64_t    frameStride;
+};
+
+const size_t SampleFile::kAlignment;
+
+static size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Size in bytes of the sample data in a container.
+static size_t sampleDataSize(uint32_t channels, int64_t frames, uint64_t channelStride, uint64_t frameStride)
+{
+    if (channels == 0 || frames == 0) {
+        return 0;
+    }
+    return size_t((channels - 1) * channelStride + (frames - 1) * frameStride + 1) * sizeof(float);
+}
+
+void SampleFile::write(const std::string& path, Methcla_SoundFile* source, const Methcla_SoundFileInfo& info, Layout layout, int64_t loopStart, int64_t loopEnd)
+{
+    const size_t channels = info.channels;
+    if (channels == 0) {
+        throw std::runtime_error("Sound " + path + " has no channels");
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::copy(kMagic, kMagic + sizeof(kMagic), header.magic);
+    header.byteOrder = kByteOrderMark;
+    header.version = kVersion;
+    header.layout = layout;
+    header.channels = info.channels;
+    header.sampleRate = info.samplerate;
+    header.dataOffset = kAlignment;
+    if (layout == kPlanar) {
+        header.channelStride = alignUp(size_t(info.frames), kAlignment / sizeof(float));
+        header.frameStride = 1;
+    } else {
+        header.channelStride = 1;
+        header.frameStride = channels;
+    }
+
+    // Write to a temporary file and rename it, so that readers never see
+    // a partial container.
+    const std::string tmpPath = path + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Couldn't create sample file " + tmpPath);
+    }
+
+    std::vector<float> block(kBlockFrames * channels);
+    std::vector<float> planar(kBlockFrames);
+    int64_t numFrames = 0;
+    bool success = true;
+    while (success && numFrames < info.frames) {
+        size_t numRead = 0;
+        if (source->read_float(source, block.data(), std::min<size_t>(kBlockFrames, size_t(info.frames - numFrames)), &numRead) != kMethcla_NoError) {
+            success = false;
+            break;
+        }
+        if (numRead == 0) {
+            break;
+        }
+        if (layout == kPlanar) {
+            for (size_t c=0; success && c < channels; c++) {
+                for (size_t i=0; i < numRead; i++) {
+                    planar[i] = block[i * channels + c];
+                }
+                const long offset = long(header.dataOffset + (c * header.channelStride + size_t(numFrames)) * sizeof(float));
+                success = std::fseek(file, offset, SEEK_SET) == 0
+                       && std::fwrite(planar.data(), sizeof(float), numRead, file) == numRead;
+            }
+        } else {
+            const long offset = long(header.dataOffset + size_t(numFrames) * channels * sizeof(float));
+            success = std::fseek(file, offset, SEEK_SET) == 0
+                   && std::fwrite(block.data(), sizeof(float), numRead * channels, file) == numRead * channels;
+        }
+        numFrames += numRead;
+    }
+    // A container that is cut short would play truncated on every run.
+    success = success && numFrames == info.frames;
+
+    header.frames = numFrames;
+    header.loopEnd = loopEnd > 0 ? std::min(loopEnd, numFrames) : numFrames;
+    header.loopStart = std::min(std::max<int64_t>(loopStart, 0), header.loopEnd);
+
+    // The header is padded to the start of the samples.
+    std::vector<char> headerPage(kAlignment, 0);
+    std::memcpy(headerPage.data(), &header, sizeof(header));
+    success = success
+           && std::fseek(file, 0, SEEK_SET) == 0
+           && std::fwrite(headerPage.data(), 1, headerPage.size(), file) == headerPage.size();
+
+    if (std::fclose(file) != 0 || !success || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Couldn't write sample file " + path);
+    }
+}
+
+std::unique_ptr<SampleFile> SampleFile::open(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+        mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+        } else {
+            mappingSize = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+
+    const Header& header = *static_cast<const Header*>(mapping);
+    const bool valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+        && header.byteOrder == kByteOrderMark
+        && header.version == kVersion
+        && (header.layout == kInterleaved || header.layout == kPlanar)
+        && header.channels > 0
+        && header.frames >= 0
+        && header.loopStart >= 0 && header.loopStart <= header.loopEnd && header.loopEnd <= header.frames
+        && header.dataOffset % kAlignment == 0
+        && header.dataOffset <= mappingSize
+        && header.channelStride <= mappingSize && header.frameStride <= mappingSize
+        && uint64_t(header.frames) <= mappingSize
+        && sampleDataSize(header.channels, header.frames, header.channelStride, header.frameStride) <= mappingSize - header.dataOffset;
+    if (!valid) {
+        munmap(mapping, mappingSize);
+        return nullptr;
+    }
+
+    return std::unique_ptr<SampleFile>(new SampleFile(mapping, mappingSize, header));
+}
+
+SampleFile::SampleFile(void* mapping, size_t mappingSize, const Header& header)
+    : m_mapping(mapping)
+    , m_mappingSize(mappingSize)
+    , m_samples(reinterpret_cast<const float*>(static_cast<const char*>(mapping) + header.dataOffset))
+    , m_dataSize(sampleDataSize(header.channels, header.frames, header.channelStride, header.frameStride))
+    , m_layout(Layout(header.layout))
+    , m_channels(header.channels)
+    , m_sampleRate(header.sampleRate)
+    , m_frames(header.frames)
+    , m_loopStart(header.loopStart)
+    , m_loopEnd(header.loopEnd)
+    , m_channelStride(header.channelStride)
+    , m_frameStride(header.frameStride)
+{
+}
+
+SampleFile::~SampleFile()
+{
+    munmap(m_mapping, m_mappingSize);
+}
+
+static size_t pageSize()
+{
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+template <class F> void SampleFile::forEachRange(int64_t startFrame, int64_t endFrame, F f) const
+{
+    startFrame = std::max<int64_t>(startFrame, 0);
+    endFrame = std::min(endFrame, m_frames);
+    if (startFrame >= endFrame) {
+        return;
+    }
+
+    const uintptr_t mapBegin = reinterpret_cast<uintptr_t>(m_mapping);
+    const uintptr_t mapEnd = mapBegin + m_mappingSize;
+    const uintptr_t pageMask = ~uintptr_t(pageSize() - 1);
+    // Interleaved channels share a single range.
+    const unsigned int numRanges = m_layout == kPlanar ? m_channels : 1;
+    for (unsigned int c=0; c < numRanges; c++) {
+        const float* first = channel(c) + size_t(startFrame) * m_frameStride;
+        const float* last = channel(c) + size_t(endFrame - 1) * m_frameStride + (m_layout == kPlanar ? 1 : m_channels);
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(first) & pageMask;
+        const uintptr_t end = std::min(mapEnd, (reinterpret_cast<uintptr_t>(last) + pageSize() - 1) & pageMask);
+        f(reinterpret_cast<void*>(begin), size_t(end - begin));
+    }
+}
+
+size_t SampleFile::prefault(int64_t startFrame, int64_t endFrame) const
+{
+    size_t numFaulted = 0;
+    std::vector<unsigned char> residency;
+    forEachRange(startFrame, endFrame, [&](void* begin, size_t size) {
+        const size_t numPages = size / pageSize();
+        residency.assign(numPages, 0);
+#if defined(__APPLE__)
+        const int result = mincore(begin, size, reinterpret_cast<char*>(residency.data()));
+#else
+        const int result = mincore(begin, size, residency.data());
+#endif
+        posix_madvise(begin, size, POSIX_MADV_WILLNEED);
+        const volatile char* pages = static_cast<const volatile char*>(begin);
+        for (size_t i=0; i < numPages; i++) {
+            (void)pages[i * pageSize()];
+            if (result == 0 && (residency[i] & 1) == 0) {
+                numFaulted++;
+            }
+        }
+    });
+    return numFaulted;
+}
+
+bool SampleFile::lock(int64_t startFrame, int64_t endFrame) const
+{
+    bool success = true;
+    forEachRange(startFrame, endFrame, [&](void* begin, size_t size) {
+        success = mlock(begin, size) == 0 && success;
+    });
+    return success;
+}
@@ -0,0 +1,121 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SAMPLEFILE_HPP_INCLUDED
+#define SAMPLEFILE_HPP_INCLUDED
+
+#include <methcla/file.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Pre-decoded sample container that is played straight from a read-only
+// memory mapping.
+//
+// A container starts with a header holding the number of frames, the
+// sample rate, the number of channels, the loop points and the sample
+// layout, followed by the samples as 32 bit floats in native byte order.
+// The samples start at a multiple of kAlignment bytes, which is a
+// multiple of the page size of all supported platforms; in the planar
+// layout every channel starts at such a boundary. Containers are meant to
+// be written on the machine that plays them.
+class SampleFile
+{
+public:
+    enum Layout
+    {
+        // Channels of a frame are adjacent.
+        kInterleaved,
+        // Frames of a channel are adjacent.
+        kPlanar
+    };
+
+    static const size_t kAlignment = 16384;
+
+    // Write the container at path with the frames read from source, which
+    // has the given info. The loop points are frame positions; loopEnd
+    // zero means the end of the sound. Writes to a temporary file that is
+    // renamed to path when complete. Throws std::runtime_error on errors.
+    static void write(const std::string& path, Methcla_SoundFile* source, const Methcla_SoundFileInfo& info, Layout layout, int64_t loopStart=0, int64_t loopEnd=0);
+
+    // Map the container at path. Returns nullptr if the file can't be
+    // opened or isn't a valid container.
+    static std::unique_ptr<SampleFile> open(const std::string& path);
+
+    ~SampleFile();
+
+    SampleFile(const SampleFile& other) = delete;
+    SampleFile& operator=(const SampleFile& other) = delete;
+
+    Layout layout() const { return m_layout; }
+    unsigned int channels() const { return m_channels; }
+    unsigned int sampleRate() const { return m_sampleRate; }
+    int64_t frames() const { return m_frames; }
+
+    // Loop points; looping voices wrap around to loopStart when they reach
+    // loopEnd.
+    int64_t loopStart() const { return m_loopStart; }
+    int64_t loopEnd() const { return m_loopEnd; }
+
+    // Samples of channel; consecutive frames are frameStride() samples
+    // apart.
+    const float* channel(unsigned int channel) const
+    {
+        return m_samples + channel * m_channelStride;
+    }
+
+    size_t frameStride() const { return m_frameStride; }
+
+    // Mapped sample data.
+    const void* data() const { return m_samples; }
+    size_t dataSize() const { return m_dataSize; }
+
+    // Advise the system that frames startFrame to endFrame of all
+    // channels are needed soon and read one byte from each of their pages,
+    // so that the audio thread doesn't fault when reading them. Blocks
+    // until pages that aren't resident have been read from disk. Returns
+    // the number of pages that weren't resident before.
+    size_t prefault(int64_t startFrame, int64_t endFrame) const;
+
+    // Lock frames startFrame to endFrame of all channels into memory.
+    // Returns false if locking failed, e.g. because of the process's
+    // locked memory limit.
+    bool lock(int64_t startFrame, int64_t endFrame) const;
+
+private:
+    struct Header;
+
+    SampleFile(void* mapping, size_t mappingSize, const Header& header);
+
+    // Call f(begin, size) for the page aligned byte ranges holding frames
+    // startFrame to endFrame.
+    template <class F> void forEachRange(int64_t startFrame, int64_t endFrame, F f) const;
+
+private:
+    void*           m_mapping;
+    size_t          m_mappingSize;
+    const float*    m_samples;
+    size_t          m_dataSize;
+    Layout          m_layout;
+    unsigned int    m_channels;
+    unsigned int    m_sampleRate;
+    int64_t         m_frames;
+    int64_t         m_loopStart;
+    int64_t         m_loopEnd;
+    size_t          m_channelStride;
+    size_t          m_frameStride;
+};
+
+#endif // SAMPLEFILE_HPP_INCLUDED
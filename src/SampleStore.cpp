@@ -0,0 +1,72 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SampleStore.hpp"
+#include "CacheFiles.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+// Changes whenever ingesting produces different containers.
+static const uint32_t kStoreVersion = 1;
+
+SampleStore::SampleStore(const std::string& dir, SampleFile::Layout layout, OpenFunction openFile)
+    : m_dir(dir)
+    , m_layout(layout)
+    , m_openFile(openFile)
+{
+    createCacheDir(m_dir);
+}
+
+std::unique_ptr<SampleFile> SampleStore::ingest(const std::string& path, const FileStamp& stamp, const std::string& sourcePath, const Methcla_SoundFileInfo& sourceInfo, std::string& outPath)
+{
+    outPath = CacheKey()
+        .add(path)
+        .add(stamp.size)
+        .add(stamp.mtime)
+        .add(uint64_t(sourceInfo.samplerate))
+        .add(uint32_t(m_layout))
+        .add(kStoreVersion)
+        .path(m_dir, ".samples");
+
+    std::unique_ptr<SampleFile> sampleFile = SampleFile::open(outPath);
+    if (sampleFile) {
+        return sampleFile;
+    }
+
+    Methcla_SoundFile* file;
+    Methcla_SoundFileInfo fileInfo;
+    if (m_openFile(sourcePath.c_str(), &file, &fileInfo) != kMethcla_NoError) {
+        std::cerr << "Opening sound file " << sourcePath << " for ingesting failed" << std::endl;
+        return nullptr;
+    }
+
+    try {
+        SampleFile::write(outPath, file, fileInfo, m_layout);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    file->close(file);
+
+    sampleFile = SampleFile::open(outPath);
+    if (!sampleFile) {
+        std::cerr << "Mapping sample file " << outPath << " failed" << std::endl;
+    }
+    return sampleFile;
+}
+
+void SampleStore::removeUnused(std::vector<std::string> usedPaths)
+{
+    removeUnusedCacheFiles(m_dir, std::move(usedPaths));
+}
@@ -0,0 +1,60 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SAMPLESTORE_HPP_INCLUDED
+#define SAMPLESTORE_HPP_INCLUDED
+
+#include "SampleFile.hpp"
+#include "SoundIndex.hpp"
+
+#include <methcla/file.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Directory of sounds decoded into sample containers (see SampleFile).
+//
+// Containers are named after a hash of the sound's path, its file stamp,
+// the sample rate of the decoded file and the layout, so that a changed
+// sound is decoded anew and an existing container is reused by mapping it.
+class SampleStore
+{
+public:
+    typedef std::function<Methcla_Error(const char* path, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)> OpenFunction;
+
+    // Create the store directory dir if it doesn't exist. Sounds are
+    // opened with openFile.
+    SampleStore(const std::string& dir, SampleFile::Layout layout, OpenFunction openFile);
+
+    SampleStore(const SampleStore& other) = delete;
+    SampleStore& operator=(const SampleStore& other) = delete;
+
+    // Return the mapped container of the sound at path with the given
+    // stamp, decoding sourcePath, the file voices would play otherwise,
+    // with info sourceInfo unless a container exists. The container's
+    // path is returned in outPath. Returns nullptr if decoding or mapping
+    // failed. Different sounds can be ingested concurrently.
+    std::unique_ptr<SampleFile> ingest(const std::string& path, const FileStamp& stamp, const std::string& sourcePath, const Methcla_SoundFileInfo& sourceInfo, std::string& outPath);
+
+    // Remove all files from the store directory except for usedPaths.
+    void removeUnused(std::vector<std::string> usedPaths);
+
+private:
+    std::string         m_dir;
+    SampleFile::Layout  m_layout;
+    OpenFunction        m_openFile;
+};
+
+#endif // SAMPLESTORE_HPP_INCLUDED
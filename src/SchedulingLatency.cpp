@@ -0,0 +1,147 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SchedulingLatency.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+static std::atomic<SchedulingLatency*> gInstance(nullptr);
+
+// Fraction of the distance to a lower target the lookahead decays by per
+// update.
+static const double kDecay = 0.1;
+
+SchedulingLatency::Options::Options()
+    : adaptive(false)
+    , latency(0.02)
+    , safetyMargin(0.002)
+    , percentile(0.99)
+    , minLatency(0.)
+    , maxLatency(0.1)
+    , window(256)
+    , probeInterval(0.05)
+{
+}
+
+SchedulingLatency::SchedulingLatency(const Options& options)
+    : m_options(options)
+    , m_latency(options.adaptive ? options.maxLatency : options.latency)
+    , m_nextToken(0)
+    , m_reportsWritten(0)
+    , m_reportsRead(0)
+    , m_delays(std::max<size_t>(options.window, 1))
+    , m_numDelays(0)
+    , m_stats({ 0, 0., 0., 0., 0. })
+{
+    m_scratch.reserve(m_delays.size());
+    for (auto& probe : m_sent) {
+        probe.token = -1;
+    }
+
+    SchedulingLatency* expected = nullptr;
+    if (!gInstance.compare_exchange_strong(expected, this)) {
+        std::cerr << "SchedulingLatency: another instance is already active" << std::endl;
+    }
+}
+
+SchedulingLatency::~SchedulingLatency()
+{
+    SchedulingLatency* expected = this;
+    gInstance.compare_exchange_strong(expected, nullptr);
+}
+
+SchedulingLatency* SchedulingLatency::instance()
+{
+    return gInstance.load(std::memory_order_acquire);
+}
+
+int32_t SchedulingLatency::beginProbe(Methcla_Time sendTime)
+{
+    const int32_t token = m_nextToken;
+    m_nextToken = (m_nextToken + 1) & 0x7fffffff;
+    m_sent[token % kMaxProbes] = { token, sendTime };
+    return token;
+}
+
+void SchedulingLatency::endProbe(int32_t token, Methcla_Time time)
+{
+    const size_t written = m_reportsWritten.load(std::memory_order_relaxed);
+    if (written - m_reportsRead.load(std::memory_order_acquire) < kMaxProbes) {
+        m_reports[written % kMaxProbes] = { token, time };
+        m_reportsWritten.store(written + 1, std::memory_order_release);
+    }
+}
+
+void SchedulingLatency::update()
+{
+    const size_t written = m_reportsWritten.load(std::memory_order_acquire);
+    size_t read = m_reportsRead.load(std::memory_order_relaxed);
+    if (read == written) {
+        return;
+    }
+
+    Methcla_Time latestDelay = 0.;
+    for (; read != written; read++) {
+        const Probe& report = m_reports[read % kMaxProbes];
+        const Probe& sent = m_sent[report.token % kMaxProbes];
+        // Ignore reports of probes whose slot has been reused.
+        if (report.token >= 0 && sent.token == report.token) {
+            const Methcla_Time delay = std::max(0., report.time - sent.time);
+            m_delays[m_numDelays % m_delays.size()] = delay;
+            m_numDelays++;
+            latestDelay = std::max(latestDelay, delay);
+        }
+    }
+    m_reportsRead.store(read, std::memory_order_release);
+
+    const size_t numSamples = std::min(m_numDelays, m_delays.size());
+    if (numSamples == 0) {
+        return;
+    }
+
+    m_scratch.assign(m_delays.begin(), m_delays.begin() + numSamples);
+    auto percentile = [this, numSamples](double p) {
+        auto nth = m_scratch.begin() + std::min(numSamples - 1, size_t(p * numSamples));
+        std::nth_element(m_scratch.begin(), nth, m_scratch.end());
+        return *nth;
+    };
+
+    Stats stats;
+    stats.numSamples = numSamples;
+    stats.p50 = percentile(0.5);
+    stats.p90 = percentile(0.9);
+    stats.p99 = percentile(0.99);
+    stats.max = *std::max_element(m_scratch.begin(), m_scratch.end());
+    const double target = percentile(m_options.percentile);
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats = stats;
+    }
+
+    if (m_options.adaptive) {
+        // Back off right away when a delay exceeds the lookahead, relax
+        // slowly otherwise.
+        const double required = std::max(target, latestDelay) + m_options.safetyMargin;
+        const double current = latency();
+        const double next = required >= current ? required : current + kDecay * (target + m_options.safetyMargin - current);
+        m_latency.store(std::min(m_options.maxLatency, std::max(m_options.minLatency, next)), std::memory_order_relaxed);
+    }
+}
+
+SchedulingLatency::Stats SchedulingLatency::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_stats;
+}
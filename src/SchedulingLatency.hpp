@@ -0,0 +1,128 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SCHEDULINGLATENCY_HPP_INCLUDED
+#define SCHEDULINGLATENCY_HPP_INCLUDED
+
+#include <methcla/common.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Lookahead with which timed requests are scheduled.
+//
+// In adaptive mode the engine periodically sends probe requests. The
+// latency probe plugin reports when each probe was processed by the audio
+// thread, and the lookahead is set to a high percentile of the observed
+// delays plus a safety margin. The lookahead rises immediately when
+// delays grow and decays slowly when they shrink.
+class SchedulingLatency
+{
+public:
+    struct Options
+    {
+        Options();
+
+        // Measure the lookahead instead of using a fixed one.
+        bool adaptive;
+        // Lookahead in seconds when not adaptive.
+        double latency;
+        // Seconds added to the measured delay percentile.
+        double safetyMargin;
+        // Percentile of the measured delays the lookahead is based on.
+        double percentile;
+        // Bounds for the adaptive lookahead in seconds; maxLatency is
+        // used until enough delays have been measured.
+        double minLatency;
+        double maxLatency;
+        // Number of most recent delays the percentiles are computed from.
+        size_t window;
+        // Interval in seconds between probe requests.
+        double probeInterval;
+    };
+
+    // Percentiles of recently measured delays in seconds.
+    struct Stats
+    {
+        size_t  numSamples;
+        double  p50;
+        double  p90;
+        double  p99;
+        double  max;
+    };
+
+    SchedulingLatency(const Options& options);
+    ~SchedulingLatency();
+
+    SchedulingLatency(const SchedulingLatency& other) = delete;
+    SchedulingLatency& operator=(const SchedulingLatency& other) = delete;
+
+    // The instance the latency probe plugin reports to, if any.
+    static SchedulingLatency* instance();
+
+    const Options& options() const
+    {
+        return m_options;
+    }
+
+    // Current lookahead in seconds. Lock-free.
+    Methcla_Time latency() const
+    {
+        return m_latency.load(std::memory_order_relaxed);
+    }
+
+    // Record that a probe is sent at engine time sendTime and return its
+    // token. Must be called from a single thread, the same as update().
+    int32_t beginProbe(Methcla_Time sendTime);
+
+    // Report that the probe with token was processed at engine time time.
+    // Called on the audio thread; lock-free.
+    void endProbe(int32_t token, Methcla_Time time);
+
+    // Collect reported probes and update the lookahead.
+    void update();
+
+    Stats stats() const;
+
+private:
+    struct Probe
+    {
+        int32_t         token;
+        Methcla_Time    time;
+    };
+
+    enum { kMaxProbes = 64 };
+
+    Options                 m_options;
+    std::atomic<double>     m_latency;
+    int32_t                 m_nextToken;
+    // Probes in flight, indexed by token.
+    Probe                   m_sent[kMaxProbes];
+    // Single producer, single consumer queue of reports from the audio
+    // thread.
+    Probe                   m_reports[kMaxProbes];
+    std::atomic<size_t>     m_reportsWritten;
+    std::atomic<size_t>     m_reportsRead;
+    // Ring buffer of measured delays.
+    std::vector<double>     m_delays;
+    size_t                  m_numDelays;
+    std::vector<double>     m_scratch;
+    mutable std::mutex      m_statsMutex;
+    Stats                   m_stats;
+};
+
+#endif // SCHEDULINGLATENCY_HPP_INCLUDED
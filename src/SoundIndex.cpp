@@ -0,0 +1,183 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "SoundIndex.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk layout, in native byte order:
+//
+//     Header
+//     FileEntry[numEntries]   sorted by path
+//     char[stringsSize]       NUL terminated paths
+//
+// The magic doubles as a byte order and format version check.
+
+static const char kMagic[8] = { 'M', 'S', 'N', 'D', 'I', 'D', 'X', '1' };
+
+struct SoundIndex::Header
+{
+    char        magic[8];
+    uint32_t    numEntries;
+    uint32_t    stringsSize;
+};
+
+struct SoundIndex::FileEntry
+{
+    uint64_t    size;
+    int64_t     mtime;
+    int64_t     frames;
+    uint32_t    channels;
+    uint32_t    samplerate;
+    uint32_t    pathOffset;
+    uint32_t    pathLength;
+};
+
+bool getFileStamp(const std::string& path, FileStamp& stamp)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp.size = st.st_size;
+#if defined(__APPLE__)
+    stamp.mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+SoundIndex::SoundIndex(const std::string& path)
+    : m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_entries(nullptr)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            m_data = data;
+            m_size = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (m_data != nullptr) {
+        const Header* header = static_cast<const Header*>(m_data);
+        const size_t expectedSize = sizeof(Header)
+                                  + header->numEntries * sizeof(FileEntry)
+                                  + header->stringsSize;
+        if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && expectedSize == m_size) {
+            m_header = header;
+            m_entries = reinterpret_cast<const FileEntry*>(header + 1);
+        }
+    }
+}
+
+SoundIndex::~SoundIndex()
+{
+    if (m_data != nullptr) {
+        munmap(m_data, m_size);
+    }
+}
+
+size_t SoundIndex::size() const
+{
+    return m_header == nullptr ? 0 : m_header->numEntries;
+}
+
+const char* SoundIndex::entryPath(const FileEntry& entry) const
+{
+    const char* strings = reinterpret_cast<const char*>(m_entries + m_header->numEntries);
+    if (entry.pathOffset + entry.pathLength >= m_header->stringsSize) {
+        return "";
+    }
+    return strings + entry.pathOffset;
+}
+
+bool SoundIndex::lookup(const std::string& path, const FileStamp& stamp, Methcla_SoundFileInfo& info) const
+{
+    const FileEntry* begin = m_entries;
+    const FileEntry* end = m_entries + size();
+    const FileEntry* it = std::lower_bound(begin, end, path, [this](const FileEntry& entry, const std::string& key) {
+        return std::strcmp(entryPath(entry), key.c_str()) < 0;
+    });
+    if (it == end || path != entryPath(*it)
+        || it->size != stamp.size || it->mtime != stamp.mtime) {
+        return false;
+    }
+    info.frames = it->frames;
+    info.channels = it->channels;
+    info.samplerate = it->samplerate;
+    return true;
+}
+
+void SoundIndex::write(const std::string& path, std::vector<Entry> entries)
+{
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return std::strcmp(a.path.c_str(), b.path.c_str()) < 0;
+    });
+
+    std::vector<FileEntry> fileEntries;
+    fileEntries.reserve(entries.size());
+    std::string strings;
+    for (const auto& entry : entries) {
+        FileEntry fileEntry;
+        fileEntry.size = entry.stamp.size;
+        fileEntry.mtime = entry.stamp.mtime;
+        fileEntry.frames = entry.info.frames;
+        fileEntry.channels = entry.info.channels;
+        fileEntry.samplerate = entry.info.samplerate;
+        fileEntry.pathOffset = strings.size();
+        fileEntry.pathLength = entry.path.size();
+        fileEntries.push_back(fileEntry);
+        strings.append(entry.path.c_str(), entry.path.size() + 1);
+    }
+
+    Header header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.numEntries = fileEntries.size();
+    header.stringsSize = strings.size();
+
+    // Write to a temporary file and rename it over the index, so that
+    // concurrent readers never see a partially written index.
+    const std::string tmpPath = path + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Couldn't create sound index " + tmpPath);
+    }
+    const bool success =
+           std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(fileEntries.data(), sizeof(FileEntry), fileEntries.size(), file) == fileEntries.size()
+        && std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    if (std::fclose(file) != 0 || !success || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Couldn't write sound index " + path);
+    }
+}
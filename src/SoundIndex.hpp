@@ -0,0 +1,84 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SOUNDINDEX_HPP_INCLUDED
+#define SOUNDINDEX_HPP_INCLUDED
+
+#include <methcla/file.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Size and modification time of a file, used for detecting changes.
+struct FileStamp
+{
+    uint64_t size;
+    int64_t  mtime; // Nanoseconds since the epoch
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+// Return false if path can't be stat'ed.
+bool getFileStamp(const std::string& path, FileStamp& stamp);
+
+// Persistent index of sound file metadata.
+//
+// The index file is memory mapped read-only; lookups are a binary search
+// over fixed size entries sorted by path, so opening an index costs a
+// single mmap regardless of the number of sounds.
+class SoundIndex
+{
+public:
+    struct Entry
+    {
+        std::string             path;
+        FileStamp               stamp;
+        Methcla_SoundFileInfo   info;
+    };
+
+    // Map the index at path. An index that doesn't exist or is invalid is
+    // treated as empty.
+    SoundIndex(const std::string& path);
+    ~SoundIndex();
+
+    SoundIndex(const SoundIndex& other) = delete;
+    SoundIndex& operator=(const SoundIndex& other) = delete;
+
+    // Number of entries in the index.
+    size_t size() const;
+
+    // Look up the sound file info for path. Returns false if path isn't
+    // in the index or if the stored stamp doesn't match.
+    bool lookup(const std::string& path, const FileStamp& stamp, Methcla_SoundFileInfo& info) const;
+
+    // Atomically replace the index at path with entries.
+    static void write(const std::string& path, std::vector<Entry> entries);
+
+private:
+    struct Header;
+    struct FileEntry;
+
+    const char* entryPath(const FileEntry& entry) const;
+
+private:
+    void*               m_data;
+    size_t              m_size;
+    const Header*       m_header;
+    const FileEntry*    m_entries;
+};
+
+#endif // SOUNDINDEX_HPP_INCLUDED
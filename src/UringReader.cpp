@@ -0,0 +1,242 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "UringReader.hpp"
+
+#include <stdexcept>
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// liburing isn't required; the few system calls needed are made directly.
+
+static int uringSetup(unsigned int entries, io_uring_params* params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int uringRegister(int fd, unsigned int opcode, void* arg, unsigned int numArgs)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, numArgs));
+}
+
+template <typename T> static T* ringPointer(void* ring, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+// The ring indices are shared with the kernel.
+static inline unsigned loadAcquire(const unsigned* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void storeRelease(unsigned* p, unsigned x)
+{
+    __atomic_store_n(p, x, __ATOMIC_RELEASE);
+}
+
+// Return true if the kernel supports IORING_OP_READ.
+static bool supportsRead(int fd)
+{
+    std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (uringRegister(fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        return false;
+    }
+    return IORING_OP_READ <= probe->last_op
+        && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+}
+
+UringReader::UringReader(unsigned int queueDepth)
+    : m_fd(-1)
+    , m_queueDepth(0)
+    , m_numQueued(0)
+    , m_numInFlight(0)
+    , m_sqRing(MAP_FAILED)
+    , m_sqRingSize(0)
+    , m_cqRing(MAP_FAILED)
+    , m_cqRingSize(0)
+    , m_sqes(MAP_FAILED)
+    , m_sqesSize(0)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_fd = uringSetup(queueDepth, &params);
+    if (m_fd < 0) {
+        throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+    }
+    if (!supportsRead(m_fd)) {
+        close(m_fd);
+        throw std::runtime_error("io_uring doesn't support IORING_OP_READ");
+    }
+
+    // The completion queue is at least as large as the submission queue,
+    // so limiting the reads in flight to the latter can't overflow it.
+    m_queueDepth = params.sq_entries;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing != MAP_FAILED) {
+        m_cqRing = singleMap ? m_sqRing
+                             : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    if (m_cqRing != MAP_FAILED) {
+        m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    }
+    if (m_sqes == MAP_FAILED) {
+        const int error = errno;
+        release();
+        throw std::runtime_error(std::string("Mapping io_uring queues failed: ") + std::strerror(error));
+    }
+
+    m_sqHead = ringPointer<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = ringPointer<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqMask = *ringPointer<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = ringPointer<unsigned>(m_sqRing, params.sq_off.array);
+    m_cqHead = ringPointer<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = ringPointer<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = *ringPointer<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = ringPointer<void>(m_cqRing, params.cq_off.cqes);
+}
+
+UringReader::~UringReader()
+{
+    release();
+}
+
+void UringReader::release()
+{
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != MAP_FAILED) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_sqes = m_cqRing = m_sqRing = MAP_FAILED;
+    m_fd = -1;
+}
+
+bool UringReader::prepareRead(int fd, void* buffer, size_t size, uint64_t offset, uint64_t userData)
+{
+    if (numPending() >= m_queueDepth) {
+        return false;
+    }
+
+    // Only this thread advances the tail.
+    const unsigned tail = *m_sqTail;
+    const unsigned index = tail & m_sqMask;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+    sqe->len = unsigned(size);
+    sqe->user_data = userData;
+    m_sqArray[index] = index;
+    storeRelease(m_sqTail, tail + 1);
+
+    m_numQueued++;
+    return true;
+}
+
+void UringReader::submit(bool wait)
+{
+    if (m_numQueued == 0 && (!wait || m_numInFlight == 0)) {
+        return;
+    }
+    const unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        const int result = uringEnter(m_fd, unsigned(m_numQueued), wait ? 1 : 0, flags);
+        if (result >= 0) {
+            m_numQueued -= size_t(result);
+            m_numInFlight += size_t(result);
+            break;
+        }
+        if (errno != EINTR) {
+            // EAGAIN and EBUSY are transient; the reads stay queued and
+            // are submitted with the next call.
+            break;
+        }
+    }
+}
+
+bool UringReader::complete(uint64_t& userData, int& result)
+{
+    const unsigned head = *m_cqHead;
+    if (head == loadAcquire(m_cqTail)) {
+        return false;
+    }
+    const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(m_cqes) + (head & m_cqMask);
+    userData = cqe->user_data;
+    result = cqe->res;
+    storeRelease(m_cqHead, head + 1);
+    m_numInFlight--;
+    return true;
+}
+
+#else
+
+UringReader::UringReader(unsigned int)
+{
+    throw std::runtime_error("io_uring is only available on Linux");
+}
+
+UringReader::~UringReader()
+{
+}
+
+bool UringReader::prepareRead(int, void*, size_t, uint64_t, uint64_t)
+{
+    return false;
+}
+
+void UringReader::submit(bool)
+{
+}
+
+bool UringReader::complete(uint64_t&, int&)
+{
+    return false;
+}
+
+#endif
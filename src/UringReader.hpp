@@ -0,0 +1,89 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef URINGREADER_HPP_INCLUDED
+#define URINGREADER_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+// Batched asynchronous file reads through io_uring on Linux.
+//
+// Reads are queued with prepareRead() and handed to the kernel together
+// by submit(), so that a single system call keeps many requests in flight
+// and the device can serve them in its preferred order. Completions are
+// collected with complete(). Not thread-safe; meant to be owned by a
+// single I/O thread.
+class UringReader
+{
+public:
+    // Set up a ring for queueDepth reads in flight. Throws
+    // std::runtime_error if io_uring isn't available, e.g. on other
+    // platforms, on kernels before 5.6 or when it is disabled by a
+    // seccomp policy.
+    explicit UringReader(unsigned int queueDepth);
+    ~UringReader();
+
+    UringReader(const UringReader& other) = delete;
+    UringReader& operator=(const UringReader& other) = delete;
+
+    // Queue a read of size bytes at offset of fd into buffer, which must
+    // stay valid until the read has completed. Returns false if queueDepth
+    // reads are queued or in flight already.
+    bool prepareRead(int fd, void* buffer, size_t size, uint64_t offset, uint64_t userData);
+
+    // Submit all queued reads. If wait is true, block until at least one
+    // read has completed.
+    void submit(bool wait);
+
+    // Collect a completed read. Returns false if there is none, otherwise
+    // userData of the read and its result, the number of bytes read or a
+    // negative errno value.
+    bool complete(uint64_t& userData, int& result);
+
+    // Number of reads queued or in flight whose completion hasn't been
+    // collected.
+    size_t numPending() const
+    {
+        return m_numQueued + m_numInFlight;
+    }
+
+private:
+    // Unmap the queues and close the ring.
+    void release();
+
+private:
+    int             m_fd;
+    unsigned int    m_queueDepth;
+    size_t          m_numQueued;
+    size_t          m_numInFlight;
+
+    void*           m_sqRing;
+    size_t          m_sqRingSize;
+    void*           m_cqRing;
+    size_t          m_cqRingSize;
+    void*           m_sqes;
+    size_t          m_sqesSize;
+
+    unsigned*       m_sqHead;
+    unsigned*       m_sqTail;
+    unsigned        m_sqMask;
+    unsigned*       m_sqArray;
+    unsigned*       m_cqHead;
+    unsigned*       m_cqTail;
+    unsigned        m_cqMask;
+    void*           m_cqes;
+};
+
+#endif // URINGREADER_HPP_INCLUDED
@@ -0,0 +1,151 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOICETABLE_HPP_INCLUDED
+#define VOICETABLE_HPP_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fixed capacity hash map from integer keys to values.
+//
+// Uses open addressing with linear probing and backward shift deletion, so
+// there are no tombstones and lookups stay short. All storage is allocated
+// at construction; insert, find and erase never allocate.
+template <typename Key, typename Value> class VoiceTable
+{
+public:
+    // Create a table holding at most maxSize entries. The slot array is
+    // kept at most a quarter full, which keeps probe runs short even when
+    // voices come and go quickly.
+    VoiceTable(size_t maxSize)
+        : m_maxSize(maxSize)
+        , m_size(0)
+    {
+        size_t capacity = 1;
+        while (capacity < 4 * maxSize) {
+            capacity <<= 1;
+        }
+        m_slots.resize(capacity);
+        m_mask = capacity - 1;
+    }
+
+    size_t size() const { return m_size; }
+    size_t maxSize() const { return m_maxSize; }
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size >= m_maxSize; }
+
+    // Return a pointer to the value for key or nullptr if there is none.
+    Value* find(Key key)
+    {
+        for (size_t i = bucket(key); m_slots[i].used; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key) {
+                return &m_slots[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    const Value* find(Key key) const
+    {
+        return const_cast<VoiceTable*>(this)->find(key);
+    }
+
+    // Insert or replace the value for key. Returns false if key is new
+    // and the table is full.
+    bool insert(Key key, const Value& value)
+    {
+        size_t i = bucket(key);
+        for (; m_slots[i].used; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key) {
+                m_slots[i].value = value;
+                return true;
+            }
+        }
+        if (full()) {
+            return false;
+        }
+        m_slots[i].used = true;
+        m_slots[i].key = key;
+        m_slots[i].value = value;
+        m_size++;
+        return true;
+    }
+
+    // Remove key from the table. Returns false if it wasn't there.
+    bool erase(Key key)
+    {
+        size_t i = bucket(key);
+        for (; m_slots[i].used; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key) {
+                break;
+            }
+        }
+        if (!m_slots[i].used) {
+            return false;
+        }
+        // Shift following entries of the same probe run back into the hole.
+        for (size_t j = (i + 1) & m_mask; m_slots[j].used; j = (j + 1) & m_mask) {
+            const size_t home = bucket(m_slots[j].key);
+            // Move entry j to i unless its home bucket lies cyclically in (i, j].
+            const bool inRange = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (!inRange) {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i].used = false;
+        m_size--;
+        return true;
+    }
+
+    // Call f(key, value) for every entry.
+    template <class F> void forEach(F f)
+    {
+        for (auto& slot : m_slots) {
+            if (slot.used) {
+                f(slot.key, slot.value);
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : used(false), key(), value() { }
+        bool    used;
+        Key     key;
+        Value   value;
+    };
+
+    // Keys are often pointers with zero low bits; mix them before masking.
+    size_t bucket(Key key) const
+    {
+        uint64_t x = uint64_t(key);
+        x ^= x >> 33;
+        x *= UINT64_C(0xff51afd7ed558ccd);
+        x ^= x >> 33;
+        return size_t(x) & m_mask;
+    }
+
+private:
+    std::vector<Slot>   m_slots;
+    size_t              m_mask;
+    size_t              m_maxSize;
+    size_t              m_size;
+};
+
+#endif // VOICETABLE_HPP_INCLUDED
@@ -0,0 +1,123 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "WavFormat.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+enum WavFormatTag
+{
+    kWavFormatPCM        = 0x0001,
+    kWavFormatFloat      = 0x0003,
+    kWavFormatExtensible = 0xFFFE
+};
+
+static inline uint16_t readLE16(const unsigned char* p)
+{
+    return uint16_t(p[0]) | (uint16_t(p[1]) << 8);
+}
+
+static inline uint32_t readLE32(const unsigned char* p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+Methcla_Error readWavHeader(FILE* file, WavFormat& format)
+{
+    unsigned char riff[12];
+    if (std::fread(riff, 1, sizeof(riff), file) != sizeof(riff)
+        || std::memcmp(riff, "RIFF", 4) != 0
+        || std::memcmp(riff+8, "WAVE", 4) != 0)
+        return kMethcla_UnsupportedFileTypeError;
+
+    bool haveFormat = false;
+    for (;;) {
+        unsigned char chunk[8];
+        if (std::fread(chunk, 1, sizeof(chunk), file) != sizeof(chunk))
+            return kMethcla_InvalidFileError;
+        const uint32_t chunkSize = readLE32(chunk+4);
+        // Chunks are padded to an even number of bytes.
+        const long paddedSize = long(chunkSize + (chunkSize & 1));
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0) {
+            unsigned char fmt[40];
+            const size_t fmtSize = std::min<size_t>(chunkSize, sizeof(fmt));
+            if (fmtSize < 16 || std::fread(fmt, 1, fmtSize, file) != fmtSize)
+                return kMethcla_InvalidFileError;
+            uint16_t tag = readLE16(fmt);
+            if (tag == kWavFormatExtensible && fmtSize >= 26)
+                tag = readLE16(fmt+24);
+            format.channels = readLE16(fmt+2);
+            format.bytesPerSample = readLE16(fmt+14) / 8;
+            format.isFloat = tag == kWavFormatFloat;
+            if ((tag != kWavFormatPCM && tag != kWavFormatFloat)
+                || (format.isFloat && format.bytesPerSample != 4 && format.bytesPerSample != 8)
+                || (!format.isFloat && (format.bytesPerSample < 1 || format.bytesPerSample > 4))
+                || format.channels == 0)
+                return kMethcla_UnsupportedDataFormatError;
+            if (std::fseek(file, paddedSize - long(fmtSize), SEEK_CUR) != 0)
+                return kMethcla_InvalidFileError;
+            format.sampleRate = readLE32(fmt+4);
+            haveFormat = true;
+        } else if (std::memcmp(chunk, "data", 4) == 0) {
+            if (!haveFormat)
+                return kMethcla_InvalidFileError;
+            format.dataOffset = std::ftell(file);
+            format.numFrames = chunkSize / format.frameSize();
+            return kMethcla_NoError;
+        } else if (std::fseek(file, paddedSize, SEEK_CUR) != 0) {
+            return kMethcla_InvalidFileError;
+        }
+    }
+}
+
+void convertWavSamples(const WavFormat& format, const unsigned char* src, float* dst, size_t numSamples)
+{
+    switch (format.bytesPerSample) {
+        case 1:
+            for (size_t i=0; i < numSamples; i++)
+                dst[i] = (float(src[i]) - 128.f) / 128.f;
+            break;
+        case 2:
+            for (size_t i=0; i < numSamples; i++, src += 2)
+                dst[i] = float(int16_t(readLE16(src))) / 32768.f;
+            break;
+        case 3:
+            for (size_t i=0; i < numSamples; i++, src += 3) {
+                const int32_t x = int32_t(uint32_t(src[0]) << 8 | uint32_t(src[1]) << 16 | uint32_t(src[2]) << 24);
+                dst[i] = float(x >> 8) / 8388608.f;
+            }
+            break;
+        case 4:
+            if (format.isFloat) {
+                for (size_t i=0; i < numSamples; i++, src += 4) {
+                    const uint32_t bits = readLE32(src);
+                    std::memcpy(&dst[i], &bits, sizeof(float));
+                }
+            } else {
+                for (size_t i=0; i < numSamples; i++, src += 4)
+                    dst[i] = float(double(int32_t(readLE32(src))) / 2147483648.);
+            }
+            break;
+        case 8:
+            for (size_t i=0; i < numSamples; i++, src += 8) {
+                const uint64_t bits = uint64_t(readLE32(src)) | (uint64_t(readLE32(src+4)) << 32);
+                double x;
+                std::memcpy(&x, &bits, sizeof(double));
+                dst[i] = float(x);
+            }
+            break;
+    }
+}
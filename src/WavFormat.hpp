@@ -0,0 +1,51 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WAVFORMAT_HPP_INCLUDED
+#define WAVFORMAT_HPP_INCLUDED
+
+#include <methcla/common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Sample layout of an uncompressed RIFF WAVE file.
+struct WavFormat
+{
+    unsigned int    channels;
+    unsigned int    sampleRate;
+    unsigned int    bytesPerSample;
+    bool            isFloat;
+    // Offset of the sample data from the start of the file in bytes.
+    long            dataOffset;
+    int64_t         numFrames;
+
+    size_t frameSize() const
+    {
+        return channels * bytesPerSample;
+    }
+};
+
+// Parse the RIFF header of file and position it at the start of the
+// sample data. Supports integer PCM with 8 to 32 bits and 32 or 64 bit
+// floats.
+Methcla_Error readWavHeader(FILE* file, WavFormat& format);
+
+// Convert numSamples samples from the on-disk format to float. Samples are
+// converted front to back, so the conversion can be done in place if src
+// points numSamples * (sizeof(float) - bytesPerSample) bytes past dst.
+void convertWavSamples(const WavFormat& format, const unsigned char* src, float* dst, size_t numSamples);
+
+#endif // WAVFORMAT_HPP_INCLUDED
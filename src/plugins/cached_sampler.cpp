@@ -0,0 +1,189 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cached_sampler.h"
+#include "SampleCache.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <new>
+
+namespace {
+
+enum Port
+{
+    kAmp = kMethclaSampler_CachedSamplerAmp,
+    kRate = kMethclaSampler_CachedSamplerRate,
+    kOutputLeft,
+    kOutputRight,
+    kNumPorts
+};
+
+struct Options
+{
+    int32_t sound;
+    bool    loop;
+};
+
+struct Synth
+{
+    float*              ports[kNumPorts];
+    int32_t             soundIndex;
+    bool                loop;
+    // Null once the sound has been released.
+    const CachedSound*  sound;
+    // Playback position in frames.
+    double              position;
+};
+
+void releaseSound(Synth* self)
+{
+    if (self->sound != nullptr) {
+        SampleCache::instance()->release(size_t(self->soundIndex));
+        self->sound = nullptr;
+    }
+}
+
+void configure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(OSCPP::ReadStream(tags, tagsSize), OSCPP::ReadStream(args, argsSize));
+    Options* options = new (outOptions) Options;
+    options->sound = argStream.int32();
+    options->loop = argStream.atEnd() ? false : argStream.int32() != 0;
+}
+
+bool port_descriptor(const Methcla_SynthOptions*, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    switch (index) {
+        case kAmp:
+        case kRate:
+            port->type = kMethcla_ControlPort;
+            port->direction = kMethcla_Input;
+            port->flags = kMethcla_PortFlags;
+            return true;
+        case kOutputLeft:
+        case kOutputRight:
+            port->type = kMethcla_AudioPort;
+            port->direction = kMethcla_Output;
+            port->flags = kMethcla_PortFlags;
+            return true;
+    }
+    return false;
+}
+
+void construct(const Methcla_World*, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    Synth* self = new (synth) Synth;
+    SampleCache* cache = SampleCache::instance();
+    self->soundIndex = options->sound;
+    self->loop = options->loop;
+    self->sound = cache == nullptr || options->sound < 0 ? nullptr : cache->sound(size_t(options->sound));
+    self->position = 0.;
+}
+
+void connect(Methcla_Synth* synth, Methcla_PortCount port, void* data)
+{
+    static_cast<Synth*>(synth)->ports[port] = static_cast<float*>(data);
+}
+
+void process(const Methcla_World*, Methcla_Synth* synth, size_t numFrames)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    float* left = self->ports[kOutputLeft];
+    float* right = self->ports[kOutputRight];
+
+    size_t k = 0;
+    if (self->sound != nullptr) {
+        const CachedSound& sound = *self->sound;
+        const float* samples = sound.samples.data();
+        const size_t channels = sound.channels;
+        const size_t rightOffset = channels > 1 ? 1 : 0;
+        const int64_t numSoundFrames = sound.frames;
+        const float amp = *self->ports[kAmp];
+        const double rate = *self->ports[kRate];
+
+        double position = self->position;
+        bool done = false;
+        for (; k < numFrames; k++) {
+            if (self->loop) {
+                while (position >= double(numSoundFrames)) {
+                    position -= double(numSoundFrames);
+                }
+            }
+            const int64_t frame = int64_t(position);
+            if (!self->loop && frame >= numSoundFrames) {
+                done = true;
+                break;
+            }
+
+            // Linear interpolation between adjacent frames; the last frame
+            // of a one-shot sound is interpolated with silence.
+            int64_t next = frame + 1;
+            const bool atEnd = next >= numSoundFrames && !self->loop;
+            if (next >= numSoundFrames) {
+                next = 0;
+            }
+            const float* f0 = samples + size_t(frame) * channels;
+            const float* f1 = samples + size_t(next) * channels;
+            const float l1 = atEnd ? 0.f : f1[0];
+            const float r1 = atEnd ? 0.f : f1[rightOffset];
+            const float a = float(position - double(frame));
+            left[k] = amp * (f0[0] + a * (l1 - f0[0]));
+            right[k] = amp * (f0[rightOffset] + a * (r1 - f0[rightOffset]));
+
+            position += rate;
+        }
+        self->position = position;
+
+        if (done) {
+            releaseSound(self);
+        }
+    }
+
+    for (; k < numFrames; k++) {
+        left[k] = right[k] = 0.f;
+    }
+}
+
+void destroy(const Methcla_World*, Methcla_Synth* synth)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    releaseSound(self);
+    self->~Synth();
+}
+
+const Methcla_SynthDef kSynthDef =
+{
+    METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_URI,
+    sizeof(Synth),
+    sizeof(Options),
+    configure,
+    port_descriptor,
+    construct,
+    connect,
+    nullptr,
+    process,
+    destroy
+};
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_sampler_plugins_cached_sampler(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_synthdef(host, &kSynthDef);
+    return &kLibrary;
+}
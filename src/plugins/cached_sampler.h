@@ -0,0 +1,46 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_H_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Sampler voice that plays a sound's decoded samples held by the active
+// SampleCache instance. The sound must have been acquired from the cache
+// for the voice; the voice releases it when it has played to the end or
+// is freed.
+//
+// Controls: amp, rate
+// Arguments: sound (index), loop (bool, optional)
+// Outputs: left, right
+Methcla_Library* methcla_sampler_plugins_cached_sampler(const Methcla_Host* host, const char* bundlePath);
+
+#define METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_URI "http://samplecount.com/methcla-sampler/plugins/cached-sampler"
+
+enum
+{
+    kMethclaSampler_CachedSamplerAmp,
+    kMethclaSampler_CachedSamplerRate
+};
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_PLUGINS_CACHED_SAMPLER_H_INCLUDED
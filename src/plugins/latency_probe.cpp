@@ -0,0 +1,99 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "latency_probe.h"
+#include "SchedulingLatency.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <new>
+
+namespace {
+
+struct Options
+{
+    int32_t token;
+};
+
+struct Synth
+{
+    int32_t token;
+    bool    done;
+};
+
+void configure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(OSCPP::ReadStream(tags, tagsSize), OSCPP::ReadStream(args, argsSize));
+    Options* options = new (outOptions) Options;
+    options->token = argStream.atEnd() ? -1 : argStream.int32();
+}
+
+bool port_descriptor(const Methcla_SynthOptions*, Methcla_PortCount, Methcla_PortDescriptor*)
+{
+    return false;
+}
+
+void construct(const Methcla_World*, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    Synth* self = new (synth) Synth;
+    self->token = options->token;
+    self->done = false;
+}
+
+void connect(Methcla_Synth*, Methcla_PortCount, void*)
+{
+}
+
+void process(const Methcla_World* world, Methcla_Synth* synth, size_t)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    if (!self->done) {
+        SchedulingLatency* latency = SchedulingLatency::instance();
+        if (latency != nullptr && self->token >= 0) {
+            latency->endProbe(self->token, methcla_world_current_time(world));
+        }
+        self->done = true;
+        methcla_world_synth_done(world, synth);
+    }
+}
+
+void destroy(const Methcla_World*, Methcla_Synth* synth)
+{
+    static_cast<Synth*>(synth)->~Synth();
+}
+
+const Methcla_SynthDef kSynthDef =
+{
+    METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_URI,
+    sizeof(Synth),
+    sizeof(Options),
+    configure,
+    port_descriptor,
+    construct,
+    connect,
+    nullptr,
+    process,
+    destroy
+};
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_sampler_plugins_latency_probe(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_synthdef(host, &kSynthDef);
+    return &kLibrary;
+}
@@ -0,0 +1,37 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_H_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Synth without ports that reports the time of the first audio block it
+// is processed in to the active SchedulingLatency instance and then frees
+// itself.
+//
+// Arguments: token (int)
+Methcla_Library* methcla_sampler_plugins_latency_probe(const Methcla_Host* host, const char* bundlePath);
+
+#define METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_URI "http://samplecount.com/methcla-sampler/plugins/latency-probe"
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_PLUGINS_LATENCY_PROBE_H_INCLUDED
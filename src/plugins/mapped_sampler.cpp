@@ -0,0 +1,213 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_sampler.h"
+#include "MappedSounds.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <new>
+
+namespace {
+
+enum Port
+{
+    kAmp = kMethclaSampler_MappedSamplerAmp,
+    kRate = kMethclaSampler_MappedSamplerRate,
+    kSound = kMethclaSampler_MappedSamplerSound,
+    kOutputLeft,
+    kOutputRight,
+    kNumPorts
+};
+
+struct Options
+{
+    bool    loop;
+};
+
+struct Synth
+{
+    float*              ports[kNumPorts];
+    bool                loop;
+    int32_t             soundIndex;
+    const SampleFile*   sound;
+    // Publishes the position to the prefetcher; null if none was
+    // available.
+    MappedCursor*       cursor;
+    // Playback position in frames.
+    double              position;
+    bool                done;
+};
+
+void closeCursor(Synth* self)
+{
+    if (self->cursor != nullptr) {
+        MappedSounds::instance()->closeCursor(self->cursor);
+        self->cursor = nullptr;
+    }
+}
+
+void configure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(OSCPP::ReadStream(tags, tagsSize), OSCPP::ReadStream(args, argsSize));
+    Options* options = new (outOptions) Options;
+    options->loop = argStream.atEnd() ? false : argStream.int32() != 0;
+}
+
+bool port_descriptor(const Methcla_SynthOptions*, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    switch (index) {
+        case kAmp:
+        case kRate:
+        case kSound:
+            port->type = kMethcla_ControlPort;
+            port->direction = kMethcla_Input;
+            port->flags = kMethcla_PortFlags;
+            return true;
+        case kOutputLeft:
+        case kOutputRight:
+            port->type = kMethcla_AudioPort;
+            port->direction = kMethcla_Output;
+            port->flags = kMethcla_PortFlags;
+            return true;
+    }
+    return false;
+}
+
+void construct(const Methcla_World*, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    Synth* self = new (synth) Synth;
+    self->loop = options->loop;
+    self->soundIndex = -1;
+    self->sound = nullptr;
+    self->cursor = nullptr;
+    self->position = 0.;
+    self->done = true;
+}
+
+void connect(Methcla_Synth* synth, Methcla_PortCount port, void* data)
+{
+    static_cast<Synth*>(synth)->ports[port] = static_cast<float*>(data);
+}
+
+void process(const Methcla_World*, Methcla_Synth* synth, size_t numFrames)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    float* left = self->ports[kOutputLeft];
+    float* right = self->ports[kOutputRight];
+
+    const int32_t soundIndex = int32_t(*self->ports[kSound]);
+    if (soundIndex != self->soundIndex) {
+        closeCursor(self);
+        MappedSounds* sounds = MappedSounds::instance();
+        self->soundIndex = soundIndex;
+        self->sound = sounds == nullptr || soundIndex < 0 ? nullptr : sounds->sound(soundIndex);
+        self->position = 0.;
+        self->done = self->sound == nullptr || self->sound->frames() == 0;
+        if (!self->done) {
+            self->cursor = sounds->openCursor(self->sound, self->loop);
+        }
+    }
+
+    size_t k = 0;
+    if (!self->done) {
+        const SampleFile& sound = *self->sound;
+        const float* l = sound.channel(0);
+        const float* r = sound.channel(sound.channels() > 1 ? 1 : 0);
+        const size_t stride = sound.frameStride();
+        const int64_t numSoundFrames = sound.frames();
+        // Loop between the loop points if they enclose any frames,
+        // otherwise over the whole sound.
+        const bool hasLoop = sound.loopEnd() > sound.loopStart();
+        const int64_t loopStart = hasLoop ? sound.loopStart() : 0;
+        const int64_t loopEnd = hasLoop ? sound.loopEnd() : numSoundFrames;
+        const double loopLength = double(loopEnd - loopStart);
+        const float amp = *self->ports[kAmp];
+        const double rate = *self->ports[kRate];
+
+        double position = self->position;
+        for (; k < numFrames; k++) {
+            if (self->loop) {
+                while (position >= double(loopEnd)) {
+                    position -= loopLength;
+                }
+            }
+            const int64_t frame = int64_t(position);
+            if (!self->loop && frame >= numSoundFrames) {
+                self->done = true;
+                break;
+            }
+
+            // Linear interpolation between adjacent frames; the last frame
+            // of a one-shot sound is interpolated with silence.
+            int64_t next = frame + 1;
+            if (self->loop && next >= loopEnd) {
+                next = loopStart;
+            }
+            const size_t i0 = size_t(frame) * stride;
+            const size_t i1 = size_t(next) * stride;
+            const bool atEnd = next >= numSoundFrames;
+            const float l1 = atEnd ? 0.f : l[i1];
+            const float r1 = atEnd ? 0.f : r[i1];
+            const float a = float(position - double(frame));
+            left[k] = amp * (l[i0] + a * (l1 - l[i0]));
+            right[k] = amp * (r[i0] + a * (r1 - r[i0]));
+
+            position += rate;
+        }
+        self->position = position;
+
+        if (self->done) {
+            closeCursor(self);
+        } else if (self->cursor != nullptr) {
+            self->cursor->update(position, float(rate));
+        }
+    }
+
+    for (; k < numFrames; k++) {
+        left[k] = right[k] = 0.f;
+    }
+}
+
+void destroy(const Methcla_World*, Methcla_Synth* synth)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    closeCursor(self);
+    self->~Synth();
+}
+
+const Methcla_SynthDef kSynthDef =
+{
+    METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_URI,
+    sizeof(Synth),
+    sizeof(Options),
+    configure,
+    port_descriptor,
+    construct,
+    connect,
+    nullptr,
+    process,
+    destroy
+};
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_sampler_plugins_mapped_sampler(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_synthdef(host, &kSynthDef);
+    return &kLibrary;
+}
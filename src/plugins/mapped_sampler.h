@@ -0,0 +1,48 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_H_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Sampler voice that plays a sound's pre-decoded sample container
+// registered with the active MappedSounds instance straight from its
+// memory mapping, without decoding or copying. Looping voices wrap around
+// at the container's loop points. Voices publish their position so that
+// the pages ahead of them are prefaulted in the background.
+//
+// Controls: amp, rate, sound (index)
+// Arguments: loop (bool, optional)
+// Outputs: left, right
+Methcla_Library* methcla_sampler_plugins_mapped_sampler(const Methcla_Host* host, const char* bundlePath);
+
+#define METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_URI "http://samplecount.com/methcla-sampler/plugins/mapped-sampler"
+
+enum
+{
+    kMethclaSampler_MappedSamplerAmp,
+    kMethclaSampler_MappedSamplerRate,
+    kMethclaSampler_MappedSamplerSound
+};
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_PLUGINS_MAPPED_SAMPLER_H_INCLUDED
@@ -0,0 +1,216 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel_sampler.h"
+#include "stream_voice.hpp"
+#include "ParallelRenderer.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <algorithm>
+#include <new>
+
+static_assert(int(kMethclaSampler_ParallelSamplerNumVoiceControls) == int(StreamVoice::kNumControls),
+              "Parallel sampler voice controls must match the stream sampler's");
+
+namespace {
+
+const size_t kNumControls = StreamVoice::kNumControls;
+// Floats per cache line.
+const size_t kCacheLineFloats = 64 / sizeof(float);
+
+struct Options
+{
+    size_t  numVoices;
+    size_t  numGroups;
+    bool    loop;
+};
+
+struct Synth
+{
+    const Methcla_World*    world;
+    size_t                  numControlPorts;
+    size_t                  numVoices;
+    size_t                  numGroups;
+    size_t                  blockSize;
+    // Control pointers of all voices, kNumControls per voice.
+    const float**           controls;
+    StreamVoice*            voices;
+    // Stereo mix buffer of each subgroup, left and right blockSize frames
+    // each; subgroups are mixStride floats apart.
+    float*                  mix;
+    size_t                  mixStride;
+    float*                  outputs[2];
+    // Number of frames of the current period.
+    size_t                  numFrames;
+};
+
+void configure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(OSCPP::ReadStream(tags, tagsSize), OSCPP::ReadStream(args, argsSize));
+    Options* options = new (outOptions) Options;
+    options->numVoices = size_t(std::max(0, argStream.int32()));
+    options->numGroups = size_t(std::max(1, argStream.int32()));
+    options->numGroups = std::min<size_t>(options->numGroups, ParallelRenderer::kMaxTasks);
+    options->loop = argStream.atEnd() ? false : argStream.int32() != 0;
+}
+
+bool port_descriptor(const Methcla_SynthOptions* inOptions, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    const size_t numControlPorts = options->numVoices * kNumControls;
+    if (index < numControlPorts) {
+        port->type = kMethcla_ControlPort;
+        port->direction = kMethcla_Input;
+        port->flags = kMethcla_PortFlags;
+        return true;
+    }
+    if (index < numControlPorts + 2) {
+        port->type = kMethcla_AudioPort;
+        port->direction = kMethcla_Output;
+        port->flags = kMethcla_PortFlags;
+        return true;
+    }
+    return false;
+}
+
+void construct(const Methcla_World* world, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    Synth* self = new (synth) Synth;
+    self->world = world;
+    self->numControlPorts = options->numVoices * kNumControls;
+    self->numVoices = options->numVoices;
+    self->numGroups = std::min(options->numGroups, std::max<size_t>(options->numVoices, 1));
+    self->blockSize = methcla_world_block_size(world);
+    self->controls = static_cast<const float**>(
+        methcla_world_alloc(world, self->numVoices * kNumControls * sizeof(const float*)));
+    self->voices = static_cast<StreamVoice*>(
+        methcla_world_alloc_aligned(world, alignof(StreamVoice), self->numVoices * sizeof(StreamVoice)));
+    // Separate the subgroups' buffers by cache lines so that threads don't
+    // write to the same line.
+    self->mixStride = (2 * self->blockSize + kCacheLineFloats - 1) / kCacheLineFloats * kCacheLineFloats;
+    self->mix = static_cast<float*>(
+        methcla_world_alloc_aligned(world, 64, self->numGroups * self->mixStride * sizeof(float)));
+    self->numFrames = 0;
+
+    if (self->controls == nullptr || self->voices == nullptr || self->mix == nullptr) {
+        // Out of realtime memory; stay silent.
+        self->numVoices = 0;
+    }
+    const double sampleRate = methcla_world_samplerate(world);
+    for (size_t i=0; i < self->numVoices; i++) {
+        new (&self->voices[i]) StreamVoice(sampleRate, options->loop);
+    }
+}
+
+void connect(Methcla_Synth* synth, Methcla_PortCount port, void* data)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    if (port < self->numControlPorts) {
+        if (self->controls != nullptr) {
+            self->controls[port] = static_cast<const float*>(data);
+        }
+    } else {
+        self->outputs[port - self->numControlPorts] = static_cast<float*>(data);
+    }
+}
+
+// Mix the voices of one subgroup.
+void processGroup(void* data, size_t group)
+{
+    Synth* self = static_cast<Synth*>(data);
+    float* left = self->mix + group * self->mixStride;
+    float* right = left + self->blockSize;
+    std::fill(left, left + self->numFrames, 0.f);
+    std::fill(right, right + self->numFrames, 0.f);
+    for (size_t i=group; i < self->numVoices; i += self->numGroups) {
+        self->voices[i].process(self->world, self->controls + i * kNumControls, left, right, self->numFrames);
+    }
+}
+
+void process(const Methcla_World* world, Methcla_Synth* synth, size_t numFrames)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    float* left = self->outputs[0];
+    float* right = self->outputs[1];
+
+    std::fill(left, left + numFrames, 0.f);
+    std::fill(right, right + numFrames, 0.f);
+    if (self->numVoices == 0) {
+        return;
+    }
+
+    self->world = world;
+    self->numFrames = numFrames;
+    ParallelRenderer* renderer = ParallelRenderer::instance();
+    if (renderer != nullptr) {
+        renderer->run(processGroup, self, self->numGroups);
+    } else {
+        for (size_t group=0; group < self->numGroups; group++) {
+            processGroup(self, group);
+        }
+    }
+
+    for (size_t group=0; group < self->numGroups; group++) {
+        const float* groupLeft = self->mix + group * self->mixStride;
+        const float* groupRight = groupLeft + self->blockSize;
+        for (size_t k=0; k < numFrames; k++) {
+            left[k] += groupLeft[k];
+            right[k] += groupRight[k];
+        }
+    }
+}
+
+void destroy(const Methcla_World* world, Methcla_Synth* synth)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    for (size_t i=0; i < self->numVoices; i++) {
+        self->voices[i].~StreamVoice();
+    }
+    if (self->controls != nullptr) {
+        methcla_world_free(world, self->controls);
+    }
+    if (self->voices != nullptr) {
+        methcla_world_free(world, self->voices);
+    }
+    if (self->mix != nullptr) {
+        methcla_world_free(world, self->mix);
+    }
+    self->~Synth();
+}
+
+const Methcla_SynthDef kSynthDef =
+{
+    METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_URI,
+    sizeof(Synth),
+    sizeof(Options),
+    configure,
+    port_descriptor,
+    construct,
+    connect,
+    nullptr,
+    process,
+    destroy
+};
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_sampler_plugins_parallel_sampler(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_synthdef(host, &kSynthDef);
+    return &kLibrary;
+}
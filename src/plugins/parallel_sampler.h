@@ -0,0 +1,53 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_H_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Bank of stream sampler voices that are rendered in parallel by the
+// active ParallelRenderer.
+//
+// Voice i belongs to subgroup i % groups. Each audio period the subgroups
+// are mixed into separate buffers by the renderer's threads and summed
+// into the outputs once all of them are done. Without a renderer all
+// subgroups are rendered on the audio thread.
+//
+// Each voice behaves like a stream sampler synth (see stream_sampler.h)
+// and has the same controls; the controls of voice i start at port
+// i * kMethclaSampler_ParallelSamplerNumVoiceControls. The bank allocates
+// its voices and mix buffers from the engine's realtime memory.
+//
+// Controls: amp, rate, sound, gate, release, trace of every voice
+// Arguments: voices (int), groups (int), loop (bool, optional)
+// Outputs: left, right
+Methcla_Library* methcla_sampler_plugins_parallel_sampler(const Methcla_Host* host, const char* bundlePath);
+
+#define METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_URI "http://samplecount.com/methcla-sampler/plugins/parallel-sampler"
+
+enum
+{
+    kMethclaSampler_ParallelSamplerNumVoiceControls = 6
+};
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_PLUGINS_PARALLEL_SAMPLER_H_INCLUDED
@@ -0,0 +1,135 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "soundfile_api_wav.h"
+#include "WavFormat.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace {
+
+struct WavFile
+{
+    FILE*           file;
+    Methcla_SoundFile soundFile;
+    WavFormat       format;
+    int64_t         position;
+    std::vector<unsigned char> buffer;
+};
+
+inline WavFile* wavFile(const Methcla_SoundFile* file)
+{
+    return static_cast<WavFile*>(file->handle);
+}
+
+Methcla_Error wav_close(const Methcla_SoundFile* file)
+{
+    WavFile* wav = wavFile(file);
+    std::fclose(wav->file);
+    delete wav;
+    return kMethcla_NoError;
+}
+
+Methcla_Error wav_seek(const Methcla_SoundFile* file, int64_t numFrames)
+{
+    WavFile* wav = wavFile(file);
+    if (numFrames < 0 || numFrames > wav->format.numFrames)
+        return kMethcla_ArgumentError;
+    const long offset = wav->format.dataOffset + long(numFrames * wav->format.frameSize());
+    if (std::fseek(wav->file, offset, SEEK_SET) != 0)
+        return kMethcla_UnspecifiedError;
+    wav->position = numFrames;
+    return kMethcla_NoError;
+}
+
+Methcla_Error wav_tell(const Methcla_SoundFile* file, int64_t* numFrames)
+{
+    *numFrames = wavFile(file)->position;
+    return kMethcla_NoError;
+}
+
+Methcla_Error wav_read_float(const Methcla_SoundFile* file, float* buffer, size_t numFrames, size_t* outNumFrames)
+{
+    WavFile* wav = wavFile(file);
+    const size_t frameSize = wav->format.frameSize();
+    const size_t framesLeft = size_t(wav->format.numFrames - wav->position);
+    const size_t framesToRead = std::min(numFrames, framesLeft);
+    if (wav->buffer.size() < framesToRead * frameSize)
+        wav->buffer.resize(framesToRead * frameSize);
+    const size_t framesRead = std::fread(wav->buffer.data(), frameSize, framesToRead, wav->file);
+    convertWavSamples(wav->format, wav->buffer.data(), buffer, framesRead * wav->format.channels);
+    wav->position += framesRead;
+    *outNumFrames = framesRead;
+    return framesRead == framesToRead ? kMethcla_NoError : kMethcla_UnspecifiedError;
+}
+
+Methcla_Error wav_write_float(const Methcla_SoundFile*, const float*, size_t, size_t*)
+{
+    return kMethcla_UnsupportedFileTypeError;
+}
+
+Methcla_Error wav_open(const Methcla_SoundFileAPI*, const char* path, Methcla_FileMode mode, Methcla_SoundFile** file, Methcla_SoundFileInfo* info)
+{
+    if (mode != kMethcla_FileModeRead)
+        return kMethcla_UnsupportedFileTypeError;
+
+    FILE* handle = std::fopen(path, "rb");
+    if (handle == nullptr)
+        return kMethcla_FileNotFoundError;
+
+    WavFile* wav = new (std::nothrow) WavFile();
+    if (wav == nullptr) {
+        std::fclose(handle);
+        return kMethcla_MemoryError;
+    }
+    wav->file = handle;
+
+    const Methcla_Error err = readWavHeader(handle, wav->format);
+    if (err != kMethcla_NoError) {
+        std::fclose(handle);
+        delete wav;
+        return err;
+    }
+
+    info->frames = wav->format.numFrames;
+    info->channels = wav->format.channels;
+    info->samplerate = wav->format.sampleRate;
+
+    wav->soundFile.handle = wav;
+    wav->soundFile.close = wav_close;
+    wav->soundFile.seek = wav_seek;
+    wav->soundFile.tell = wav_tell;
+    wav->soundFile.read_float = wav_read_float;
+    wav->soundFile.write_float = wav_write_float;
+    *file = &wav->soundFile;
+
+    return kMethcla_NoError;
+}
+
+const Methcla_SoundFileAPI kSoundFileAPI = { nullptr, wav_open };
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_soundfile_api_wav(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_soundfile_api(host, &kSoundFileAPI);
+    return &kLibrary;
+}
@@ -0,0 +1,32 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_SOUNDFILE_API_WAV_H_INCLUDED
+#define METHCLA_SAMPLER_SOUNDFILE_API_WAV_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Portable, dependency free sound file API for reading RIFF/WAVE files.
+// Supports 8/16/24/32 bit integer PCM and 32/64 bit float data.
+Methcla_Library* methcla_soundfile_api_wav(const Methcla_Host* host, const char* bundlePath);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_SOUNDFILE_API_WAV_H_INCLUDED
@@ -0,0 +1,121 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stream_sampler.h"
+#include "stream_voice.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <new>
+
+namespace {
+
+enum Port
+{
+    kOutputLeft = StreamVoice::kNumControls,
+    kOutputRight,
+    kNumPorts
+};
+
+struct Options
+{
+    bool    loop;
+};
+
+struct Synth
+{
+    float*          ports[kNumPorts];
+    StreamVoice     voice;
+
+    Synth(double sampleRate, bool loop)
+        : voice(sampleRate, loop)
+    { }
+};
+
+void configure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(OSCPP::ReadStream(tags, tagsSize), OSCPP::ReadStream(args, argsSize));
+    Options* options = new (outOptions) Options;
+    options->loop = argStream.atEnd() ? false : argStream.int32() != 0;
+}
+
+bool port_descriptor(const Methcla_SynthOptions*, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    if (index < StreamVoice::kNumControls) {
+        port->type = kMethcla_ControlPort;
+        port->direction = kMethcla_Input;
+        port->flags = kMethcla_PortFlags;
+        return true;
+    }
+    switch (index) {
+        case kOutputLeft:
+        case kOutputRight:
+            port->type = kMethcla_AudioPort;
+            port->direction = kMethcla_Output;
+            port->flags = kMethcla_PortFlags;
+            return true;
+    }
+    return false;
+}
+
+void construct(const Methcla_World* world, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    const Options* options = static_cast<const Options*>(inOptions);
+    new (synth) Synth(methcla_world_samplerate(world), options->loop);
+}
+
+void connect(Methcla_Synth* synth, Methcla_PortCount port, void* data)
+{
+    static_cast<Synth*>(synth)->ports[port] = static_cast<float*>(data);
+}
+
+void process(const Methcla_World* world, Methcla_Synth* synth, size_t numFrames)
+{
+    Synth* self = static_cast<Synth*>(synth);
+    float* left = self->ports[kOutputLeft];
+    float* right = self->ports[kOutputRight];
+    for (size_t k=0; k < numFrames; k++) {
+        left[k] = right[k] = 0.f;
+    }
+    self->voice.process(world, self->ports, left, right, numFrames);
+}
+
+void destroy(const Methcla_World*, Methcla_Synth* synth)
+{
+    static_cast<Synth*>(synth)->~Synth();
+}
+
+const Methcla_SynthDef kSynthDef =
+{
+    METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_URI,
+    sizeof(Synth),
+    sizeof(Options),
+    configure,
+    port_descriptor,
+    construct,
+    connect,
+    nullptr,
+    process,
+    destroy
+};
+
+Methcla_Library kLibrary = { nullptr, nullptr };
+
+} // namespace
+
+Methcla_Library* methcla_sampler_plugins_stream_sampler(const Methcla_Host* host, const char* /* bundlePath */)
+{
+    methcla_host_register_synthdef(host, &kSynthDef);
+    return &kLibrary;
+}
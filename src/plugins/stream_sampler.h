@@ -0,0 +1,60 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_H_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_H_INCLUDED
+
+#include <methcla/plugin.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Sampler voice that starts playing from the head of a sound kept in
+// memory and continues with data streamed from disk by the active
+// DiskStreamer.
+//
+// Playback of sound starts when gate becomes positive and stops when it
+// drops to zero, so that a synth can be reused for many notes without
+// being reconstructed. Changing sound while the gate is open restarts
+// playback with the new sound. When release is positive, closing the gate
+// fades the voice out linearly over release seconds instead of cutting it
+// off.
+//
+// If trace is non-negative when playback starts, the start time and the
+// time of the first non-silent sample are reported to the active
+// InputLatency instance under that token.
+//
+// Controls: amp, rate, sound (index), gate, release, trace
+// Arguments: loop (bool, optional)
+// Outputs: left, right
+Methcla_Library* methcla_sampler_plugins_stream_sampler(const Methcla_Host* host, const char* bundlePath);
+
+#define METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_URI "http://samplecount.com/methcla-sampler/plugins/stream-sampler"
+
+enum
+{
+    kMethclaSampler_StreamSamplerAmp,
+    kMethclaSampler_StreamSamplerRate,
+    kMethclaSampler_StreamSamplerSound,
+    kMethclaSampler_StreamSamplerGate,
+    kMethclaSampler_StreamSamplerRelease,
+    kMethclaSampler_StreamSamplerTrace
+};
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // METHCLA_SAMPLER_PLUGINS_STREAM_SAMPLER_H_INCLUDED
@@ -0,0 +1,205 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stream_voice.hpp"
+#include "InputLatency.hpp"
+
+#include <limits>
+
+StreamVoice::StreamVoice(double sampleRate, bool loop)
+    : m_sampleRate(sampleRate)
+    , m_loop(loop)
+    , m_gate(0.f)
+    , m_envelope(1.f)
+    , m_envelopeStep(0.f)
+    , m_releasing(false)
+    , m_soundIndex(-1)
+    , m_sound(nullptr)
+    , m_stream(nullptr)
+    , m_position(0.)
+    , m_endFrame(0)
+    , m_done(true)
+    , m_traceToken(-1)
+    , m_traceStartTime(0.)
+{
+}
+
+StreamVoice::~StreamVoice()
+{
+    stop();
+}
+
+// Report the current trace; soundTime is negative if the note didn't
+// produce any sound.
+void StreamVoice::endTrace(Methcla_Time soundTime)
+{
+    if (m_traceToken >= 0) {
+        InputLatency* latency = InputLatency::instance();
+        if (latency != nullptr) {
+            latency->endTrace(m_traceToken, m_traceStartTime, soundTime);
+        }
+        m_traceToken = -1;
+    }
+}
+
+void StreamVoice::stop()
+{
+    endTrace(-1.);
+    if (m_stream != nullptr) {
+        DiskStreamer::instance()->closeStream(m_stream);
+        m_stream = nullptr;
+    }
+    m_sound = nullptr;
+    m_releasing = false;
+    m_done = true;
+}
+
+// Fade out over release seconds or stop right away.
+void StreamVoice::release(float release)
+{
+    const double releaseFrames = release * m_sampleRate;
+    if (m_done || releaseFrames < 1.) {
+        stop();
+    } else if (!m_releasing) {
+        m_releasing = true;
+        m_envelopeStep = float(m_envelope / releaseFrames);
+    }
+}
+
+void StreamVoice::start(int32_t soundIndex)
+{
+    stop();
+
+    DiskStreamer* streamer = DiskStreamer::instance();
+    m_soundIndex = soundIndex;
+    m_sound = streamer == nullptr || soundIndex < 0 ? nullptr : streamer->sound(soundIndex);
+    m_position = 0.;
+    m_envelope = 1.f;
+    m_releasing = false;
+    m_done = m_sound == nullptr;
+
+    if (!m_done) {
+        m_endFrame = m_loop ? std::numeric_limits<int64_t>::max() : m_sound->info.frames;
+        // Start streaming right away so that the tail arrives before the
+        // head has been played.
+        const bool needsStream = m_loop || m_sound->headFrames < m_sound->info.frames;
+        if (needsStream) {
+            m_stream = streamer->openStream(soundIndex, m_sound, m_sound->headFrames, m_loop);
+            if (m_stream == nullptr) {
+                // All streams are in use; only play the head.
+                m_endFrame = m_sound->headFrames;
+            }
+        }
+    }
+}
+
+// Return a pointer to the interleaved samples of frame or nullptr if it
+// isn't available (yet).
+inline const float* StreamVoice::frameAt(int64_t frame) const
+{
+    if (frame < m_sound->headFrames) {
+        return m_sound->head.data() + frame * m_sound->info.channels;
+    }
+    if (m_stream != nullptr && m_stream->contains(frame)) {
+        return m_stream->frame(frame);
+    }
+    return nullptr;
+}
+
+bool StreamVoice::process(const Methcla_World* world, const float* const* controls, float* left, float* right, size_t numFrames)
+{
+    const float gate = *controls[kGate];
+    const int32_t soundIndex = int32_t(*controls[kSound]);
+    if (gate > 0.f && (m_gate <= 0.f || soundIndex != m_soundIndex)) {
+        start(soundIndex);
+        if (!m_done) {
+            m_traceToken = int32_t(*controls[kTrace]);
+            m_traceStartTime = methcla_world_current_time(world);
+        }
+    } else if (gate <= 0.f && m_gate > 0.f) {
+        release(*controls[kRelease]);
+    }
+    m_gate = gate;
+
+    if (m_done) {
+        return false;
+    }
+
+    const float amp = *controls[kAmp];
+    const double rate = *controls[kRate];
+    const unsigned int channels = m_sound->info.channels;
+    const size_t rightChannel = channels > 1 ? 1 : 0;
+
+    double position = m_position;
+    float envelope = m_envelope;
+    bool underrun = false;
+
+    for (size_t k=0; k < numFrames; k++) {
+        const int64_t frame = int64_t(position);
+        if (m_releasing) {
+            envelope -= m_envelopeStep;
+        }
+        if (frame >= m_endFrame || envelope <= 0.f) {
+            // End of a one-shot sound or of the release; only the stream
+            // is released.
+            m_done = true;
+            break;
+        }
+
+        // Linear interpolation between adjacent frames; the last frame of a
+        // one-shot sound is interpolated with silence.
+        const float* x0 = frameAt(frame);
+        const bool atEnd = frame + 1 >= m_endFrame;
+        const float* x1 = atEnd ? nullptr : frameAt(frame + 1);
+        if (x0 == nullptr || (x1 == nullptr && !atEnd)) {
+            // Data hasn't arrived in time; output silence and skip the
+            // missing frames so that the voice stays on schedule.
+            underrun = true;
+            position += rate;
+            continue;
+        }
+
+        const float a = float(position - double(frame));
+        const float gain = amp * envelope;
+        const float l1 = x1 == nullptr ? 0.f : x1[0];
+        const float r1 = x1 == nullptr ? 0.f : x1[rightChannel];
+        const float l = gain * (x0[0] + a * (l1 - x0[0]));
+        const float r = gain * (x0[rightChannel] + a * (r1 - x0[rightChannel]));
+        left[k] += l;
+        right[k] += r;
+
+        if (m_traceToken >= 0 && (l != 0.f || r != 0.f)) {
+            endTrace(methcla_world_current_time(world) + k / m_sampleRate);
+        }
+
+        position += rate;
+    }
+
+    m_position = position;
+    m_envelope = envelope;
+
+    if (m_stream != nullptr) {
+        if (underrun) {
+            m_stream->underrun();
+        }
+        m_stream->setRate(float(rate));
+        m_stream->release(int64_t(position));
+        if (m_done) {
+            DiskStreamer::instance()->closeStream(m_stream);
+            m_stream = nullptr;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,85 @@
+// Copyright 2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SAMPLER_PLUGINS_STREAM_VOICE_HPP_INCLUDED
+#define METHCLA_SAMPLER_PLUGINS_STREAM_VOICE_HPP_INCLUDED
+
+#include "stream_sampler.h"
+#include "DiskStreamer.hpp"
+
+#include <methcla/plugin.h>
+
+// Playback state of a voice streaming a sound from the active
+// DiskStreamer, shared by the stream sampler and parallel sampler plugins.
+// The controls are described in stream_sampler.h.
+//
+// Voices don't share any state, so different voices can be processed
+// concurrently.
+class StreamVoice
+{
+public:
+    enum Control
+    {
+        kAmp = kMethclaSampler_StreamSamplerAmp,
+        kRate = kMethclaSampler_StreamSamplerRate,
+        kSound = kMethclaSampler_StreamSamplerSound,
+        kGate = kMethclaSampler_StreamSamplerGate,
+        kRelease = kMethclaSampler_StreamSamplerRelease,
+        kTrace = kMethclaSampler_StreamSamplerTrace,
+        kNumControls
+    };
+
+    StreamVoice(double sampleRate, bool loop);
+    ~StreamVoice();
+
+    StreamVoice(const StreamVoice& other) = delete;
+    StreamVoice& operator=(const StreamVoice& other) = delete;
+
+    // Add numFrames frames of output to left and right. controls points to
+    // the kNumControls current control values. Returns false if the voice
+    // is silent, in which case nothing has been added.
+    bool process(const Methcla_World* world, const float* const* controls, float* left, float* right, size_t numFrames);
+
+private:
+    void endTrace(Methcla_Time soundTime);
+    void start(int32_t soundIndex);
+    void stop();
+    void release(float release);
+    const float* frameAt(int64_t frame) const;
+
+private:
+    double                  m_sampleRate;
+    bool                    m_loop;
+    float                   m_gate;
+    // Release envelope; decreases by m_envelopeStep per frame while
+    // releasing.
+    float                   m_envelope;
+    float                   m_envelopeStep;
+    bool                    m_releasing;
+    int32_t                 m_soundIndex;
+    const StreamSound*      m_sound;
+    Stream*                 m_stream;
+    // Playback position in frames. Increases monotonically; positions past
+    // the end of a looping sound wrap around in the stream.
+    double                  m_position;
+    // Frame at which the voice ends: the end of a one-shot sound, or the
+    // end of the head if no stream was available.
+    int64_t                 m_endFrame;
+    bool                    m_done;
+    // Latency trace of the current note, if any.
+    int32_t                 m_traceToken;
+    Methcla_Time            m_traceStartTime;
+};
+
+#endif // METHCLA_SAMPLER_PLUGINS_STREAM_VOICE_HPP_INCLUDED